@@ -0,0 +1,375 @@
+/*
+ *  BundleSolver.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "BundleSolver.hpp"
+
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/core/utility.hpp>
+#include <float.h>
+#include <math.h>
+
+#define BUNDLE_LAMBDA_LG10_INITIAL -3 // As cv::calibrateCamera()'s solver.
+#define BUNDLE_LAMBDA_LG10_MIN -16
+#define BUNDLE_LAMBDA_LG10_MAX 16
+
+typedef cv::Vec<double, 8> BundleIntrinsics; // fx, fy, cx, cy, k1, k2, p1, p2. The column order of cv::projectPoints()'s Jacobian.
+typedef cv::Vec<double, 6> BundlePose; // Rotation vector, translation.
+
+// One view's part of the normal equations, J^T J and J^T r, where r is the projected minus the observed corners
+// and J is the Jacobian of the projections.
+struct BundleViewBlocks {
+    cv::Matx<double, 8, 8> U; // Intrinsics x intrinsics.
+    cv::Matx<double, 8, 6> W; // Intrinsics x pose.
+    cv::Matx<double, 6, 6> V; // Pose x pose.
+    cv::Vec<double, 8> ga;
+    cv::Vec<double, 6> gb;
+    double cost; // Sum of squared residuals.
+    // Elimination of the pose, at the current damping.
+    cv::Matx<double, 8, 6> Y; // W (V damped)^-1.
+    bool ok; // Damped V was positive definite, so Y is valid.
+};
+
+static inline cv::Matx33d bundleCameraMatrix(const BundleIntrinsics& a)
+{
+    return cv::Matx33d(a[0], 0.0, a[2], 0.0, a[1], a[3], 0.0, 0.0, 1.0);
+}
+
+static inline cv::Vec4d bundleDistortionCoeff(const BundleIntrinsics& a)
+{
+    return cv::Vec4d(a[4], a[5], a[6], a[7]);
+}
+
+// Sum of squared residuals of a view, and optionally its blocks.
+static double bundleProject(const std::vector<cv::Point3f>& objectPoints, const CornerSet& cornerSet, const int view, const BundleIntrinsics& a, const BundlePose& b, std::vector<cv::Point2f>& projected, cv::Mat *jacobian, BundleViewBlocks *blocks)
+{
+    const cv::Vec3d rvec(b[0], b[1], b[2]), tvec(b[3], b[4], b[5]);
+    if (jacobian) cv::projectPoints(objectPoints, rvec, tvec, bundleCameraMatrix(a), bundleDistortionCoeff(a), projected, *jacobian);
+    else cv::projectPoints(objectPoints, rvec, tvec, bundleCameraMatrix(a), bundleDistortionCoeff(a), projected);
+    
+    const int n = cornerSet.pointCount();
+    const float *cx = cornerSet.x(view), *cy = cornerSet.y(view);
+    double cost = 0.0;
+    if (!blocks) {
+        for (int i = 0; i < n; i++) {
+            const double dx = projected[i].x - cx[i], dy = projected[i].y - cy[i];
+            cost += dx*dx + dy*dy;
+        }
+        return cost;
+    }
+    
+    // Accumulate J^T J and J^T r from the 2n x 14 Jacobian (pose columns first, then intrinsics).
+    double H[14][14] = {{0.0}};
+    double g[14] = {0.0};
+    for (int row = 0; row < 2*n; row++) {
+        const double *J = jacobian->ptr<double>(row);
+        const double r = (row & 1 ? (double)projected[row >> 1].y - cy[row >> 1] : (double)projected[row >> 1].x - cx[row >> 1]);
+        cost += r*r;
+        for (int j = 0; j < 14; j++) {
+            g[j] += J[j]*r;
+            for (int k = j; k < 14; k++) H[j][k] += J[j]*J[k];
+        }
+    }
+    for (int j = 0; j < 14; j++) for (int k = 0; k < j; k++) H[j][k] = H[k][j];
+    for (int j = 0; j < 6; j++) {
+        blocks->gb[j] = g[j];
+        for (int k = 0; k < 6; k++) blocks->V(j, k) = H[j][k];
+    }
+    for (int j = 0; j < 8; j++) {
+        blocks->ga[j] = g[6 + j];
+        for (int k = 0; k < 6; k++) blocks->W(j, k) = H[6 + j][k];
+        for (int k = 0; k < 8; k++) blocks->U(j, k) = H[6 + j][6 + k];
+    }
+    blocks->cost = cost;
+    return cost;
+}
+
+// Linearise each view at the current intrinsics and poses.
+class BundleLineariseBody : public cv::ParallelLoopBody
+{
+public:
+    BundleLineariseBody(const std::vector<cv::Point3f>& objectPoints,
+                        const CornerSet& cornerSet,
+                        const BundleIntrinsics& a,
+                        const std::vector<BundlePose>& poses,
+                        std::vector<BundleViewBlocks>& blocks) :
+        m_objectPoints(objectPoints),
+        m_cornerSet(cornerSet),
+        m_a(a),
+        m_poses(poses),
+        m_blocks(blocks)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        std::vector<cv::Point2f> projected;
+        cv::Mat jacobian;
+        for (int k = range.start; k < range.end; k++) {
+            bundleProject(m_objectPoints, m_cornerSet, k, m_a, m_poses[k], projected, &jacobian, &m_blocks[k]);
+        }
+    }
+
+private:
+    const std::vector<cv::Point3f>& m_objectPoints;
+    const CornerSet& m_cornerSet;
+    const BundleIntrinsics& m_a;
+    const std::vector<BundlePose>& m_poses;
+    std::vector<BundleViewBlocks>& m_blocks;
+};
+
+// Eliminate each view's pose from the damped normal equations.
+class BundleEliminateBody : public cv::ParallelLoopBody
+{
+public:
+    BundleEliminateBody(const double lambda, std::vector<BundleViewBlocks>& blocks) :
+        m_lambda(lambda),
+        m_blocks(blocks)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        for (int k = range.start; k < range.end; k++) {
+            BundleViewBlocks& blocks = m_blocks[k];
+            cv::Matx<double, 6, 6> V = blocks.V;
+            for (int j = 0; j < 6; j++) V(j, j) *= 1.0 + m_lambda;
+            // Y = W V^-1, i.e. V Y^T = W^T, as V is symmetric. If V isn't positive definite (the view's corners
+            // don't determine its pose), the step can't be taken at this damping.
+            cv::Matx<double, 6, 8> Yt;
+            blocks.ok = cv::solve(V, blocks.W.t(), Yt, cv::DECOMP_CHOLESKY);
+            blocks.Y = Yt.t();
+        }
+    }
+
+private:
+    const double m_lambda;
+    std::vector<BundleViewBlocks>& m_blocks;
+};
+
+// Given the intrinsics step, find each view's pose step, and the cost at the stepped parameters.
+class BundleStepBody : public cv::ParallelLoopBody
+{
+public:
+    BundleStepBody(const std::vector<cv::Point3f>& objectPoints,
+                   const CornerSet& cornerSet,
+                   const double lambda,
+                   const std::vector<BundleViewBlocks>& blocks,
+                   const BundleIntrinsics& aStepped,
+                   const cv::Vec<double, 8>& da,
+                   const std::vector<BundlePose>& poses,
+                   std::vector<BundlePose>& posesStepped,
+                   std::vector<double>& costs,
+                   std::vector<double>& stepNormsSq) :
+        m_objectPoints(objectPoints),
+        m_cornerSet(cornerSet),
+        m_lambda(lambda),
+        m_blocks(blocks),
+        m_aStepped(aStepped),
+        m_da(da),
+        m_poses(poses),
+        m_posesStepped(posesStepped),
+        m_costs(costs),
+        m_stepNormsSq(stepNormsSq)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        std::vector<cv::Point2f> projected;
+        for (int k = range.start; k < range.end; k++) {
+            const BundleViewBlocks& blocks = m_blocks[k];
+            // V db = gb - W^T da.
+            cv::Matx<double, 6, 6> V = blocks.V;
+            for (int j = 0; j < 6; j++) V(j, j) *= 1.0 + m_lambda;
+            const cv::Vec<double, 6> rhs = blocks.gb - blocks.W.t()*m_da;
+            cv::Vec<double, 6> db;
+            cv::solve(V, rhs, db, cv::DECOMP_CHOLESKY); // Succeeds, as BundleEliminateBody factorised the same V.
+            m_posesStepped[k] = m_poses[k] - db;
+            m_stepNormsSq[k] = db.dot(db);
+            m_costs[k] = bundleProject(m_objectPoints, m_cornerSet, k, m_aStepped, m_posesStepped[k], projected, NULL, NULL);
+        }
+    }
+
+private:
+    const std::vector<cv::Point3f>& m_objectPoints;
+    const CornerSet& m_cornerSet;
+    const double m_lambda;
+    const std::vector<BundleViewBlocks>& m_blocks;
+    const BundleIntrinsics& m_aStepped;
+    const cv::Vec<double, 8>& m_da;
+    const std::vector<BundlePose>& m_poses;
+    std::vector<BundlePose>& m_posesStepped;
+    std::vector<double>& m_costs;
+    std::vector<double>& m_stepNormsSq;
+};
+
+// Initial pose of each view, under the initial intrinsics.
+class BundleInitPosesBody : public cv::ParallelLoopBody
+{
+public:
+    BundleInitPosesBody(const std::vector<cv::Point3f>& objectPoints,
+                        const CornerSet& cornerSet,
+                        const BundleIntrinsics& a,
+                        std::vector<BundlePose>& poses) :
+        m_objectPoints(objectPoints),
+        m_cornerSet(cornerSet),
+        m_a(a),
+        m_poses(poses)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        std::vector<cv::Point2f> corners;
+        for (int k = range.start; k < range.end; k++) {
+            cv::Vec3d rvec, tvec;
+            m_cornerSet.copyView(k, corners);
+            cv::solvePnP(m_objectPoints, corners, bundleCameraMatrix(m_a), bundleDistortionCoeff(m_a), rvec, tvec, false, cv::SOLVEPNP_ITERATIVE);
+            m_poses[k] = BundlePose(rvec[0], rvec[1], rvec[2], tvec[0], tvec[1], tvec[2]);
+        }
+    }
+
+private:
+    const std::vector<cv::Point3f>& m_objectPoints;
+    const CornerSet& m_cornerSet;
+    const BundleIntrinsics& m_a;
+    std::vector<BundlePose>& m_poses;
+};
+
+double bundleCalibrateCamera(const std::vector<cv::Point3f>& objectPoints,
+                             const CornerSet& cornerSet,
+                             const cv::Size imageSize,
+                             cv::Mat& cameraMatrix,
+                             cv::Mat& distortionCoeff,
+                             std::vector<cv::Mat>& rotationVectors,
+                             std::vector<cv::Mat>& translationVectors,
+                             const bool useIntrinsicGuess,
+                             const cv::TermCriteria& criteria)
+{
+    const int viewCount = cornerSet.viewCount();
+    const int iterationsMax = (criteria.type & cv::TermCriteria::COUNT ? criteria.maxCount : 30);
+    const double epsilon = (criteria.type & cv::TermCriteria::EPS ? criteria.epsilon : DBL_EPSILON);
+    
+    // Initial intrinsics.
+    BundleIntrinsics a;
+    if (useIntrinsicGuess) {
+        cv::Mat K, d;
+        cameraMatrix.convertTo(K, CV_64F);
+        distortionCoeff.convertTo(d, CV_64F);
+        a = BundleIntrinsics(K.at<double>(0, 0), K.at<double>(1, 1), K.at<double>(0, 2), K.at<double>(1, 2), d.at<double>(0), d.at<double>(1), d.at<double>(2), d.at<double>(3));
+    } else {
+        const std::vector<std::vector<cv::Point3f> > objectPointSet(viewCount, objectPoints);
+        std::vector<std::vector<cv::Point2f> > imagePointSet;
+        cornerSet.copyViews(imagePointSet);
+        const cv::Mat K = cv::initCameraMatrix2D(objectPointSet, imagePointSet, imageSize, 0.0);
+        a = BundleIntrinsics(K.at<double>(0, 0), K.at<double>(1, 1), K.at<double>(0, 2), K.at<double>(1, 2), 0.0, 0.0, 0.0, 0.0);
+    }
+    
+    // Initial poses.
+    std::vector<BundlePose> poses(viewCount), posesStepped(viewCount);
+    cv::parallel_for_(cv::Range(0, viewCount), BundleInitPosesBody(objectPoints, cornerSet, a, poses));
+    
+    std::vector<BundleViewBlocks> blocks(viewCount);
+    std::vector<double> costs(viewCount), stepNormsSq(viewCount);
+    int lambdaLg10 = BUNDLE_LAMBDA_LG10_INITIAL;
+    double cost = 0.0;
+    
+    for (int iteration = 0; iteration < iterationsMax; ) {
+        
+        // Linearise, and sum the views' costs and intrinsics blocks. Sums are in view order, so the result doesn't
+        // depend on scheduling.
+        cv::parallel_for_(cv::Range(0, viewCount), BundleLineariseBody(objectPoints, cornerSet, a, poses, blocks));
+        cost = 0.0;
+        cv::Matx<double, 8, 8> U;
+        cv::Vec<double, 8> ga;
+        double paramNormSq = a.dot(a);
+        for (int k = 0; k < viewCount; k++) {
+            cost += blocks[k].cost;
+            U += blocks[k].U;
+            ga += blocks[k].ga;
+            paramNormSq += poses[k].dot(poses[k]);
+        }
+        
+        // Try steps of increasing damping until one reduces the cost.
+        bool accepted = false;
+        bool singular = false;
+        double stepNormSq = 0.0;
+        while (!accepted && lambdaLg10 <= BUNDLE_LAMBDA_LG10_MAX) {
+            const double lambda = pow(10.0, lambdaLg10);
+            
+            // Reduced system: (U - sum W V^-1 W^T) da = ga - sum W V^-1 gb. Every view's pose block must be
+            // invertible. If one isn't, more damping may make it so.
+            cv::parallel_for_(cv::Range(0, viewCount), BundleEliminateBody(lambda, blocks));
+            singular = false;
+            for (int k = 0; k < viewCount && !singular; k++) singular = !blocks[k].ok;
+            if (singular) {
+                lambdaLg10++;
+                continue;
+            }
+            cv::Matx<double, 8, 8> S = U;
+            for (int j = 0; j < 8; j++) S(j, j) *= 1.0 + lambda;
+            cv::Vec<double, 8> e = ga;
+            for (int k = 0; k < viewCount; k++) {
+                S -= blocks[k].Y*blocks[k].W.t();
+                e -= blocks[k].Y*blocks[k].gb;
+            }
+            cv::Vec<double, 8> da;
+            if (!cv::solve(S, e, da, cv::DECOMP_CHOLESKY)) cv::solve(S, e, da, cv::DECOMP_SVD);
+            
+            const BundleIntrinsics aStepped = a - da;
+            cv::parallel_for_(cv::Range(0, viewCount), BundleStepBody(objectPoints, cornerSet, lambda, blocks, aStepped, da, poses, posesStepped, costs, stepNormsSq));
+            double costStepped = 0.0;
+            stepNormSq = da.dot(da);
+            for (int k = 0; k < viewCount; k++) {
+                costStepped += costs[k];
+                stepNormSq += stepNormsSq[k];
+            }
+            
+            if (costStepped <= cost) {
+                a = aStepped;
+                poses.swap(posesStepped);
+                cost = costStepped;
+                lambdaLg10 = std::max(lambdaLg10 - 1, BUNDLE_LAMBDA_LG10_MIN);
+                accepted = true;
+            } else {
+                lambdaLg10++;
+            }
+        }
+        if (singular) return (-1.0); // A view's pose can't be solved for at any damping.
+        if (!accepted) break; // No step reduces the cost.
+        iteration++;
+        if (sqrt(stepNormSq) < epsilon*sqrt(paramNormSq)) break;
+    }
+    
+    cameraMatrix = cv::Mat(bundleCameraMatrix(a), true);
+    distortionCoeff = (cv::Mat_<double>(4, 1) << a[4], a[5], a[6], a[7]);
+    rotationVectors.resize(viewCount);
+    translationVectors.resize(viewCount);
+    for (int k = 0; k < viewCount; k++) {
+        rotationVectors[k] = (cv::Mat_<double>(3, 1) << poses[k][0], poses[k][1], poses[k][2]);
+        translationVectors[k] = (cv::Mat_<double>(3, 1) << poses[k][3], poses[k][4], poses[k][5]);
+    }
+    const int pointCount = viewCount*cornerSet.pointCount();
+    return (pointCount ? sqrt(cost/pointCount) : 0.0);
+}
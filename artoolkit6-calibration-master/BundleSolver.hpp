@@ -0,0 +1,54 @@
+/*
+ *  BundleSolver.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include "CornerSet.hpp"
+
+// Camera calibration from views of a planar pattern by sparse Levenberg-Marquardt bundle adjustment, for calibrations
+// of hundreds or thousands of views. It solves for the same model as cv::calibrateCamera() with CALIB_FIX_K3, K4 and
+// K5 (focal lengths, principal point, k1, k2, p1, p2, and a pose for each view), with the same initialisation,
+// damping and stopping rule, so the two reach the same solution.
+//
+// Each view's pose affects only its own corners, so the normal equations have an 8x8 block for the intrinsics, a
+// 6x6 block for each view, and 8x6 blocks coupling them, and nothing else. The view blocks are eliminated with
+// the Schur complement, leaving an 8x8 system, so an iteration takes time linear in the number of views, where
+// cv::calibrateCamera() solves a dense system of 8 + 6 x views unknowns. Each view's Jacobian and elimination is
+// independent of the others, and these run in parallel.
+//
+// Arguments and result are as cv::calibrateCamera(). If useIntrinsicGuess is true, cameraMatrix and distortionCoeff
+// (4x1) hold the intrinsics to start from; otherwise, the start is estimated from homographies of the views.
+// Returns the RMS reprojection error, in pixels, or -1 if the solve failed because a view's pose block of the normal
+// equations was singular at every damping (e.g. its corners are degenerate). The outputs are then not valid.
+double bundleCalibrateCamera(const std::vector<cv::Point3f>& objectPoints,
+                             const CornerSet& cornerSet,
+                             const cv::Size imageSize,
+                             cv::Mat& cameraMatrix,
+                             cv::Mat& distortionCoeff,
+                             std::vector<cv::Mat>& rotationVectors,
+                             std::vector<cv::Mat>& translationVectors,
+                             const bool useIntrinsicGuess,
+                             const cv::TermCriteria& criteria);
@@ -24,9 +24,85 @@
  */
 
 #include "Calibration.hpp"
+#include <algorithm>
+#include <cmath>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
 #include "calc.hpp"
+#include "lumaUtil.hpp"
+
+#define CORNER_FINDER_PYRAMID_WIDTH_MIN 640
+#define CORNER_FINDER_ROI_PYRAMID_WIDTH_MIN 320 // Minimum width of a decimated region of interest.
+#define CORNER_FINDER_ROI_PADDING_FACTOR 0.25f // Padding added to each side of the corners' bounding box, as a fraction of the box size.
+#define CORNER_FINDER_ROI_PADDING_MIN 32 // Minimum padding, in pixels.
+#define CORNER_TRACKER_REDETECT_INTERVAL_DEFAULT 10
+// Sharpness is 100 times the gradient energy per unit of luma variance, which doesn't depend on contrast, scaled to
+// 640 pixels frame width. For a chessboard of s-pixel squares blurred by a Gaussian of sigma pixels, it is about
+// 226/(s*sigma), whether or not the board fills the frame (measured: 9.4 sharp, 3.0 at sigma 2, 2.1 at sigma 3, for
+// s = 40, a 7x5 board across most of the frame). The default passes that board up to sigma 2, beyond which an edge
+// spreads across cornerSubPix()'s 11x11 window.
+#define CORNER_FINDER_SHARPNESS_THRESHOLD_DEFAULT 2.5f
+#define CORNER_FINDER_SHARPNESS_ROW_STEP 4 // Sharpness is measured on every nth row.
+#define CORNER_FINDER_SHARPNESS_VARIANCE_MIN 1.0f // Frames flatter than this (e.g. with the lens covered) score 0.
+#define AUTO_CAPTURE_STABLE_FRAME_COUNT_DEFAULT 5
+#define AUTO_CAPTURE_STABLE_MOTION_MAX 1.5f // Largest movement of any corner between results for the pattern to be still, in pixels at 640 pixels frame width.
+#define AUTO_CAPTURE_SCORE_MIN_DEFAULT 0.6f
+#define DETECTION_HISTORY_COUNT 8 // Recent detections kept for pairing with another stream. Enough to span a few frames of the slower of two streams.
+#define SOLVER_VIEW_COUNT_MIN 3 // Fewer views don't constrain the intrinsics usefully.
+#define SOLVER_CONVERGED_VIEW_COUNT_MIN 6
+#define SOLVER_CONVERGED_FOCAL_CHANGE_MAX 0.005 // Relative.
+#define SOLVER_CONVERGED_PRINCIPAL_POINT_CHANGE_MAX 0.005 // As a fraction of the image width.
+#define SOLVER_CONVERGED_K1_CHANGE_MAX 0.01
+#define CORNER_TRACKER_WINDOW_SIZE 21 // Lucas-Kanade search window, in pixels at each pyramid level.
+#define CORNER_TRACKER_PYRAMID_LEVELS 3
+#define CORNER_TRACKER_RESIDUAL_RMS_MAX 2.0 // Largest acceptable RMS distance of tracked corners from the fitted homography, in pixels.
+#define CORNER_TRACKER_RESIDUAL_MAX 5.0 // Largest acceptable distance of any one tracked corner from the fitted homography, in pixels.
+#define CORNER_TRACKER_REFINE_ITERATIONS_MAX 5 // Refinement of tracked corners, enough to stop them drifting. Captured views are refined fully.
+#define CORNER_TRACKER_REFINE_EPS 0.1
+
+//
+// Reference-counted frames, and the pool they are drawn from.
+//
+
+void Calibration::CalibrationFrame::retain()
+{
+    refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Calibration::CalibrationFrame::release()
+{
+    // Once the count reaches zero, the pool may hand the frame out again, so
+    // writes to the buffer by the next user must not be reordered before our reads.
+    refCount.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+Calibration::CalibrationFramePool::CalibrationFramePool(const int count, const int videoWidth, const int videoHeight) :
+    m_frames(count)
+{
+    for (CalibrationFrame& frame : m_frames) {
+        arMalloc(frame.buff, uint8_t, videoWidth * videoHeight);
+        frame.timestamp = {0, 0};
+        frame.refCount.store(0);
+    }
+}
+
+Calibration::CalibrationFramePool::~CalibrationFramePool()
+{
+    for (CalibrationFrame& frame : m_frames) {
+        if (frame.refCount.load() != 0) ARLOGw("Warning: frame released with %d references outstanding.\n", frame.refCount.load());
+        free(frame.buff);
+    }
+}
+
+Calibration::CalibrationFrame *Calibration::CalibrationFramePool::checkout()
+{
+    for (CalibrationFrame& frame : m_frames) {
+        int expected = 0;
+        if (frame.refCount.compare_exchange_strong(expected, 1, std::memory_order_acquire)) return &frame;
+    }
+    return NULL;
+}
 
 //
 // A class to encapsulate the inputs and outputs of a corner-finding run, and to allow for copying of the results
@@ -38,10 +114,19 @@ Calibration::CalibrationCornerFinderData::CalibrationCornerFinderData(const Cali
     patternSize(patternSize_in),
     videoWidth(videoWidth_in),
     videoHeight(videoHeight_in),
+    frame(NULL),
+    timestamp({0, 0}),
+    roi(),
+    pyramidLevelMax(0),
     cornerFoundAllFlag(0),
-    corners()
+    pyramidLevel(-1),
+    tracked(false),
+    coverageScore(0.0f),
+    corners(),
+    trackFrame(NULL),
+    trackCorners(),
+    patternModel(NULL)
 {
-    init();
 }
 
 // copy constructor.
@@ -50,56 +135,58 @@ Calibration::CalibrationCornerFinderData::CalibrationCornerFinderData(const Cali
     patternSize(orig.patternSize),
     videoWidth(orig.videoWidth),
     videoHeight(orig.videoHeight),
+    frame(orig.frame),
+    timestamp(orig.timestamp),
+    roi(orig.roi),
+    pyramidLevelMax(orig.pyramidLevelMax),
     cornerFoundAllFlag(orig.cornerFoundAllFlag),
-    corners(orig.corners)
+    pyramidLevel(orig.pyramidLevel),
+    tracked(orig.tracked),
+    coverageScore(orig.coverageScore),
+    corners(orig.corners),
+    trackFrame(NULL),
+    trackCorners(),
+    patternModel(orig.patternModel)
 {
-    init();
-    copy(orig);
+    if (frame) frame->retain();
 }
 
 // copy assignement.
 const Calibration::CalibrationCornerFinderData& Calibration::CalibrationCornerFinderData::operator=(const Calibration::CalibrationCornerFinderData& orig)
 {
     if (this != &orig) {
-        dealloc();
+        if (orig.frame) orig.frame->retain();
+        if (frame) frame->release();
         patternType = orig.patternType;
         patternSize = orig.patternSize;
         videoWidth = orig.videoWidth;
         videoHeight = orig.videoHeight;
+        frame = orig.frame;
+        timestamp = orig.timestamp;
+        roi = orig.roi;
+        pyramidLevelMax = orig.pyramidLevelMax;
         cornerFoundAllFlag = orig.cornerFoundAllFlag;
+        pyramidLevel = orig.pyramidLevel;
+        tracked = orig.tracked;
+        coverageScore = orig.coverageScore;
         corners = orig.corners;
-        init();
-        copy(orig);
+        patternModel = orig.patternModel;
     }
     return *this;
 }
 
 Calibration::CalibrationCornerFinderData::~CalibrationCornerFinderData()
 {
-    dealloc();
+    if (frame) frame->release();
+    if (trackFrame) trackFrame->release();
 }
 
-void Calibration::CalibrationCornerFinderData::init()
+void Calibration::CalibrationCornerFinderData::setFrame(CalibrationFrame *frame_in)
 {
-    if (videoWidth > 0 && videoHeight > 0) {
-        arMalloc(videoFrame, uint8_t, videoWidth * videoHeight);
-        calibImage = cvCreateImageHeader(cvSize(videoWidth, videoHeight), IPL_DEPTH_8U, 1);
-        cvSetData(calibImage, videoFrame, videoWidth); // Last parameter is rowBytes.
-    } else {
-        videoFrame = nullptr;
-        calibImage = nullptr;
-    }
-}
-
-void Calibration::CalibrationCornerFinderData::copy(const CalibrationCornerFinderData& orig)
-{
-    memcpy(videoFrame, orig.videoFrame, sizeof(uint8_t) * videoWidth * videoHeight);
-}
-
-void Calibration::CalibrationCornerFinderData::dealloc()
-{
-    if (calibImage) cvReleaseImageHeader(&calibImage);
-    free(videoFrame);
+    if (frame) frame->release();
+    frame = frame_in;
+    if (frame) timestamp = frame->timestamp;
+    else timestamp = {0, 0};
 }
 
 
@@ -118,72 +205,381 @@ std::map<Calibration::CalibrationPatternType, float> Calibration::CalibrationPat
     {Calibration::CalibrationPatternType::ASYMMETRIC_CIRCLES_GRID, 20.0f}
 };
 
-Calibration::Calibration(const CalibrationPatternType patternType, const int calibImageCountMax, const cv::Size patternSize, const int chessboardSquareWidth, const int videoWidth, const int videoHeight) :
-    m_cornerFinderData(patternType, patternSize, videoWidth, videoHeight),
-    m_cornerFinderResultData(patternType, patternSize, 0, 0),
+std::map<Calibration::CalibrationPatternType, int> Calibration::CalibrationPatternPyramidLevels = {
+    {Calibration::CalibrationPatternType::CHESSBOARD, 2},
+    {Calibration::CalibrationPatternType::CIRCLES_GRID, 1},
+    {Calibration::CalibrationPatternType::ASYMMETRIC_CIRCLES_GRID, 1}
+};
+
+#define CORNER_FINDER_RESULT_INDEX_MASK 0x3
+#define CORNER_FINDER_RESULT_FRESH 0x4
+
+// Returns true if timestamp a is later than timestamp b.
+static inline bool timestampIsNewer(const AR2VideoTimestampT& a, const AR2VideoTimestampT& b)
+{
+    return (a.sec > b.sec || (a.sec == b.sec && a.usec > b.usec));
+}
+
+Calibration::CornerFinderPool::CornerFinderPool(const int workerCount) :
+    m_workers()
+{
+    pthread_mutex_init(&m_lock, NULL);
+    
+    int count = workerCount;
+    if (count <= 0) {
+        count = threadGetCPU() - 1;
+        if (count < 1) count = 1;
+    }
+    ARLOGi("Using %d corner finder thread%s.\n", count, (count == 1 ? "" : "s"));
+    
+    for (int i = 0; i < count; i++) {
+        Worker *worker = new Worker;
+        worker->data = NULL;
+        worker->claimed = false;
+        worker->thread = threadInit(i, (void *)worker, cornerFinder);
+        if (!worker->thread) {
+            ARLOGe("Error starting corner finder thread %d.\n", i);
+            delete worker;
+            break;
+        }
+        m_workers.push_back(worker);
+    }
+}
+
+Calibration::CornerFinderPool::~CornerFinderPool()
+{
+    for (Worker *worker : m_workers) {
+        threadWaitQuit(worker->thread);
+        threadFree(&worker->thread);
+        delete worker;
+    }
+    m_workers.clear();
+    pthread_mutex_destroy(&m_lock);
+}
+
+int Calibration::CornerFinderPool::claim()
+{
+    int ret = -1;
+    pthread_mutex_lock(&m_lock);
+    for (int i = 0; i < (int)m_workers.size(); i++) {
+        if (!m_workers[i]->claimed) {
+            m_workers[i]->claimed = true;
+            ret = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&m_lock);
+    return ret;
+}
+
+void Calibration::CornerFinderPool::release(const int worker)
+{
+    pthread_mutex_lock(&m_lock);
+    m_workers[worker]->claimed = false;
+    pthread_mutex_unlock(&m_lock);
+}
+
+Calibration::Calibration(const CalibrationPatternType patternType, const int calibImageCountMax, const cv::Size patternSize, const int chessboardSquareWidth, const int videoWidth, const int videoHeight, const int cornerFinderWorkerCount) :
+    Calibration(patternType, calibImageCountMax, patternSize, chessboardSquareWidth, videoWidth, videoHeight, new CornerFinderPool(cornerFinderWorkerCount))
+{
+    m_cornerFinderPoolOwned = true;
+}
+
+Calibration::Calibration(const CalibrationPatternType patternType, const int calibImageCountMax, const cv::Size patternSize, const int chessboardSquareWidth, const int videoWidth, const int videoHeight, CornerFinderPool *cornerFinderPool) :
+    m_cornerFinderPool(cornerFinderPool),
+    m_cornerFinderPoolOwned(false),
+    m_cornerFinderData(),
+    m_cornerFinderClaimed(),
+    m_framePool(NULL),
+    m_frameLastTimestamp({0, 0}),
+    m_frameSubmittedCount(0),
+    m_frameDroppedCount(0),
+    m_frameDuplicateCount(0),
+    m_sharpnessThreshold(CORNER_FINDER_SHARPNESS_THRESHOLD_DEFAULT),
+    m_frameBlurredCount(0),
+    m_lastFrameSharpness(0.0f),
+    m_lastFrameBlurred(false),
+    m_cornerFinderResultData(3, CalibrationCornerFinderData(patternType, patternSize, videoWidth, videoHeight)),
+    m_cornerFinderResultBack(0),
+    m_cornerFinderResultMiddle(1),
+    m_cornerFinderResultFront(2),
+    m_cornerFinderResultTimestamp({0, 0}),
+    m_roiTrackingEnabled(true),
+    m_roi(),
+    m_roiSearchCount(0),
+    m_roiHitCount(0),
+    m_trackingEnabled(true),
+    m_trackingRedetectInterval(CORNER_TRACKER_REDETECT_INTERVAL_DEFAULT),
+    m_trackingRunLength(0),
+    m_trackCount(0),
+    m_trackHitCount(0),
+    m_patternModel(),
+    m_cornerFinderCaptureData(patternType, patternSize, videoWidth, videoHeight),
+    m_cornerFinderCaptureStable(false),
+    m_captureCorners(),
+    m_autoCaptureEnabled(false),
+    m_autoCaptureStableFrameCount(AUTO_CAPTURE_STABLE_FRAME_COUNT_DEFAULT),
+    m_stableCount(0),
+    m_stableCorners(),
+    m_autoCaptureScoreMin(AUTO_CAPTURE_SCORE_MIN_DEFAULT),
+    m_autoCaptureReady(false),
+    m_coverage(patternSize, videoWidth, videoHeight),
+    m_detections(DETECTION_HISTORY_COUNT),
+    m_detectionNext(0),
+    m_detectionCount(0),
+    m_detectionCurrent(false),
+    m_solverThread(NULL),
+    m_solverEstimate(),
+    m_solverStatus(),
+    m_solverStatusValid(false),
+    m_corners(patternSize.area()),
     m_calibImageCountMax(calibImageCountMax),
+    m_calibViewSubsetCount(0),
+    m_calibOutlierRejectionEnabled(false),
+    m_calibUncertaintyMethod(UncertaintyMethod::BOOTSTRAP),
+    m_calibUncertaintySampleCount(0),
+    m_calibUncertainty(),
+    m_calibUncertaintyValid(false),
     m_patternType(patternType),
     m_patternSize(patternSize),
     m_chessboardSquareWidth(chessboardSquareWidth),
+    m_pyramidLevelMax(0),
     m_videoWidth(videoWidth),
-    m_videoHeight(videoHeight),
-    m_corners()
+    m_videoHeight(videoHeight)
 {
-    // Spawn the corner finder worker thread.
-    m_cornerFinderThread = threadInit(0, (void *)(&m_cornerFinderData), cornerFinder);
+    pthread_mutex_init(&m_cornerFinderCaptureLock, NULL);
+    pthread_mutex_init(&m_solverLock, NULL);
+    
+    // Reserve space for a full set of corners in the results, so that publishing never allocates.
+    for (CalibrationCornerFinderData& result : m_cornerFinderResultData) result.corners.reserve(patternSize.area());
+    m_cornerFinderCaptureData.corners.reserve(patternSize.area());
+    m_captureCorners.reserve(patternSize.area());
+    m_corners.reserve(calibImageCountMax);
+    m_stableCorners.reserve(patternSize.area());
+    for (Detection& detection : m_detections) {
+        detection.corners.reserve(patternSize.area());
+        detection.frame = NULL;
+    }
+    
+    m_pyramidLevelMax = pyramidLevelMaxForWidth(patternType, videoWidth);
+    ARLOGi("Corner finder pyramid levels: %d.\n", m_pyramidLevelMax);
+    
+    // Tracked corners are checked against the layout of the pattern. Only its shape matters, so unit spacing is used.
+    std::vector<cv::Point3f> patternModel3D;
+    calcChessboardCorners(patternType, patternSize, 1.0f, patternModel3D);
+    for (const cv::Point3f& p : patternModel3D) m_patternModel.push_back(cv::Point2f(p.x, p.y));
+    
+    // An input and output for each of the pool's workers, used while this Calibration has claimed that worker.
+    const int workerCount = m_cornerFinderPool->workerCount();
+    for (int i = 0; i < workerCount; i++) {
+        CalibrationCornerFinderData *cornerFinderData = new CalibrationCornerFinderData(patternType, patternSize, videoWidth, videoHeight);
+        cornerFinderData->pyramidLevelMax = m_pyramidLevelMax;
+        cornerFinderData->patternModel = &m_patternModel;
+        cornerFinderData->trackCorners.reserve(patternSize.area());
+        m_cornerFinderData.push_back(cornerFinderData);
+    }
+    m_cornerFinderClaimed.assign(workerCount, false);
     
-    pthread_mutex_init(&m_cornerFinderResultLock, NULL);
+    // Each worker holds at most two frames (the frame being searched, and the frame being tracked from), and the
+    // published results hold up to four more (three triple buffer slots and the capture copy). Kept detections of
+    // tracked corners hold theirs until refined at capture, and capture() holds one while refining. One spare allows
+    // a new frame to be checked out while a just-finished worker's frame is still referenced.
+    m_framePool = new CalibrationFramePool(workerCount*2 + DETECTION_HISTORY_COUNT + 6, videoWidth, videoHeight);
+    
+    m_solverThread = threadInit(workerCount, (void *)this, solver);
+    if (!m_solverThread) ARLOGe("Error starting calibration solver thread.\n");
+}
+
+int Calibration::cornerFinderWorkerCount() const
+{
+    return m_cornerFinderPool->workerCount();
 }
 
-bool Calibration::frame(ARVideoSource *vs)
+void Calibration::collectResults()
 {
     //
     // Start of main calibration-related cycle.
     //
     
-    // First, see if an image has been completely processed.
-    if (threadGetStatus(m_cornerFinderThread)) {
-        threadEndWait(m_cornerFinderThread); // We know from status above that worker has already finished, so this just resets it.
+    // First, see if any images have been completely processed. With more than one worker, runs can
+    // complete out of order, so only a result for a frame later than the one already published is
+    // taken, and results for earlier frames are discarded.
+    int newest = -1;
+    for (int i = 0; i < (int)m_cornerFinderData.size(); i++) {
+        if (m_cornerFinderClaimed[i] && threadGetStatus(m_cornerFinderPool->m_workers[i]->thread)) {
+            threadEndWait(m_cornerFinderPool->m_workers[i]->thread); // We know from status above that worker has already finished, so this just resets it.
+            m_cornerFinderClaimed[i] = false;
+            m_cornerFinderPool->release(i); // The results stay in m_cornerFinderData[i] until this Calibration claims the worker again.
+            if (m_cornerFinderData[i]->tracked) {
+                m_trackHitCount++;
+            } else if (m_cornerFinderData[i]->roi.area() > 0) {
+                m_roiSearchCount++;
+                if (m_cornerFinderData[i]->cornerFoundAllFlag) m_roiHitCount++;
+            }
+            if (timestampIsNewer(m_cornerFinderData[i]->timestamp, (newest == -1 ? m_cornerFinderResultTimestamp : m_cornerFinderData[newest]->timestamp))) {
+                newest = i;
+            }
+        }
+    }
+    if (newest != -1) {
+        publishResults(*m_cornerFinderData[newest]);
         
-        // Copy the results.
-        pthread_mutex_lock(&m_cornerFinderResultLock); // Results are also read by GL thread, so need to lock before modifying.
-        m_cornerFinderResultData = m_cornerFinderData;
-        pthread_mutex_unlock(&m_cornerFinderResultLock);
-    }
-    
-    // If corner finder worker thread is ready and waiting, submit the new image.
-    if (!threadGetBusyStatus(m_cornerFinderThread)) {
-        // As corner finding takes longer than a single frame capture, we need to copy the incoming image
-        // so that OpenCV has exclusive use of it. We copy into cornerFinderData->videoFrame which provides
-        // the backing for calibImage.
-        AR2VideoBufferT *buff = vs->checkoutFrameIfNewerThan({0,0});
-        if (buff) {
-            memcpy(m_cornerFinderData.videoFrame, buff->buffLuma, vs->getVideoWidth()*vs->getVideoHeight());
-            vs->checkinFrame();
-            
-            // Kick off a new cycle of the cornerFinder. The results will be collected on a subsequent cycle.
-            threadStartSignal(m_cornerFinderThread);
+        // Predict where to search next: close to where the pattern was just found.
+        updateROI(*m_cornerFinderData[newest]);
+    }
+}
+
+void Calibration::submitFrame(const AR2VideoBufferT *buff)
+{
+    m_frameLastTimestamp = buff->time;
+    
+    // Don't waste a corner finder run, or a copy into the frame pool, on a blurred frame. Only its sharpness and
+    // blurred flag are published. The results, and the tracking, stability and region of interest state derived from
+    // them, are left alone, as blur is usually momentary. The display holds the last searched frame meanwhile.
+    float variance;
+    const float gradientEnergy = lumaUtilGradientEnergy(buff->buffLuma, m_videoWidth, m_videoHeight, m_videoWidth, CORNER_FINDER_SHARPNESS_ROW_STEP, &variance);
+    const float widthScale = (float)m_videoWidth / 640.0f;
+    const float sharpness = (variance < CORNER_FINDER_SHARPNESS_VARIANCE_MIN ? 0.0f : 100.0f * gradientEnergy / variance * widthScale*widthScale);
+    const bool blurred = (sharpness < m_sharpnessThreshold);
+    m_lastFrameSharpness.store(sharpness, std::memory_order_relaxed);
+    m_lastFrameBlurred.store(blurred, std::memory_order_relaxed);
+    if (blurred) {
+        m_frameBlurredCount++;
+        return;
+    }
+    
+    // If a corner finder worker thread is ready and waiting, claim it and submit the new image to it.
+    int idle = m_cornerFinderPool->claim();
+    CalibrationFrame *frame = (idle == -1 ? NULL : m_framePool->checkout());
+    if (!frame) {
+        if (idle != -1) m_cornerFinderPool->release(idle);
+        m_frameDroppedCount++;
+    } else {
+        // The video source will reuse its buffer once the frame is checked in, so a single copy into a pooled
+        // frame is needed. From there on, the corner finder and the published results share the pooled frame.
+        memcpy(frame->buff, buff->buffLuma, m_videoWidth*m_videoHeight);
+        frame->timestamp = buff->time;
+        m_cornerFinderData[idle]->setFrame(frame);
+        m_cornerFinderData[idle]->roi = (m_roiTrackingEnabled ? m_roi : cv::Rect());
+        
+        // If the pattern was found in the last published results, ask the worker to track it from there.
+        // The capture copy is written only by this thread, so it can be read here without locking.
+        const CalibrationCornerFinderData& last = m_cornerFinderCaptureData;
+        if (m_trackingEnabled && m_trackingRunLength < m_trackingRedetectInterval && last.cornerFoundAllFlag && last.frame) {
+            last.frame->retain();
+            m_cornerFinderData[idle]->trackFrame = last.frame;
+            m_cornerFinderData[idle]->trackCorners = last.corners;
+            m_trackingRunLength++;
+            m_trackCount++;
+        } else {
+            m_trackingRunLength = 0;
         }
+        m_frameSubmittedCount++;
+        
+        // Kick off a new cycle of the cornerFinder. The results will be collected on a subsequent cycle.
+        m_cornerFinderClaimed[idle] = true;
+        m_cornerFinderPool->m_workers[idle]->data = m_cornerFinderData[idle];
+        threadStartSignal(m_cornerFinderPool->m_workers[idle]->thread);
     }
     
     //
     // End of main calibration-related cycle.
     //
-    return true;
 }
 
-bool Calibration::cornerFinderResultsLockAndFetch(int *cornerFoundAllFlag, std::vector<cv::Point2f>& corners, ARUint8** videoFrame)
+void Calibration::publishResults(const CalibrationCornerFinderData& result)
 {
-    pthread_mutex_lock(&m_cornerFinderResultLock);
-    *cornerFoundAllFlag = m_cornerFinderResultData.cornerFoundAllFlag;
-    corners = m_cornerFinderResultData.corners;
-    *videoFrame = m_cornerFinderResultData.videoFrame;
+    LatencyStatsScope latency(LATENCY_STAGE_PUBLISH);
+    
+    // Check whether the pattern is being held still, by comparing against the last results in which it was found.
+    bool still = false;
+    if (result.cornerFoundAllFlag && m_stableCorners.size() == result.corners.size()) {
+        const float motionMax = AUTO_CAPTURE_STABLE_MOTION_MAX * (float)m_videoWidth / 640.0f;
+        still = true;
+        for (size_t i = 0; i < result.corners.size(); i++) {
+            const float dx = result.corners[i].x - m_stableCorners[i].x;
+            const float dy = result.corners[i].y - m_stableCorners[i].y;
+            if (dx*dx + dy*dy > motionMax*motionMax) {
+                still = false;
+                break;
+            }
+        }
+    }
+    m_stableCount = (still ? m_stableCount + 1 : 0);
+    if (result.cornerFoundAllFlag) m_stableCorners = result.corners;
+    else m_stableCorners.clear();
+    const bool stable = (m_stableCount >= m_autoCaptureStableFrameCount);
+    
+    pthread_mutex_lock(&m_cornerFinderCaptureLock); // Read by capture() on the flow thread.
+    const float coverageScore = (result.cornerFoundAllFlag ? m_coverage.score(result.corners) : 0.0f);
+    m_cornerFinderCaptureData = result;
+    m_cornerFinderCaptureData.coverageScore = coverageScore;
+    m_cornerFinderCaptureStable = stable;
+    m_autoCaptureReady = (stable && coverageScore >= m_autoCaptureScoreMin);
+    m_detectionCurrent = (result.cornerFoundAllFlag != 0);
+    if (m_detectionCurrent) {
+        Detection& detection = m_detections[m_detectionNext];
+        detection.timestamp = result.timestamp;
+        detection.corners = result.corners;
+        if (detection.frame) detection.frame->release();
+        detection.frame = (result.tracked ? result.frame : NULL);
+        if (detection.frame) detection.frame->retain();
+        m_detectionNext = (m_detectionNext + 1) % DETECTION_HISTORY_COUNT;
+        if (m_detectionCount < DETECTION_HISTORY_COUNT) m_detectionCount++;
+    }
+    pthread_mutex_unlock(&m_cornerFinderCaptureLock);
+    
+    // Copy the results into the back slot, then publish by swapping it into the middle. Copying shares the frame
+    // and reuses the reserved corner storage, so nothing is allocated.
+    m_cornerFinderResultData[m_cornerFinderResultBack] = result;
+    m_cornerFinderResultData[m_cornerFinderResultBack].coverageScore = coverageScore;
+    m_cornerFinderResultBack = m_cornerFinderResultMiddle.exchange(m_cornerFinderResultBack | CORNER_FINDER_RESULT_FRESH, std::memory_order_acq_rel) & CORNER_FINDER_RESULT_INDEX_MASK;
+    m_cornerFinderResultTimestamp = result.timestamp;
+}
+
+void Calibration::updateROI(const CalibrationCornerFinderData& result)
+{
+    if (!result.cornerFoundAllFlag) {
+        m_roi = cv::Rect(); // Lost. Search the whole frame next time.
+        return;
+    }
+    
+    cv::Rect box = cv::boundingRect(result.corners);
+    int padX = std::max((int)(box.width * CORNER_FINDER_ROI_PADDING_FACTOR), CORNER_FINDER_ROI_PADDING_MIN);
+    int padY = std::max((int)(box.height * CORNER_FINDER_ROI_PADDING_FACTOR), CORNER_FINDER_ROI_PADDING_MIN);
+    box.x -= padX;
+    box.y -= padY;
+    box.width += 2*padX;
+    box.height += 2*padY;
+    m_roi = box & cv::Rect(0, 0, m_videoWidth, m_videoHeight);
+    
+    // If the region covers most of the frame anyway, cropping gains nothing.
+    if (m_roi.area() > (m_videoWidth * m_videoHeight * 3) / 4) m_roi = cv::Rect();
+}
+
+bool Calibration::cornerFinderResultsAcquire(int *cornerFoundAllFlag, const std::vector<cv::Point2f>** corners, ARUint8** videoFrame, CornerFinderResultInfo *info)
+{
+    // If newer results have been published, swap them into the front slot.
+    if (m_cornerFinderResultMiddle.load(std::memory_order_relaxed) & CORNER_FINDER_RESULT_FRESH) {
+        m_cornerFinderResultFront = m_cornerFinderResultMiddle.exchange(m_cornerFinderResultFront, std::memory_order_acq_rel) & CORNER_FINDER_RESULT_INDEX_MASK;
+    }
+    const CalibrationCornerFinderData& result = m_cornerFinderResultData[m_cornerFinderResultFront];
+    *cornerFoundAllFlag = result.cornerFoundAllFlag;
+    *corners = &result.corners;
+    *videoFrame = result.videoFrame();
+    if (info) {
+        info->pyramidLevel = result.pyramidLevel;
+        info->tracked = result.tracked;
+        info->sharpness = m_lastFrameSharpness.load(std::memory_order_relaxed);
+        info->blurred = m_lastFrameBlurred.load(std::memory_order_relaxed);
+        info->coverageScore = result.coverageScore;
+    }
     return true;
 }
 
-bool Calibration::cornerFinderResultsUnlock(void)
+bool Calibration::cornerFinderResultsRelease(void)
 {
-    pthread_mutex_unlock(&m_cornerFinderResultLock);
+    // The front slot is never written by frame(), so there is nothing to do until the next acquire.
     return true;
 }
 
@@ -195,89 +591,476 @@ void *Calibration::cornerFinder(THREAD_HANDLE_T *threadHandle)
     ARLOGi("Start cornerFinder thread.\n");
 #endif
     
-    CalibrationCornerFinderData *cornerFinderDataPtr = (CalibrationCornerFinderData *)threadGetArg(threadHandle);
+    CornerFinderPool::Worker *worker = (CornerFinderPool::Worker *)threadGetArg(threadHandle);
+    std::vector<cv::Mat> pyramid; // Decimated frames. Allocated on first use, then reused.
     
     while (threadStartWait(threadHandle) == 0) {
         
-        switch (cornerFinderDataPtr->patternType) {
+        // The Calibration which claimed this worker set its input and output before starting the run.
+        CalibrationCornerFinderData *cornerFinderDataPtr = worker->data;
+        
+        LatencyStatsTime start = latencyStatsNow();
+        
+        // Try tracking first, if asked to.
+        cornerFinderDataPtr->tracked = false;
+        if (cornerFinderDataPtr->trackFrame) {
+            cv::Mat prevImage(cornerFinderDataPtr->videoHeight, cornerFinderDataPtr->videoWidth, CV_8UC1, cornerFinderDataPtr->trackFrame->buff);
+            cornerFinderDataPtr->tracked = trackCorners(prevImage, cornerFinderDataPtr->calibImage(), cornerFinderDataPtr->trackCorners, *cornerFinderDataPtr->patternModel, cornerFinderDataPtr->corners);
+            cornerFinderDataPtr->trackFrame->release();
+            cornerFinderDataPtr->trackFrame = NULL;
+        }
+        
+        const cv::Rect& roi = cornerFinderDataPtr->roi;
+        if (cornerFinderDataPtr->tracked) {
+            cornerFinderDataPtr->cornerFoundAllFlag = 1;
+            cornerFinderDataPtr->pyramidLevel = 0;
+        } else if (roi.area() > 0) {
+            // Search only the region of interest, decimating less as it is smaller than the whole frame.
+            int pyramidLevelMax = cornerFinderDataPtr->pyramidLevelMax;
+            while (pyramidLevelMax > 0 && (roi.width >> pyramidLevelMax) < CORNER_FINDER_ROI_PYRAMID_WIDTH_MIN) pyramidLevelMax--;
+            cornerFinderDataPtr->cornerFoundAllFlag = findCorners(cornerFinderDataPtr->calibImage()(roi), cornerFinderDataPtr->patternType, cornerFinderDataPtr->patternSize, pyramidLevelMax, pyramid, cornerFinderDataPtr->corners, &cornerFinderDataPtr->pyramidLevel);
+            for (cv::Point2f& corner : cornerFinderDataPtr->corners) {
+                corner.x += roi.x;
+                corner.y += roi.y;
+            }
+        } else {
+            cornerFinderDataPtr->cornerFoundAllFlag = findCorners(cornerFinderDataPtr->calibImage(), cornerFinderDataPtr->patternType, cornerFinderDataPtr->patternSize, cornerFinderDataPtr->pyramidLevelMax, pyramid, cornerFinderDataPtr->corners, &cornerFinderDataPtr->pyramidLevel);
+        }
+        
+        // Refine detected corners to the accuracy needed for calibration. Tracked corners are refined only enough to
+        // keep them from drifting, as most are never captured. capture() refines them fully if they are.
+        if (cornerFinderDataPtr->tracked) {
+            cv::cornerSubPix(cornerFinderDataPtr->calibImage(), cornerFinderDataPtr->corners, cv::Size(5,5), cv::Size(-1,-1), cv::TermCriteria(CV_TERMCRIT_EPS|CV_TERMCRIT_ITER, CORNER_TRACKER_REFINE_ITERATIONS_MAX, CORNER_TRACKER_REFINE_EPS));
+        } else if (cornerFinderDataPtr->cornerFoundAllFlag) {
+            refineCorners(cornerFinderDataPtr->calibImage(), cornerFinderDataPtr->corners);
+        }
+        latencyStatsRecord(LATENCY_STAGE_DETECT, start);
+        ARLOGd("cornerFinderDataPtr->cornerFoundAllFlag=%d, pyramidLevel=%d, tracked=%d.\n", cornerFinderDataPtr->cornerFoundAllFlag, cornerFinderDataPtr->pyramidLevel, (int)cornerFinderDataPtr->tracked);
+        threadEndSignal(threadHandle);
+    }
+    
+#ifdef DEBUG
+    ARLOGi("End cornerFinder thread.\n");
+#endif
+    return (NULL);
+}
+
+// static
+int Calibration::pyramidLevelMaxForWidth(const CalibrationPatternType patternType, const int width)
+{
+    // Coarse-to-fine detection only pays off for large frames.
+    int pyramidLevelMax = 0;
+    std::map<CalibrationPatternType, int>::const_iterator it = CalibrationPatternPyramidLevels.find(patternType);
+    if (it != CalibrationPatternPyramidLevels.end()) {
+        pyramidLevelMax = it->second;
+        while (pyramidLevelMax > 0 && (width >> pyramidLevelMax) < CORNER_FINDER_PYRAMID_WIDTH_MIN) pyramidLevelMax--;
+    }
+    return pyramidLevelMax;
+}
+
+// static
+void Calibration::refineCorners(const cv::Mat& image, std::vector<cv::Point2f>& corners)
+{
+    cv::cornerSubPix(image, corners, cv::Size(5,5), cv::Size(-1,-1), cv::TermCriteria(CV_TERMCRIT_ITER, 100, 0.1));
+}
+
+// static
+bool Calibration::findCornersInImage(const cv::Mat& image, const CalibrationPatternType patternType, const cv::Size patternSize, std::vector<cv::Mat>& pyramid, std::vector<cv::Point2f>& corners)
+{
+    if (!findCorners(image, patternType, patternSize, pyramidLevelMaxForWidth(patternType, image.cols), pyramid, corners, NULL)) return false;
+    refineCorners(image, corners);
+    return true;
+}
+
+// static
+int Calibration::findCorners(const cv::Mat& image, const CalibrationPatternType patternType, const cv::Size patternSize, const int pyramidLevelMax, std::vector<cv::Mat>& pyramid, std::vector<cv::Point2f>& corners, int *pyramidLevel_out)
+{
+    int cornerFoundAllFlag = 0;
+    
+    // Build the decimated images. Each level is half the size of the one before.
+    if ((int)pyramid.size() < pyramidLevelMax + 1) pyramid.resize(pyramidLevelMax + 1);
+    pyramid[0] = image;
+    for (int level = 1; level <= pyramidLevelMax; level++) {
+        const cv::Mat& src = pyramid[level - 1];
+        pyramid[level].create(src.rows / 2, src.cols / 2, CV_8UC1); // No-op if already allocated at this size.
+        lumaUtilDownsample2x(src.data, src.cols, src.rows, (int)src.step, pyramid[level].data, (int)pyramid[level].step);
+    }
+    
+    int level;
+    for (level = pyramidLevelMax; level >= 0; level--) {
+        switch (patternType) {
             case CalibrationPatternType::CHESSBOARD:
-                cornerFinderDataPtr->cornerFoundAllFlag = cv::findChessboardCorners(cv::cvarrToMat(cornerFinderDataPtr->calibImage), cornerFinderDataPtr->patternSize, cornerFinderDataPtr->corners, CV_CALIB_CB_FAST_CHECK|CV_CALIB_CB_ADAPTIVE_THRESH|CV_CALIB_CB_FILTER_QUADS);
+                cornerFoundAllFlag = cv::findChessboardCorners(pyramid[level], patternSize, corners, CV_CALIB_CB_FAST_CHECK|CV_CALIB_CB_ADAPTIVE_THRESH|CV_CALIB_CB_FILTER_QUADS);
                 break;
             case CalibrationPatternType::CIRCLES_GRID:
-                cornerFinderDataPtr->cornerFoundAllFlag = cv::findCirclesGrid(cv::cvarrToMat(cornerFinderDataPtr->calibImage), cornerFinderDataPtr->patternSize, cornerFinderDataPtr->corners, cv::CALIB_CB_SYMMETRIC_GRID);
+                cornerFoundAllFlag = cv::findCirclesGrid(pyramid[level], patternSize, corners, cv::CALIB_CB_SYMMETRIC_GRID);
                 break;
             case CalibrationPatternType::ASYMMETRIC_CIRCLES_GRID:
-                cornerFinderDataPtr->cornerFoundAllFlag = cv::findCirclesGrid(cv::cvarrToMat(cornerFinderDataPtr->calibImage), cornerFinderDataPtr->patternSize, cornerFinderDataPtr->corners, cv::CALIB_CB_ASYMMETRIC_GRID);
+                cornerFoundAllFlag = cv::findCirclesGrid(pyramid[level], patternSize, corners, cv::CALIB_CB_ASYMMETRIC_GRID);
                 break;
         }
-        ARLOGd("cornerFinderDataPtr->cornerFoundAllFlag=%d.\n", cornerFinderDataPtr->cornerFoundAllFlag);
-        threadEndSignal(threadHandle);
+        if (cornerFoundAllFlag) break;
     }
     
-#ifdef DEBUG
-    ARLOGi("End cornerFinder thread.\n");
-#endif
-    return (NULL);
+    if (cornerFoundAllFlag && level > 0) {
+        // Map the corners back to full resolution. A pixel at level n covers a block of 2^n full-resolution
+        // pixels, whose centre is offset by (2^n - 1)/2.
+        const float scale = (float)(1 << level);
+        const float offset = (scale - 1.0f) * 0.5f;
+        for (cv::Point2f& corner : corners) {
+            corner.x = corner.x * scale + offset;
+            corner.y = corner.y * scale + offset;
+        }
+        // Refine chessboard corners against the full-resolution image, with a search window large enough to
+        // cover the uncertainty of the coarse position. (Circle centres are blob centroids and are already
+        // sub-pixel, so they are used as mapped.)
+        if (patternType == CalibrationPatternType::CHESSBOARD) {
+            const int win = 2*(1 << level) + 1;
+            cv::cornerSubPix(image, corners, cv::Size(win, win), cv::Size(-1, -1), cv::TermCriteria(CV_TERMCRIT_EPS|CV_TERMCRIT_ITER, 30, 0.01));
+        }
+    }
+    
+    if (pyramidLevel_out) *pyramidLevel_out = (cornerFoundAllFlag ? level : -1);
+    return cornerFoundAllFlag;
+}
+
+// static
+bool Calibration::trackCorners(const cv::Mat& prevImage, const cv::Mat& image, const std::vector<cv::Point2f>& prevCorners, const std::vector<cv::Point2f>& patternModel, std::vector<cv::Point2f>& corners)
+{
+    if (prevCorners.empty() || prevCorners.size() != patternModel.size()) return false;
+    
+    std::vector<unsigned char> status;
+    std::vector<float> err;
+    cv::calcOpticalFlowPyrLK(prevImage, image, prevCorners, corners, status, err, cv::Size(CORNER_TRACKER_WINDOW_SIZE, CORNER_TRACKER_WINDOW_SIZE), CORNER_TRACKER_PYRAMID_LEVELS, cv::TermCriteria(cv::TermCriteria::COUNT|cv::TermCriteria::EPS, 20, 0.03));
+    for (unsigned char s : status) {
+        if (!s) return false;
+    }
+    
+    // The pattern is planar, so its corners in any view lie on a homography of the model, up to lens distortion.
+    // A corner which has drifted or jumped onto a neighbouring square will not.
+    cv::Mat H = cv::findHomography(patternModel, corners, 0);
+    if (H.empty()) return false;
+    std::vector<cv::Point2f> projected;
+    cv::perspectiveTransform(patternModel, projected, H);
+    double sumSq = 0.0;
+    for (size_t i = 0; i < corners.size(); i++) {
+        const double dx = corners[i].x - projected[i].x;
+        const double dy = corners[i].y - projected[i].y;
+        const double dSq = dx*dx + dy*dy;
+        if (dSq > CORNER_TRACKER_RESIDUAL_MAX*CORNER_TRACKER_RESIDUAL_MAX) return false;
+        sumSq += dSq;
+    }
+    return (sumSq / corners.size() <= CORNER_TRACKER_RESIDUAL_RMS_MAX*CORNER_TRACKER_RESIDUAL_RMS_MAX);
 }
 
-bool Calibration::capture()
+bool Calibration::capture(const bool automatic)
 {
-    if (m_corners.size() >= m_calibImageCountMax) return false;
+    if (m_corners.viewCount() >= m_calibImageCountMax) return false;
    
     bool saved = false;
     
-    pthread_mutex_lock(&m_cornerFinderResultLock);
-    if (m_cornerFinderResultData.cornerFoundAllFlag) {
-        // Refine the corner positions.
-        cornerSubPix(cv::cvarrToMat(m_cornerFinderResultData.calibImage), m_cornerFinderResultData.corners, cv::Size(5,5), cvSize(-1,-1), cv::TermCriteria(CV_TERMCRIT_ITER, 100, 0.1));
-        
-        // Save the corners.
-        m_corners.push_back(m_cornerFinderResultData.corners);
-        saved = true;
+    // Take the latest corners. Detected corners have already been refined by the corner finder. Tracked corners
+    // are refined here, outside the lock, so that publishing isn't held up.
+    bool found = false;
+    CalibrationFrame *refineFrame = NULL;
+    pthread_mutex_lock(&m_cornerFinderCaptureLock);
+    if (m_lastFrameBlurred.load(std::memory_order_relaxed)) {
+        ARLOGw("Not capturing: frame too blurred (sharpness %.1f).\n", m_lastFrameSharpness.load(std::memory_order_relaxed));
+    } else if (m_cornerFinderCaptureData.cornerFoundAllFlag) {
+        found = true;
+        m_captureCorners = m_cornerFinderCaptureData.corners;
+        if (m_cornerFinderCaptureData.tracked) {
+            refineFrame = m_cornerFinderCaptureData.frame;
+            refineFrame->retain();
+        }
+    }
+    pthread_mutex_unlock(&m_cornerFinderCaptureLock);
+    if (!found) return false;
+    if (refineFrame) {
+        refineCorners(cv::Mat(m_videoHeight, m_videoWidth, CV_8UC1, refineFrame->buff), m_captureCorners);
+        refineFrame->release();
     }
-    pthread_mutex_unlock(&m_cornerFinderResultLock);
+    
+    pthread_mutex_lock(&m_cornerFinderCaptureLock);
+    saved = addView(m_captureCorners, automatic);
+    pthread_mutex_unlock(&m_cornerFinderCaptureLock);
+    if (saved) solverRequest();
 
     if (saved) {
-        ARLOG("---------- %2d/%2d -----------\n", (int)m_corners.size(), m_calibImageCountMax);
-        const std::vector<cv::Point2f>& corners = m_corners.back();
-        for (std::vector<cv::Point2f>::const_iterator it = corners.begin(); it < corners.end(); it++) {
-            ARLOG("  %f, %f\n", it->x, it->y);
+        const int view = m_corners.viewCount() - 1;
+        ARLOG("---------- %2d/%2d -----------\n", view + 1, m_calibImageCountMax);
+        for (int i = 0; i < m_corners.pointCount(); i++) {
+            ARLOG("  %f, %f\n", m_corners.x(view)[i], m_corners.y(view)[i]);
         }
-        ARLOG("---------- %2d/%2d -----------\n", (int)m_corners.size(), m_calibImageCountMax);
+        ARLOG("---------- %2d/%2d -----------\n", view + 1, m_calibImageCountMax);
     }
     
     return (saved);
 }
 
+bool Calibration::captureCorners(const std::vector<cv::Point2f>& corners, const bool automatic)
+{
+    if (m_corners.viewCount() >= m_calibImageCountMax || (int)corners.size() != m_corners.pointCount()) return false;
+    
+    pthread_mutex_lock(&m_cornerFinderCaptureLock);
+    bool saved = addView(corners, automatic);
+    pthread_mutex_unlock(&m_cornerFinderCaptureLock);
+    if (saved) solverRequest();
+    return (saved);
+}
+
+bool Calibration::addView(const std::vector<cv::Point2f>& corners, const bool automatic)
+{
+    // An automatic capture is rescored here, as another view may have been captured since readiness was signalled.
+    if (automatic && !(m_cornerFinderCaptureStable && m_coverage.score(corners) >= m_autoCaptureScoreMin)) return false;
+    m_corners.push_back(corners);
+    m_coverage.add(corners);
+    return true;
+}
+
+bool Calibration::detectionLatest(AR2VideoTimestampT *timestamp_out, std::vector<cv::Point2f>& corners)
+{
+    pthread_mutex_lock(&m_cornerFinderCaptureLock);
+    bool found = (m_detectionCurrent && m_detectionCount > 0);
+    CalibrationFrame *refineFrame = NULL;
+    if (found) {
+        const Detection& detection = m_detections[(m_detectionNext + DETECTION_HISTORY_COUNT - 1) % DETECTION_HISTORY_COUNT];
+        *timestamp_out = detection.timestamp;
+        corners = detection.corners;
+        refineFrame = detection.frame;
+        if (refineFrame) refineFrame->retain();
+    }
+    pthread_mutex_unlock(&m_cornerFinderCaptureLock);
+    if (refineFrame) detectionRefine(refineFrame, corners);
+    return found;
+}
+
+bool Calibration::detectionNearest(const AR2VideoTimestampT& timestamp, AR2VideoTimestampT *timestamp_out, std::vector<cv::Point2f>& corners)
+{
+    pthread_mutex_lock(&m_cornerFinderCaptureLock);
+    int nearest = -1;
+    double nearestDelta = 0.0;
+    for (int i = 0; i < m_detectionCount; i++) {
+        const AR2VideoTimestampT& t = m_detections[i].timestamp;
+        const double delta = fabs((double)((int64_t)t.sec - (int64_t)timestamp.sec) + ((double)t.usec - (double)timestamp.usec)*1.0e-6);
+        if (nearest < 0 || delta < nearestDelta) {
+            nearest = i;
+            nearestDelta = delta;
+        }
+    }
+    CalibrationFrame *refineFrame = NULL;
+    if (nearest >= 0) {
+        *timestamp_out = m_detections[nearest].timestamp;
+        corners = m_detections[nearest].corners;
+        refineFrame = m_detections[nearest].frame;
+        if (refineFrame) refineFrame->retain();
+    }
+    pthread_mutex_unlock(&m_cornerFinderCaptureLock);
+    if (refineFrame) detectionRefine(refineFrame, corners);
+    return (nearest >= 0);
+}
+
+void Calibration::detectionRefine(CalibrationFrame *frame, std::vector<cv::Point2f>& corners)
+{
+    refineCorners(cv::Mat(m_videoHeight, m_videoWidth, CV_8UC1, frame->buff), corners);
+    frame->release();
+}
+
+void Calibration::capturedCorners(CornerSet& cornerSet)
+{
+    pthread_mutex_lock(&m_cornerFinderCaptureLock);
+    cornerSet = m_corners;
+    pthread_mutex_unlock(&m_cornerFinderCaptureLock);
+}
+
 bool Calibration::uncapture(void)
 {
-    if (m_corners.size() <= 0) return false;
+    if (m_corners.empty()) return false;
+    pthread_mutex_lock(&m_cornerFinderCaptureLock);
     m_corners.pop_back();
+    m_coverage.removeLast();
+    pthread_mutex_unlock(&m_cornerFinderCaptureLock);
+    solverRequest();
     return true;
 }
 
 bool Calibration::uncaptureAll(void)
 {
-    if (m_corners.size() <= 0) return false;
+    if (m_corners.empty()) return false;
+    pthread_mutex_lock(&m_cornerFinderCaptureLock);
     m_corners.clear();
+    m_coverage.clear();
+    pthread_mutex_unlock(&m_cornerFinderCaptureLock);
+    solverRequest();
     return true;
 }
 
 void Calibration::calib(ARParam *param_out, ARdouble *err_min_out, ARdouble *err_avg_out, ARdouble *err_max_out)
 {
-    calc((int)m_corners.size(), m_patternType, m_patternSize, m_chessboardSquareWidth, m_corners, m_videoWidth, m_videoHeight, param_out, err_min_out, err_avg_out, err_max_out);
+    // Start from the background solver's latest estimate, so that this solve need only refine it.
+    pthread_mutex_lock(&m_solverLock);
+    IntrinsicsEstimate estimate = {m_solverEstimate.cameraMatrix.clone(), m_solverEstimate.distortionCoeff.clone(), m_solverEstimate.rms};
+    pthread_mutex_unlock(&m_solverLock);
+    
+    const CornerSet *cornerSet = &m_corners;
+    CornerSet subset;
+    if (m_calibViewSubsetCount > 0 && m_calibViewSubsetCount < m_corners.viewCount()) {
+        std::vector<int> selected;
+        CalibrationCoverage::selectViews(m_corners, m_patternSize, m_videoWidth, m_videoHeight, m_calibViewSubsetCount, selected);
+        subset = m_corners.subset(selected);
+        ARLOGi("Calibrating with %d of %d views, chosen for coverage.\n", subset.viewCount(), m_corners.viewCount());
+        cornerSet = &subset;
+    }
+    
+    CornerSet kept;
+    if (m_calibOutlierRejectionEnabled) {
+        std::vector<CalibrationRejectedView> rejected;
+        calcRobust(cornerSet->viewCount(), m_patternType, m_patternSize, m_chessboardSquareWidth, *cornerSet, m_videoWidth, m_videoHeight, param_out, err_min_out, err_avg_out, err_max_out, &rejected, &estimate);
+        if (!rejected.empty()) {
+            ARLOGi("Rejected %d of %d views as outliers.\n", (int)rejected.size(), cornerSet->viewCount());
+            // The uncertainty is that of the solve of the views kept.
+            std::vector<bool> reject(cornerSet->viewCount(), false);
+            for (const CalibrationRejectedView& r : rejected) reject[r.index] = true;
+            std::vector<int> keep;
+            for (int i = 0; i < cornerSet->viewCount(); i++) if (!reject[i]) keep.push_back(i);
+            kept = cornerSet->subset(keep);
+            cornerSet = &kept;
+        }
+    } else {
+        calc(cornerSet->viewCount(), m_patternType, m_patternSize, m_chessboardSquareWidth, *cornerSet, m_videoWidth, m_videoHeight, param_out, err_min_out, err_avg_out, err_max_out, &estimate);
+    }
+    
+    m_calibUncertaintyValid = false;
+    if (m_calibUncertaintySampleCount > 0) {
+        m_calibUncertaintyValid = calcUncertainty(m_patternType, m_patternSize, m_chessboardSquareWidth, *cornerSet, m_videoWidth, m_videoHeight, estimate, m_calibUncertaintyMethod, m_calibUncertaintySampleCount, &m_calibUncertainty);
+    }
+}
+
+bool Calibration::calibUncertainty(Uncertainty *uncertainty) const
+{
+    if (!m_calibUncertaintyValid) return false;
+    *uncertainty = m_calibUncertainty;
+    return true;
 }
 
-Calibration::~Calibration()
+// static
+void *Calibration::solver(THREAD_HANDLE_T *threadHandle)
 {
-    pthread_mutex_destroy(&m_cornerFinderResultLock);
+    Calibration *calibration = (Calibration *)threadGetArg(threadHandle);
+    CornerSet cornerSet; // Reused, so that copying the captured views allocates only when there are more than before.
     
-    // Clean up the corner finder.
-    if (m_cornerFinderThread) {
+    while (threadStartWait(threadHandle) == 0) {
+        
+        // Solve the views captured now. Any captured while solving will have requested another solve.
+        pthread_mutex_lock(&calibration->m_cornerFinderCaptureLock);
+        cornerSet = calibration->m_corners;
+        pthread_mutex_unlock(&calibration->m_cornerFinderCaptureLock);
+        
+        if (cornerSet.viewCount() < SOLVER_VIEW_COUNT_MIN) {
+            // Too few to solve. If all views have gone, so has the estimate.
+            pthread_mutex_lock(&calibration->m_solverLock);
+            if (cornerSet.empty()) {
+                calibration->m_solverEstimate.cameraMatrix.release();
+                calibration->m_solverEstimate.distortionCoeff.release();
+            }
+            calibration->m_solverStatusValid = false;
+            pthread_mutex_unlock(&calibration->m_solverLock);
+        } else {
+            pthread_mutex_lock(&calibration->m_solverLock);
+            IntrinsicsEstimate estimate = {calibration->m_solverEstimate.cameraMatrix.clone(), calibration->m_solverEstimate.distortionCoeff.clone(), calibration->m_solverEstimate.rms};
+            pthread_mutex_unlock(&calibration->m_solverLock);
+            const IntrinsicsEstimate previous = {estimate.cameraMatrix.clone(), estimate.distortionCoeff.clone(), estimate.rms};
+            
+            ARParam param;
+            ARdouble err_min, err_avg, err_max;
+            calc(cornerSet.viewCount(), calibration->m_patternType, calibration->m_patternSize, calibration->m_chessboardSquareWidth, cornerSet, calibration->m_videoWidth, calibration->m_videoHeight, &param, &err_min, &err_avg, &err_max, &estimate);
+            
+            SolverStatus status = {cornerSet.viewCount(), estimate.rms, 1.0, (double)calibration->m_videoWidth, 1.0, false};
+            if (!estimate.cameraMatrix.empty() && !previous.cameraMatrix.empty()) {
+                const double f = 0.5*(estimate.cameraMatrix.at<double>(0, 0) + estimate.cameraMatrix.at<double>(1, 1));
+                const double fPrev = 0.5*(previous.cameraMatrix.at<double>(0, 0) + previous.cameraMatrix.at<double>(1, 1));
+                status.focalChange = (fPrev != 0.0 ? (f - fPrev)/fPrev : 1.0);
+                status.principalPointChange = hypot(estimate.cameraMatrix.at<double>(0, 2) - previous.cameraMatrix.at<double>(0, 2), estimate.cameraMatrix.at<double>(1, 2) - previous.cameraMatrix.at<double>(1, 2));
+                status.k1Change = estimate.distortionCoeff.at<double>(0) - previous.distortionCoeff.at<double>(0);
+                status.converged = (status.viewCount >= SOLVER_CONVERGED_VIEW_COUNT_MIN
+                                    && fabs(status.focalChange) < SOLVER_CONVERGED_FOCAL_CHANGE_MAX
+                                    && status.principalPointChange < SOLVER_CONVERGED_PRINCIPAL_POINT_CHANGE_MAX*calibration->m_videoWidth
+                                    && fabs(status.k1Change) < SOLVER_CONVERGED_K1_CHANGE_MAX);
+            }
+            ARLOGi("Background calibration of %d views: RMS %.3f px, focal length change %+.2f%%, principal point change %.1f px, k1 change %+.4f%s.\n",
+                   status.viewCount, status.rms, status.focalChange*100.0, status.principalPointChange, status.k1Change, (status.converged ? ", converged" : ""));
+            
+            pthread_mutex_lock(&calibration->m_solverLock);
+            calibration->m_solverEstimate = estimate;
+            calibration->m_solverStatus = status;
+            calibration->m_solverStatusValid = !estimate.cameraMatrix.empty();
+            pthread_mutex_unlock(&calibration->m_solverLock);
+        }
         
-        threadWaitQuit(m_cornerFinderThread);
-        threadFree(&m_cornerFinderThread);
+        threadEndSignal(threadHandle);
+    }
+    return (NULL);
+}
+
+void Calibration::solverRequest()
+{
+    // A start signal sent while the solver is busy is held until it next waits, so requests coalesce.
+    if (m_solverThread) threadStartSignal(m_solverThread);
+}
+
+bool Calibration::solverStatus(SolverStatus *status)
+{
+    pthread_mutex_lock(&m_solverLock);
+    bool valid = m_solverStatusValid;
+    if (valid && status) *status = m_solverStatus;
+    pthread_mutex_unlock(&m_solverLock);
+    return valid;
+}
+
+bool Calibration::solverConverged()
+{
+    SolverStatus status;
+    return (solverStatus(&status) && status.converged);
+}
+
+bool Calibration::solverEstimate(IntrinsicsEstimate *estimate)
+{
+    pthread_mutex_lock(&m_solverLock);
+    bool valid = !m_solverEstimate.cameraMatrix.empty();
+    if (valid) *estimate = {m_solverEstimate.cameraMatrix.clone(), m_solverEstimate.distortionCoeff.clone(), m_solverEstimate.rms};
+    pthread_mutex_unlock(&m_solverLock);
+    return valid;
+}
+
+Calibration::~Calibration()
+{
+    if (m_solverThread) {
+        threadWaitQuit(m_solverThread);
+        threadFree(&m_solverThread);
     }
+    pthread_mutex_destroy(&m_solverLock);
+    
+    // Clean up the corner finders. Runs still in progress are waited for, and their workers returned to the pool.
+    for (int i = 0; i < (int)m_cornerFinderData.size(); i++) {
+        if (m_cornerFinderClaimed[i]) {
+            threadEndWait(m_cornerFinderPool->m_workers[i]->thread);
+            m_cornerFinderPool->release(i);
+        }
+        delete m_cornerFinderData[i];
+    }
+    m_cornerFinderData.clear();
+    m_cornerFinderClaimed.clear();
+    if (m_cornerFinderPoolOwned) delete m_cornerFinderPool;
+    m_cornerFinderPool = nullptr;
+    for (CalibrationCornerFinderData& result : m_cornerFinderResultData) result.setFrame(NULL);
+    m_cornerFinderCaptureData.setFrame(NULL);
+    for (Detection& detection : m_detections) {
+        if (detection.frame) detection.frame->release();
+        detection.frame = NULL;
+    }
+    delete m_framePool;
+    
+    pthread_mutex_destroy(&m_cornerFinderCaptureLock);
     
     // Calibration input cleanup.
 }
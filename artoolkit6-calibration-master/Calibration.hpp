@@ -29,8 +29,12 @@
 #include <opencv2/core/core.hpp>
 #include <AR6/ARVideoSource.h>
 #include <map>
+#include <atomic>
 
 #include <AR6/ARUtil/thread_sub.h>
+#include "CalibrationCoverage.hpp"
+#include "CornerSet.hpp"
+#include "LatencyStats.hpp"
 
 class Calibration
 {
@@ -44,60 +48,374 @@ public:
     
     static std::map<CalibrationPatternType, cv::Size> CalibrationPatternSizes;
     static std::map<CalibrationPatternType, float> CalibrationPatternSpacings;
+    // Coarse-to-fine detection. The pattern is first searched for in a copy of the frame decimated by
+    // 2^level, and the corners found are mapped back to and refined in the full-resolution frame. If not found,
+    // each finer level is tried in turn. 0 searches the full-resolution frame only. The level actually used is
+    // also limited so that the decimated frame is no narrower than CORNER_FINDER_PYRAMID_WIDTH_MIN pixels.
+    static std::map<CalibrationPatternType, int> CalibrationPatternPyramidLevels;
     
-    Calibration(const CalibrationPatternType patternType, const int calibImageCountMax, const cv::Size patternSize, const int chessboardSquareWidth, const int videoWidth, const int videoHeight);
-    int calibImageCount() const {return (int)m_corners.size(); }
+    class CornerFinderPool;
+    
+    // cornerFinderWorkerCount is the number of corner finder threads to run concurrently. Pass 0 to use one
+    // thread per available CPU core, less one for the thread calling frame().
+    Calibration(const CalibrationPatternType patternType, const int calibImageCountMax, const cv::Size patternSize, const int chessboardSquareWidth, const int videoWidth, const int videoHeight, const int cornerFinderWorkerCount = 0);
+    // As above, but the corner finders run on the workers of cornerFinderPool, which may be shared with other
+    // Calibrations. The pool must outlive this Calibration.
+    Calibration(const CalibrationPatternType patternType, const int calibImageCountMax, const cv::Size patternSize, const int chessboardSquareWidth, const int videoWidth, const int videoHeight, CornerFinderPool *cornerFinderPool);
+    int calibImageCount() const {return m_corners.viewCount(); }
     int calibImageCountMax() const {return m_calibImageCountMax; }
-    bool frame(ARVideoSource *vs);
-    bool cornerFinderResultsLockAndFetch(int *cornerFoundAllFlag, std::vector<cv::Point2f>& corners, ARUint8** videoFrame);
-    bool cornerFinderResultsUnlock(void);
-    bool capture();
+    int cornerFinderWorkerCount() const; // Workers in the pool the corner finders run on.
+    unsigned long frameSubmittedCount() const {return m_frameSubmittedCount; } // Frames handed to a corner finder.
+    unsigned long frameDroppedCount() const {return m_frameDroppedCount; } // New frames not processed because all corner finders were busy.
+    unsigned long frameDuplicateCount() const {return m_frameDuplicateCount; } // Calls to frame() with no frame newer than the last one seen.
+    // Region-of-interest tracking. While the pattern is being found, the corner finder searches only a padded
+    // bounding box around the most recently found corners, reverting to the whole frame once the pattern is lost.
+    void setROITrackingEnabled(const bool enabled) {m_roiTrackingEnabled = enabled; }
+    bool roiTrackingEnabled() const {return m_roiTrackingEnabled; }
+    unsigned long roiSearchCount() const {return m_roiSearchCount; } // Corner finder runs restricted to a region of interest.
+    unsigned long roiHitCount() const {return m_roiHitCount; } // Of those, runs which found the pattern.
+    float roiHitRate() const {return (m_roiSearchCount ? (float)m_roiHitCount / (float)m_roiSearchCount : 0.0f); }
+    // Optical-flow tracking. While the pattern is being found, its corners are followed from the last published
+    // results into each new frame with pyramidal Lucas-Kanade flow, which is much cheaper than detection. Tracked
+    // corners are accepted only if they still fit the pattern's planar model. Full detection runs when tracking
+    // fails, and after every trackingRedetectInterval consecutive tracked frames.
+    void setTrackingEnabled(const bool enabled) {m_trackingEnabled = enabled; }
+    bool trackingEnabled() const {return m_trackingEnabled; }
+    void setTrackingRedetectInterval(const int interval) {m_trackingRedetectInterval = interval; }
+    int trackingRedetectInterval() const {return m_trackingRedetectInterval; }
+    unsigned long trackCount() const {return m_trackCount; } // Corner finder runs which attempted tracking.
+    unsigned long trackHitCount() const {return m_trackHitCount; } // Of those, runs in which tracking succeeded.
+    float trackHitRate() const {return (m_trackCount ? (float)m_trackHitCount / (float)m_trackCount : 0.0f); }
+    // Blur rejection. Each new frame's sharpness (its gradient energy from lumaUtilGradientEnergy(), per unit of
+    // luma variance and scaled to 640 pixels frame width) is measured before it is handed to a corner finder.
+    // Frames scoring below the threshold are neither searched nor displayed, and cannot be captured.
+    // Set the threshold to 0 to search every frame.
+    void setSharpnessThreshold(const float threshold) {m_sharpnessThreshold = threshold; }
+    float sharpnessThreshold() const {return m_sharpnessThreshold; }
+    unsigned long frameBlurredCount() const {return m_frameBlurredCount; } // New frames not searched because they were blurred.
+    // Automatic capture. The pattern is ready to capture once it has been found and held still for
+    // autoCaptureStableFrameCount consecutive results, in a view which would add at least autoCaptureScoreMin
+    // to the coverage of the views already captured (see CalibrationCoverage::score()).
+    void setAutoCaptureEnabled(const bool enabled) {m_autoCaptureEnabled = enabled; }
+    bool autoCaptureEnabled() const {return m_autoCaptureEnabled; }
+    void setAutoCaptureStableFrameCount(const int count) {m_autoCaptureStableFrameCount = count; }
+    int autoCaptureStableFrameCount() const {return m_autoCaptureStableFrameCount; }
+    void setAutoCaptureScoreMin(const float scoreMin) {m_autoCaptureScoreMin = scoreMin; }
+    float autoCaptureScoreMin() const {return m_autoCaptureScoreMin; }
+    bool autoCaptureReady() const {return (m_autoCaptureEnabled && m_autoCaptureReady); } // Call from the same thread as frame().
+    // Process the next frame from a video source. Any frame source providing the same checkoutFrameIfNewerThan()
+    // and checkinFrame() as ARVideoSource may be used, e.g. a FrameSequenceReader replaying a recording.
+    template <class FrameSource> bool frame(FrameSource *vs)
+    {
+        collectResults();
+        // Only a frame newer than any already seen is considered, so no frame is ever processed twice.
+        LatencyStatsTime start = latencyStatsNow();
+        AR2VideoBufferT *buff = vs->checkoutFrameIfNewerThan(m_frameLastTimestamp);
+        if (!buff) {
+            m_frameDuplicateCount++;
+        } else {
+            submitFrame(buff);
+            vs->checkinFrame();
+            latencyStatsRecord(LATENCY_STAGE_FRAME, start);
+        }
+        return true;
+    }
+    // Supplementary information about a set of corner finder results.
+    struct CornerFinderResultInfo {
+        int pyramidLevel; // Pyramid level at which the pattern was found, or -1 if not found.
+        bool tracked; // True if the corners were tracked from an earlier frame rather than detected.
+        float sharpness; // Sharpness score of the newest frame, which may be newer than the results.
+        bool blurred; // True if the newest frame was not searched because its sharpness was below the threshold.
+        float coverageScore; // Information the view would add to those captured, or 0 if the pattern was not found.
+    };
+    // Get the latest published corner finder results, for display. Never blocks. The results (and the frame
+    // they were found in) remain valid and unchanged until the next call to cornerFinderResultsRelease().
+    // videoFrame is NULL if no frame has been searched yet.
+    // Only one thread may acquire results. If info is non-NULL, it is filled in too.
+    bool cornerFinderResultsAcquire(int *cornerFoundAllFlag, const std::vector<cv::Point2f>** corners, ARUint8** videoFrame, CornerFinderResultInfo *info = NULL);
+    bool cornerFinderResultsRelease(void);
+    // Save the corners from the latest results. If automatic is true, only do so if they are ready for automatic capture.
+    bool capture(const bool automatic = false);
+    // Save corners supplied by the caller rather than those from the latest results, e.g. corners paired with a
+    // detection in another camera's stream. If automatic is true, only do so if the pattern has been held still and
+    // the view would add at least autoCaptureScoreMin to the coverage.
+    bool captureCorners(const std::vector<cv::Point2f>& corners, const bool automatic = false);
+    // Recent detections. The corners found in the last few published results are kept with the capture times of
+    // their frames, so that they can be matched to detections made at nearly the same time in another stream.
+    // detectionLatest() returns false if the pattern was not found in the latest published results.
+    // detectionNearest() gets the kept detection nearest in time to timestamp, and returns false if none is kept.
+    // Tracked corners are refined fully before they are returned. Both may be called from any thread.
+    bool detectionLatest(AR2VideoTimestampT *timestamp_out, std::vector<cv::Point2f>& corners);
+    bool detectionNearest(const AR2VideoTimestampT& timestamp, AR2VideoTimestampT *timestamp_out, std::vector<cv::Point2f>& corners);
+    // Copy the corners of the views captured so far.
+    void capturedCorners(CornerSet& cornerSet);
     bool uncapture();
     bool uncaptureAll();
+    // If calibViewSubsetCount is non-zero and more views than that have been captured, calib() uses only that many
+    // of them, chosen greedily for coverage.
+    void setCalibViewSubsetCount(const int count) {m_calibViewSubsetCount = count; }
+    int calibViewSubsetCount() const {return m_calibViewSubsetCount; }
+    // If enabled, calib() rejects views whose error is an outlier, and recalibrates without them. See calcRobust().
+    void setCalibOutlierRejectionEnabled(const bool enable) {m_calibOutlierRejectionEnabled = enable; }
+    bool calibOutlierRejectionEnabled() const {return m_calibOutlierRejectionEnabled; }
     void calib(ARParam *param_out, ARdouble *err_min_out, ARdouble *err_avg_out, ARdouble *err_max_out);
     ~Calibration();
     
+    // Camera intrinsics in OpenCV form, as estimated by a solve, and used to warm-start the next.
+    struct IntrinsicsEstimate {
+        cv::Mat cameraMatrix; // 3x3, CV_64F. Empty if there is no estimate.
+        cv::Mat distortionCoeff; // 4x1, CV_64F.
+        double rms; // RMS reprojection error reported by the solve, in pixels.
+    };
+    
+    // After every capture or uncapture, the captured views are recalibrated on a background thread, warm-started
+    // from the previous estimate. This reports on the latest of those solves, and how much it moved the estimate.
+    struct SolverStatus {
+        int viewCount; // Views in the latest solve.
+        double rms; // RMS reprojection error, in pixels.
+        double focalChange; // Relative change in focal length since the previous solve.
+        double principalPointChange; // Change in principal point since the previous solve, in pixels.
+        double k1Change; // Change in first radial distortion coefficient since the previous solve.
+        bool converged; // Enough views, and the estimate has stopped moving.
+    };
+    // Returns false if there has been no solve of the views currently captured.
+    bool solverStatus(SolverStatus *status);
+    bool solverConverged();
+    // Copy the latest background solver estimate. Returns false if there is none.
+    bool solverEstimate(IntrinsicsEstimate *estimate);
+    
+    // How the views are resampled to estimate the uncertainty of a calibration. See calcUncertainty().
+    enum class UncertaintyMethod {
+        BOOTSTRAP, // Each sample is as many views as there are, drawn with replacement.
+        K_FOLD // Each sample leaves out one of K interleaved folds of the views (a grouped jackknife).
+    };
+    // Standard deviation of each calibrated parameter.
+    struct Uncertainty {
+        UncertaintyMethod method;
+        int sampleCount; // Resampled solves which completed in time and in range.
+        ARdouble distFactorStdDev[AR_DIST_FACTOR_NUM_MAX]; // Of each entry of ARParam.dist_factor. Unused entries are 0.
+    };
+    // If sampleCount is non-zero, calib() also estimates the uncertainty of its result, from sampleCount resamples
+    // (or K = sampleCount folds) of the views it used.
+    void setCalibUncertainty(const UncertaintyMethod method, const int sampleCount) {m_calibUncertaintyMethod = method; m_calibUncertaintySampleCount = sampleCount; }
+    // Uncertainty of the result of the last call to calib(). Returns false if it wasn't estimated.
+    // Call only from the thread which called calib().
+    bool calibUncertainty(Uncertainty *uncertainty) const;
+    
+    // Find the pattern in a single greyscale image, using the same coarse-to-fine search and refinement as the
+    // corner finder workers. For offline use, and safe to call from any number of threads at once. pyramid is
+    // scratch space, which may be reused between calls on the same thread. Returns true if all corners were found.
+    static bool findCornersInImage(const cv::Mat& image, const CalibrationPatternType patternType, const cv::Size patternSize, std::vector<cv::Mat>& pyramid, std::vector<cv::Point2f>& corners);
+    
+    // Refine found corners to the accuracy needed for calibration.
+    static void refineCorners(const cv::Mat& image, std::vector<cv::Point2f>& corners);
+    
 private:
     
     Calibration(const Calibration&) = delete; // No copy construction.
     Calibration& operator=(const Calibration&) = delete; // No copy assignment.
     
+    // The two halves of frame(): collect and publish finished corner finder results, then hand a new frame
+    // (which must be checked in only after submitFrame() returns) to an idle corner finder.
+    void collectResults();
+    void submitFrame(const AR2VideoBufferT *buff);
+    
     // This function runs the heavy-duty corner finding process on a secondary thread. Must be static so it can be
     // passed to threadInit().
     static void *cornerFinder(THREAD_HANDLE_T *threadHandle);
     
+    // Background calibration of the captured views. Each call to solverRequest() causes at least one more solve,
+    // of the views captured at the time it starts. Requests made during a solve are coalesced into one.
+    static void *solver(THREAD_HANDLE_T *threadHandle);
+    void solverRequest();
+    
+    // Search for the pattern in image, first at pyramidLevelMax then at each finer level. pyramid holds the
+    // decimated images, and is reused between calls. Returns non-zero if all corners were found.
+    static int findCorners(const cv::Mat& image, const CalibrationPatternType patternType, const cv::Size patternSize, const int pyramidLevelMax, std::vector<cv::Mat>& pyramid, std::vector<cv::Point2f>& corners, int *pyramidLevel_out);
+    
+    // Number of decimated levels worth searching in an image of the given width.
+    static int pyramidLevelMaxForWidth(const CalibrationPatternType patternType, const int width);
+    
+    // Follow prevCorners from prevImage into image. Returns true if every corner was tracked and the tracked
+    // corners fit a homography of patternModel (the pattern's corner positions on its plane) closely.
+    static bool trackCorners(const cv::Mat& prevImage, const cv::Mat& image, const std::vector<cv::Point2f>& prevCorners, const std::vector<cv::Point2f>& patternModel, std::vector<cv::Point2f>& corners);
+    
+    // A reference-counted luma frame, drawn from a CalibrationFramePool. The buffer is written once when the
+    // frame is checked out of the video source, and thereafter only read, so it can be shared without copying
+    // between a corner finder run, the published results, and anything else holding a reference.
+    class CalibrationFramePool;
+    class CalibrationFrame {
+    public:
+        uint8_t             *buff;
+        AR2VideoTimestampT   timestamp;
+        void retain();
+        void release(); // When the last reference is released, the frame returns to its pool.
+    private:
+        friend class CalibrationFramePool;
+        std::atomic<int>     refCount;
+    };
+    
+    // A fixed set of CalibrationFrame buffers, allocated once.
+    class CalibrationFramePool {
+    public:
+        CalibrationFramePool(const int count, const int videoWidth, const int videoHeight);
+        ~CalibrationFramePool();
+        CalibrationFrame *checkout(); // Returns a free frame with a single reference, or NULL if all are in use.
+    private:
+        CalibrationFramePool(const CalibrationFramePool&) = delete;
+        CalibrationFramePool& operator=(const CalibrationFramePool&) = delete;
+        std::vector<CalibrationFrame> m_frames;
+    };
+    
     // A class to encapsulate the inputs and outputs of a corner-finding run, and to allow for copying of the results
-    // of a completed run.
+    // of a completed run. Copying shares the frame rather than duplicating it.
     class CalibrationCornerFinderData {
     public:
         CalibrationCornerFinderData(const CalibrationPatternType patternType_in, const cv::Size patternSize_in, const int videoWidth_in, const int videoHeight_in);
         CalibrationCornerFinderData(const CalibrationCornerFinderData& orig);
         const CalibrationCornerFinderData& operator=(const CalibrationCornerFinderData& orig);
         ~CalibrationCornerFinderData();
+        void setFrame(CalibrationFrame *frame_in); // Takes ownership of the caller's reference.
+        uint8_t *videoFrame() const {return (frame ? frame->buff : NULL); }
+        cv::Mat calibImage() const {return cv::Mat(videoHeight, videoWidth, CV_8UC1, videoFrame()); }
         CalibrationPatternType patternType;
         cv::Size             patternSize;
         int                  videoWidth;
         int                  videoHeight;
-        uint8_t             *videoFrame;
-        IplImage            *calibImage;
+        CalibrationFrame    *frame;
+        AR2VideoTimestampT   timestamp; // Capture time of frame.
+        cv::Rect             roi; // Region of frame to search. Empty to search the whole frame.
+        int                  pyramidLevelMax;
         int                  cornerFoundAllFlag;
+        int                  pyramidLevel; // Level at which corners were found, or -1.
+        bool                 tracked; // Corners were tracked from trackFrame, not detected.
+        float                coverageScore; // Set on publication.
         std::vector<cv::Point2f> corners;
-    private:
-        void init();
-        void copy(const CalibrationCornerFinderData& orig);
-        void dealloc();
+        // Tracking inputs. If trackFrame is non-NULL, the worker tries to follow trackCorners from it before
+        // falling back to detection, then releases it. These are not copied.
+        CalibrationFrame    *trackFrame;
+        std::vector<cv::Point2f> trackCorners;
+        const std::vector<cv::Point2f> *patternModel;
+    };
+    
+    // Corner finder workers, from a pool which may be shared with other Calibrations. While this Calibration has
+    // claimed worker i, the worker's input and output are the CalibrationCornerFinderData at index i.
+    CornerFinderPool    *m_cornerFinderPool;
+    bool                 m_cornerFinderPoolOwned; // Created by the constructor, so deleted with this Calibration.
+    std::vector<CalibrationCornerFinderData *> m_cornerFinderData;
+    std::vector<bool>    m_cornerFinderClaimed; // Workers claimed by frame() and not yet collected.
+    CalibrationFramePool *m_framePool;
+    AR2VideoTimestampT   m_frameLastTimestamp; // Time of the newest frame seen by frame().
+    unsigned long        m_frameSubmittedCount;
+    unsigned long        m_frameDroppedCount;
+    unsigned long        m_frameDuplicateCount;
+    float                m_sharpnessThreshold;
+    unsigned long        m_frameBlurredCount;
+    std::atomic<float>   m_lastFrameSharpness; // Of the newest frame. Written by frame(), read by capture() and for display.
+    std::atomic<bool>    m_lastFrameBlurred;
+    
+    // Corner finder results copies, for display to user, published through a triple buffer. frame() fills the
+    // back slot and swaps it with the middle slot, and cornerFinderResultsAcquire() swaps the front slot with the
+    // middle slot if it holds newer results. Neither side ever waits for the other.
+    std::vector<CalibrationCornerFinderData> m_cornerFinderResultData;
+    int                  m_cornerFinderResultBack; // Owned by frame().
+    std::atomic<int>     m_cornerFinderResultMiddle; // Index, plus CORNER_FINDER_RESULT_FRESH if not yet acquired.
+    int                  m_cornerFinderResultFront; // Owned by cornerFinderResultsAcquire().
+    AR2VideoTimestampT   m_cornerFinderResultTimestamp; // Time of the frame last published.
+    
+    // Region-of-interest tracking.
+    bool                 m_roiTrackingEnabled;
+    cv::Rect             m_roi; // Empty when the pattern was not found in the last published results.
+    unsigned long        m_roiSearchCount;
+    unsigned long        m_roiHitCount;
+    
+    // Optical-flow tracking.
+    bool                 m_trackingEnabled;
+    int                  m_trackingRedetectInterval;
+    int                  m_trackingRunLength; // Tracking runs submitted since the last detection run.
+    unsigned long        m_trackCount;
+    unsigned long        m_trackHitCount;
+    std::vector<cv::Point2f> m_patternModel; // Corner positions on the pattern plane, for checking tracked corners.
+    
+    // Latest corner finder results, for capture().
+    pthread_mutex_t      m_cornerFinderCaptureLock;
+    CalibrationCornerFinderData m_cornerFinderCaptureData;
+    bool                 m_cornerFinderCaptureStable; // The pattern in m_cornerFinderCaptureData has been held still.
+    std::vector<cv::Point2f> m_captureCorners; // Corners being captured by capture(), refined outside the lock.
+    
+    // Automatic capture.
+    std::atomic<bool>    m_autoCaptureEnabled;
+    int                  m_autoCaptureStableFrameCount;
+    int                  m_stableCount; // Consecutive published results in which the pattern was found and still.
+    std::vector<cv::Point2f> m_stableCorners; // Corners from the last published results in which the pattern was found.
+    float                m_autoCaptureScoreMin;
+    bool                 m_autoCaptureReady;
+    CalibrationCoverage  m_coverage; // Of the views in m_corners. Guarded by m_cornerFinderCaptureLock.
+
+    // Recent detections, in a ring written by publishResults(). Guarded by m_cornerFinderCaptureLock.
+    struct Detection {
+        AR2VideoTimestampT   timestamp;
+        std::vector<cv::Point2f> corners;
+        CalibrationFrame    *frame; // Retained if corners were tracked, and so still need refining when captured. Otherwise NULL.
     };
+    std::vector<Detection> m_detections;
+    int                  m_detectionNext; // Slot to be written next.
+    int                  m_detectionCount; // Slots in use.
+    bool                 m_detectionCurrent; // The pattern was found in the latest published results.
+
+    bool addView(const std::vector<cv::Point2f>& corners, const bool automatic); // Call with m_cornerFinderCaptureLock held.
+    void detectionRefine(CalibrationFrame *frame, std::vector<cv::Point2f>& corners); // Refine a kept detection's tracked corners, and release its frame.
+
+    void publishResults(const CalibrationCornerFinderData& result);
+    void updateROI(const CalibrationCornerFinderData& result);
     
-    CalibrationCornerFinderData m_cornerFinderData; // Corner finder input and output.
-    THREAD_HANDLE_T     *m_cornerFinderThread = NULL;
-    pthread_mutex_t      m_cornerFinderResultLock;
-    CalibrationCornerFinderData m_cornerFinderResultData; // Corner finder results copy, for display to user.
+    // Background solver.
+    THREAD_HANDLE_T     *m_solverThread;
+    pthread_mutex_t      m_solverLock; // Guards the estimate and status.
+    IntrinsicsEstimate   m_solverEstimate;
+    SolverStatus         m_solverStatus;
+    bool                 m_solverStatusValid;
     
-    std::vector<std::vector<cv::Point2f> > m_corners; // Collected corner information which gets passed to the OpenCV calibration function.
+    CornerSet            m_corners; // Collected corner information which gets passed to the calibration solver.
     int                  m_calibImageCountMax;
+    int                  m_calibViewSubsetCount;
+    bool                 m_calibOutlierRejectionEnabled;
+    UncertaintyMethod    m_calibUncertaintyMethod;
+    int                  m_calibUncertaintySampleCount;
+    Uncertainty          m_calibUncertainty; // Of the last calib().
+    bool                 m_calibUncertaintyValid;
     CalibrationPatternType m_patternType;
     cv::Size             m_patternSize;
     int                  m_chessboardSquareWidth;
+    int                  m_pyramidLevelMax;
     int                  m_videoWidth;
     int                  m_videoHeight;
 };
+
+// A pool of corner finder worker threads, which several Calibrations may share, e.g. one for each camera of a
+// multi-camera station. A Calibration claims an idle worker for each frame it submits, and releases it once it has
+// collected the results, so the workers go to whichever cameras are delivering frames.
+class Calibration::CornerFinderPool
+{
+public:
+    // Pass 0 for workerCount to use one thread per available CPU core, less one for the thread calling frame().
+    CornerFinderPool(const int workerCount = 0);
+    ~CornerFinderPool(); // Every Calibration using the pool must be deleted first.
+    int workerCount() const {return (int)m_workers.size(); }
+    
+private:
+    friend class Calibration;
+    CornerFinderPool(const CornerFinderPool&) = delete; // No copy construction.
+    CornerFinderPool& operator=(const CornerFinderPool&) = delete; // No copy assignment.
+    
+    struct Worker {
+        THREAD_HANDLE_T     *thread;
+        CalibrationCornerFinderData *data; // The claimant's input and output. Set before each run is started.
+        bool                 claimed; // Guarded by m_lock.
+    };
+    std::vector<Worker *> m_workers;
+    pthread_mutex_t      m_lock;
+    
+    int claim(); // Returns the index of a worker no other Calibration has claimed, now claimed, or -1 if there is none.
+    void release(const int worker);
+};
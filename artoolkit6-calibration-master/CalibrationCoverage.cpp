@@ -0,0 +1,163 @@
+/*
+ *  CalibrationCoverage.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "CalibrationCoverage.hpp"
+#include <algorithm>
+#include <cmath>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#define COVERAGE_GRID_SIZE 8 // The image is divided into a grid of this many cells in each dimension.
+#define COVERAGE_GRID_WEIGHT 0.5f // Weight of grid occupancy in the score. Pose takes the remainder.
+
+// Tilt is measured as the log of the ratio of the lengths of opposite sides of the pattern. Untilted views
+// fall in the first bin, and tilted views are further binned by magnitude and by which axis they are tilted about.
+static const float kTiltBinEdges[] = {0.05f, 0.15f, 0.3f};
+#define COVERAGE_TILT_MAGNITUDE_BINS (sizeof(kTiltBinEdges)/sizeof(kTiltBinEdges[0]) + 1)
+#define COVERAGE_TILT_BINS (1 + (COVERAGE_TILT_MAGNITUDE_BINS - 1)*2)
+// Apparent size is the square root of the area of the pattern as a fraction of that of the frame, a proxy for distance.
+static const float kScaleBinEdges[] = {0.25f, 0.45f};
+#define COVERAGE_SCALE_BINS (sizeof(kScaleBinEdges)/sizeof(kScaleBinEdges[0]) + 1)
+
+CalibrationCoverage::CalibrationCoverage(const cv::Size patternSize, const int videoWidth, const int videoHeight) :
+    m_patternSize(patternSize),
+    m_videoWidth(videoWidth),
+    m_videoHeight(videoHeight),
+    m_gridCounts(COVERAGE_GRID_SIZE*COVERAGE_GRID_SIZE, 0),
+    m_poseCounts(COVERAGE_TILT_BINS*COVERAGE_SCALE_BINS, 0),
+    m_views()
+{
+}
+
+int CalibrationCoverage::cell(const cv::Point2f& corner) const
+{
+    const int x = std::min(std::max((int)(corner.x * COVERAGE_GRID_SIZE / m_videoWidth), 0), COVERAGE_GRID_SIZE - 1);
+    const int y = std::min(std::max((int)(corner.y * COVERAGE_GRID_SIZE / m_videoHeight), 0), COVERAGE_GRID_SIZE - 1);
+    return (y*COVERAGE_GRID_SIZE + x);
+}
+
+int CalibrationCoverage::poseBin(const std::vector<cv::Point2f>& corners) const
+{
+    if ((int)corners.size() != m_patternSize.area() || corners.empty()) return -1;
+
+    // The outermost corners, in the corner finder's row-major order.
+    const cv::Point2f& tl = corners[0];
+    const cv::Point2f& tr = corners[m_patternSize.width - 1];
+    const cv::Point2f& bl = corners[(m_patternSize.height - 1)*m_patternSize.width];
+    const cv::Point2f& br = corners[m_patternSize.height*m_patternSize.width - 1];
+
+    const float left = (float)cv::norm(bl - tl), right = (float)cv::norm(br - tr);
+    const float top = (float)cv::norm(tr - tl), bottom = (float)cv::norm(br - bl);
+    const float tiltX = (left > 0.0f && right > 0.0f ? logf(right / left) : 0.0f);
+    const float tiltY = (top > 0.0f && bottom > 0.0f ? logf(bottom / top) : 0.0f);
+    const float tilt = sqrtf(tiltX*tiltX + tiltY*tiltY);
+    int tiltBin = 0;
+    while (tiltBin < (int)COVERAGE_TILT_MAGNITUDE_BINS - 1 && tilt >= kTiltBinEdges[tiltBin]) tiltBin++;
+    if (tiltBin > 0) tiltBin = 1 + (tiltBin - 1)*2 + (fabsf(tiltX) >= fabsf(tiltY) ? 0 : 1);
+
+    std::vector<cv::Point2f> quad = {tl, tr, br, bl};
+    const float scale = sqrtf((float)cv::contourArea(quad) / ((float)m_videoWidth * (float)m_videoHeight));
+    int scaleBin = 0;
+    while (scaleBin < (int)COVERAGE_SCALE_BINS - 1 && scale >= kScaleBinEdges[scaleBin]) scaleBin++;
+
+    return (tiltBin*COVERAGE_SCALE_BINS + scaleBin);
+}
+
+void CalibrationCoverage::add(const std::vector<cv::Point2f>& corners)
+{
+    View view;
+    view.poseBin = poseBin(corners);
+    if (view.poseBin >= 0) m_poseCounts[view.poseBin]++;
+    view.cells.reserve(corners.size());
+    for (const cv::Point2f& corner : corners) {
+        const int c = cell(corner);
+        m_gridCounts[c]++;
+        view.cells.push_back(c);
+    }
+    m_views.push_back(view);
+}
+
+void CalibrationCoverage::removeLast()
+{
+    if (m_views.empty()) return;
+    const View& view = m_views.back();
+    if (view.poseBin >= 0) m_poseCounts[view.poseBin]--;
+    for (int c : view.cells) m_gridCounts[c]--;
+    m_views.pop_back();
+}
+
+void CalibrationCoverage::clear()
+{
+    std::fill(m_gridCounts.begin(), m_gridCounts.end(), 0);
+    std::fill(m_poseCounts.begin(), m_poseCounts.end(), 0);
+    m_views.clear();
+}
+
+float CalibrationCoverage::score(const std::vector<cv::Point2f>& corners) const
+{
+    const int bin = poseBin(corners);
+    if (bin < 0) return 0.0f;
+
+    // Each corner or view adds less, the more already fall in its cell or bin.
+    float gridGain = 0.0f;
+    for (const cv::Point2f& corner : corners) gridGain += 1.0f / (float)(1 + m_gridCounts[cell(corner)]);
+    gridGain /= (float)corners.size();
+    const float poseGain = 1.0f / (float)(1 + m_poseCounts[bin]);
+
+    return (COVERAGE_GRID_WEIGHT*gridGain + (1.0f - COVERAGE_GRID_WEIGHT)*poseGain);
+}
+
+float CalibrationCoverage::gridCoverage() const
+{
+    int occupied = 0;
+    for (int count : m_gridCounts) if (count > 0) occupied++;
+    return ((float)occupied / (float)m_gridCounts.size());
+}
+
+// static
+void CalibrationCoverage::selectViews(const CornerSet& cornerSet, const cv::Size patternSize, const int videoWidth, const int videoHeight, const int count, std::vector<int>& selected)
+{
+    selected.clear();
+    CalibrationCoverage coverage(patternSize, videoWidth, videoHeight);
+    const int viewCount = cornerSet.viewCount();
+    std::vector<bool> taken(viewCount, false);
+    std::vector<cv::Point2f> corners;
+
+    while ((int)selected.size() < count && (int)selected.size() < viewCount) {
+        int best = -1;
+        float bestScore = -1.0f;
+        for (int i = 0; i < viewCount; i++) {
+            if (taken[i]) continue;
+            cornerSet.copyView(i, corners);
+            const float s = coverage.score(corners);
+            if (s > bestScore) {
+                bestScore = s;
+                best = i;
+            }
+        }
+        taken[best] = true;
+        cornerSet.copyView(best, corners);
+        coverage.add(corners);
+        selected.push_back(best);
+    }
+}
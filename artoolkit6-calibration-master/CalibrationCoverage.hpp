@@ -0,0 +1,71 @@
+/*
+ *  CalibrationCoverage.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include "CornerSet.hpp"
+
+// A model of how well a set of views of the calibration pattern covers what a calibration needs to see: corners
+// spread over the whole image (to constrain distortion and the principal point), and the pattern at a range of
+// tilts and distances (to constrain focal length). It records an occupancy count for each cell of a grid over the
+// image, and a histogram of the views' poses binned by tilt and apparent size.
+class CalibrationCoverage
+{
+public:
+    CalibrationCoverage(const cv::Size patternSize, const int videoWidth, const int videoHeight);
+
+    void add(const std::vector<cv::Point2f>& corners);
+    void removeLast();
+    void clear();
+    int viewCount() const {return (int)m_views.size(); }
+
+    // The information a view with these corners would add to the views already added, from 0 (nothing new)
+    // to 1 (every corner in an empty grid cell, and the pose in an empty bin).
+    float score(const std::vector<cv::Point2f>& corners) const;
+
+    // Fraction of grid cells holding at least one corner.
+    float gridCoverage() const;
+
+    // Choose count views from cornerSet, greedily taking at each step the view which adds the most information to
+    // those already chosen. The indices of the chosen views are returned in selected, in the order chosen.
+    static void selectViews(const CornerSet& cornerSet, const cv::Size patternSize, const int videoWidth, const int videoHeight, const int count, std::vector<int>& selected);
+
+private:
+    struct View {
+        int poseBin;
+        std::vector<int> cells;
+    };
+
+    int poseBin(const std::vector<cv::Point2f>& corners) const; // Returns -1 if corners is not a full set.
+    int cell(const cv::Point2f& corner) const;
+
+    cv::Size             m_patternSize;
+    int                  m_videoWidth;
+    int                  m_videoHeight;
+    std::vector<int>     m_gridCounts; // Corners in each grid cell, row-major.
+    std::vector<int>     m_poseCounts; // Views in each pose bin.
+    std::vector<View>    m_views;
+};
@@ -0,0 +1,189 @@
+/*
+ *  CornerSet.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "CornerSet.hpp"
+#include <AR6/AR/ar.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <utility>
+
+#define CORNER_SET_ALIGNMENT 64 // Bytes. A cache line, and enough for any SIMD width in use.
+#define CORNER_SET_VIEW_CAPACITY_MIN 16
+
+CornerSet::CornerSet() :
+    m_pointCount(0),
+    m_stride(0),
+    m_viewCount(0),
+    m_viewCapacity(0),
+    m_block(NULL),
+    m_data(NULL)
+{
+}
+
+CornerSet::CornerSet(const int pointCount) :
+    CornerSet()
+{
+    setPointCount(pointCount);
+}
+
+CornerSet::CornerSet(const CornerSet& other) :
+    CornerSet()
+{
+    *this = other;
+}
+
+CornerSet::CornerSet(CornerSet&& other) :
+    CornerSet()
+{
+    *this = std::move(other);
+}
+
+CornerSet& CornerSet::operator=(const CornerSet& other)
+{
+    if (this == &other) return *this;
+    m_viewCount = 0;
+    if (other.m_pointCount != m_pointCount) {
+        free(m_block);
+        m_block = NULL;
+        m_data = NULL;
+        m_viewCapacity = 0;
+        setPointCount(other.m_pointCount);
+    }
+    if (other.m_viewCount > m_viewCapacity) grow(other.m_viewCount);
+    if (other.m_viewCount) memcpy(m_data, other.m_data, (size_t)other.m_viewCount*2*m_stride*sizeof(float));
+    m_viewCount = other.m_viewCount;
+    return *this;
+}
+
+CornerSet& CornerSet::operator=(CornerSet&& other)
+{
+    if (this == &other) return *this;
+    free(m_block);
+    m_pointCount = other.m_pointCount;
+    m_stride = other.m_stride;
+    m_viewCount = other.m_viewCount;
+    m_viewCapacity = other.m_viewCapacity;
+    m_block = other.m_block;
+    m_data = other.m_data;
+    other.m_viewCount = other.m_viewCapacity = 0;
+    other.m_block = NULL;
+    other.m_data = NULL;
+    return *this;
+}
+
+CornerSet::~CornerSet()
+{
+    free(m_block);
+}
+
+void CornerSet::setPointCount(const int pointCount)
+{
+    const int floatsPerLine = CORNER_SET_ALIGNMENT/sizeof(float);
+    m_pointCount = pointCount;
+    m_stride = (pointCount + floatsPerLine - 1)/floatsPerLine*floatsPerLine;
+}
+
+void CornerSet::grow(const int viewCapacity)
+{
+    const size_t size = (size_t)viewCapacity*2*m_stride*sizeof(float);
+    void *block = malloc(size + CORNER_SET_ALIGNMENT - 1);
+    if (!block) {
+        ARLOGe("Out of memory!\n");
+        exit(-1);
+    }
+    float *data = (float *)(((uintptr_t)block + CORNER_SET_ALIGNMENT - 1) & ~(uintptr_t)(CORNER_SET_ALIGNMENT - 1));
+    if (m_viewCount) memcpy(data, m_data, (size_t)m_viewCount*2*m_stride*sizeof(float));
+    free(m_block);
+    m_block = block;
+    m_data = data;
+    m_viewCapacity = viewCapacity;
+}
+
+void CornerSet::reserve(const int viewCount)
+{
+    if (viewCount > m_viewCapacity && m_stride) grow(viewCount);
+}
+
+void CornerSet::push_back(const std::vector<cv::Point2f>& corners)
+{
+    if (!m_pointCount && !m_viewCount) setPointCount((int)corners.size());
+    if ((int)corners.size() != m_pointCount) {
+        ARLOGe("Error: view has %d corners, but corner set has %d per view.\n", (int)corners.size(), m_pointCount);
+        return;
+    }
+    if (m_viewCount == m_viewCapacity) grow(std::max(m_viewCapacity*2, CORNER_SET_VIEW_CAPACITY_MIN));
+    float *vx = m_data + (size_t)m_viewCount*2*m_stride;
+    float *vy = vx + m_stride;
+    for (int i = 0; i < m_pointCount; i++) {
+        vx[i] = corners[i].x;
+        vy[i] = corners[i].y;
+    }
+    for (int i = m_pointCount; i < m_stride; i++) vx[i] = vy[i] = 0.0f; // Padding, so that whole-stride loops read defined values.
+    m_viewCount++;
+}
+
+void CornerSet::push_back(const CornerSet& other, const int view)
+{
+    if (!m_pointCount && !m_viewCount) setPointCount(other.m_pointCount);
+    if (other.m_pointCount != m_pointCount) {
+        ARLOGe("Error: view has %d corners, but corner set has %d per view.\n", other.m_pointCount, m_pointCount);
+        return;
+    }
+    if (m_viewCount == m_viewCapacity) grow(std::max(m_viewCapacity*2, CORNER_SET_VIEW_CAPACITY_MIN));
+    memcpy(m_data + (size_t)m_viewCount*2*m_stride, other.x(view), 2*m_stride*sizeof(float));
+    m_viewCount++;
+}
+
+void CornerSet::pop_back()
+{
+    if (m_viewCount > 0) m_viewCount--;
+}
+
+void CornerSet::clear()
+{
+    m_viewCount = 0;
+}
+
+void CornerSet::copyView(const int view, std::vector<cv::Point2f>& corners) const
+{
+    if ((int)corners.size() != m_pointCount) corners.resize(m_pointCount);
+    const float *vx = x(view), *vy = y(view);
+    for (int i = 0; i < m_pointCount; i++) corners[i] = cv::Point2f(vx[i], vy[i]);
+}
+
+void CornerSet::copyViews(std::vector<std::vector<cv::Point2f> >& cornerSet) const
+{
+    cornerSet.resize(m_viewCount);
+    for (int k = 0; k < m_viewCount; k++) copyView(k, cornerSet[k]);
+}
+
+CornerSet CornerSet::subset(const std::vector<int>& views) const
+{
+    CornerSet s(m_pointCount);
+    s.reserve((int)views.size());
+    for (int view : views) s.push_back(*this, view);
+    return s;
+}
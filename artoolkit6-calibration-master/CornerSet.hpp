@@ -0,0 +1,79 @@
+/*
+ *  CornerSet.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+// The corners found in a set of views of the calibration pattern, each view having the same number of corners, in
+// corner finder order. All views are held in one block of memory. Each view's x and y coordinates are in separate
+// arrays, each starting on a 64-byte boundary, so that loops over a view's corners vectorise. Adding a view copies
+// it into the block, which grows (by doubling) only when full, so a set of thousands of views is a handful of
+// allocations rather than one per view.
+class CornerSet
+{
+public:
+    CornerSet();
+    explicit CornerSet(const int pointCount);
+    CornerSet(const CornerSet& other);
+    CornerSet(CornerSet&& other);
+    CornerSet& operator=(const CornerSet& other); // Reuses this set's block if it is large enough.
+    CornerSet& operator=(CornerSet&& other);
+    ~CornerSet();
+    
+    int pointCount() const {return m_pointCount; } // Corners per view.
+    int viewCount() const {return m_viewCount; }
+    bool empty() const {return (m_viewCount == 0); }
+    void reserve(const int viewCount);
+    
+    // Append a view of pointCount() corners. If the set has no point count yet, it takes that of corners.
+    void push_back(const std::vector<cv::Point2f>& corners);
+    // Append view of other, which must have the same point count.
+    void push_back(const CornerSet& other, const int view);
+    void pop_back();
+    void clear(); // Keeps the block and point count.
+    
+    const float *x(const int view) const {return (m_data + (size_t)view*2*m_stride); }
+    const float *y(const int view) const {return (m_data + (size_t)view*2*m_stride + m_stride); }
+    cv::Point2f corner(const int view, const int i) const {return cv::Point2f(x(view)[i], y(view)[i]); }
+    
+    // Copy a view's corners out as points, for interfaces which need them so. corners is resized only if needed.
+    void copyView(const int view, std::vector<cv::Point2f>& corners) const;
+    // Copy all views out as points, e.g. for cv::calibrateCamera().
+    void copyViews(std::vector<std::vector<cv::Point2f> >& cornerSet) const;
+    // A new set of the views at the given indices, in that order. Indices may repeat.
+    CornerSet subset(const std::vector<int>& views) const;
+    
+private:
+    void setPointCount(const int pointCount);
+    void grow(const int viewCapacity);
+    
+    int m_pointCount;
+    int m_stride; // Floats from a view's x array to its y array: pointCount rounded up to a multiple of 64 bytes.
+    int m_viewCount;
+    int m_viewCapacity;
+    void *m_block; // As allocated.
+    float *m_data; // m_block, aligned.
+};
@@ -0,0 +1,393 @@
+/*
+ *  FrameSequence.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "FrameSequence.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <sys/time.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#define FRAME_SEQUENCE_MAGIC "AR6LUMA"
+#define FRAME_SEQUENCE_VERSION 1
+#define FRAME_SEQUENCE_FRAME_ZLIB 0x1 // Index entry flag: frame is zlib-compressed.
+#define FRAME_SEQUENCE_FRAME_INTERVAL_DEFAULT 33333 // Microseconds between loops of a single-frame sequence.
+
+struct FrameSequenceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frameCount;
+    uint64_t indexOffset;
+    uint8_t reserved[32];
+};
+
+static_assert(sizeof(FrameSequenceHeader) == 64, "FrameSequenceHeader must be 64 bytes");
+static_assert(sizeof(FrameSequenceIndexEntry) == 32, "FrameSequenceIndexEntry must be 32 bytes");
+
+static uint64_t timeNowUsec(void)
+{
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    return ((((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime) / 10);
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((uint64_t)tv.tv_sec*1000000ull + (uint64_t)tv.tv_usec);
+#endif
+}
+
+//
+// FrameSequenceWriter.
+//
+
+FrameSequenceWriter::FrameSequenceWriter() :
+    m_fp(NULL),
+    m_width(0),
+    m_height(0),
+    m_compress(false),
+    m_offset(0),
+    m_compressBuff(),
+    m_index()
+{
+}
+
+FrameSequenceWriter::~FrameSequenceWriter()
+{
+    close();
+}
+
+bool FrameSequenceWriter::open(const char *path, const int width, const int height, const bool compress)
+{
+    if (m_fp) close();
+    if (!path || width <= 0 || height <= 0) return false;
+
+    if (!(m_fp = fopen(path, "wb"))) {
+        ARLOGe("Error opening frame sequence file '%s' for writing.\n", path);
+        ARLOGperror(NULL);
+        return false;
+    }
+    // Space for the header, which is written on close.
+    FrameSequenceHeader header;
+    memset(&header, 0, sizeof(header));
+    if (fwrite(&header, sizeof(header), 1, m_fp) != 1) {
+        ARLOGe("Error writing frame sequence file '%s'.\n", path);
+        fclose(m_fp);
+        m_fp = NULL;
+        return false;
+    }
+    m_width = width;
+    m_height = height;
+    m_compress = compress;
+    m_offset = sizeof(header);
+    m_index.clear();
+    if (m_compress) m_compressBuff.resize(compressBound((uLong)(width*height)));
+    return true;
+}
+
+bool FrameSequenceWriter::append(const uint8_t *luma, const AR2VideoTimestampT& time)
+{
+    if (!m_fp || !luma) return false;
+
+    FrameSequenceIndexEntry entry;
+    entry.sec = time.sec;
+    entry.usec = time.usec;
+    entry.flags = 0;
+    entry.offset = m_offset;
+    const uint8_t *data = luma;
+    entry.size = (uint64_t)(m_width*m_height);
+    if (m_compress) {
+        uLongf compressedSize = (uLongf)m_compressBuff.size();
+        if (compress2(m_compressBuff.data(), &compressedSize, luma, (uLong)(m_width*m_height), Z_BEST_SPEED) == Z_OK && compressedSize < entry.size) {
+            data = m_compressBuff.data();
+            entry.size = compressedSize;
+            entry.flags |= FRAME_SEQUENCE_FRAME_ZLIB;
+        }
+    }
+    if (fwrite(data, (size_t)entry.size, 1, m_fp) != 1) {
+        ARLOGe("Error writing frame sequence frame %d.\n", (int)m_index.size());
+        return false;
+    }
+    m_offset += entry.size;
+    m_index.push_back(entry);
+    return true;
+}
+
+bool FrameSequenceWriter::close()
+{
+    if (!m_fp) return false;
+
+    bool ok = true;
+    if (!m_index.empty() && fwrite(m_index.data(), sizeof(FrameSequenceIndexEntry), m_index.size(), m_fp) != m_index.size()) ok = false;
+    FrameSequenceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FRAME_SEQUENCE_MAGIC, sizeof(FRAME_SEQUENCE_MAGIC));
+    header.version = FRAME_SEQUENCE_VERSION;
+    header.width = (uint32_t)m_width;
+    header.height = (uint32_t)m_height;
+    header.frameCount = (ok ? (uint32_t)m_index.size() : 0);
+    header.indexOffset = m_offset;
+    if (fseek(m_fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, m_fp) != 1) ok = false;
+    if (fclose(m_fp) != 0) ok = false;
+    m_fp = NULL;
+    if (!ok) ARLOGe("Error completing frame sequence file.\n");
+    m_index.clear();
+    m_compressBuff.clear();
+    return ok;
+}
+
+//
+// FrameSequenceReader.
+//
+
+FrameSequenceReader::FrameSequenceReader() :
+    m_data(NULL),
+    m_dataSize(0),
+    m_mapped(false),
+    m_width(0),
+    m_height(0),
+    m_frameCount(0),
+    m_indexOffset(0),
+    m_realtime(false),
+    m_loop(false),
+    m_next(0),
+    m_passDurationUsec(0),
+    m_loopOffsetUsec(0),
+    m_playStartUsec(0),
+    m_buff()
+{
+    memset(&m_videoBuffer, 0, sizeof(m_videoBuffer));
+}
+
+FrameSequenceReader::~FrameSequenceReader()
+{
+    close();
+}
+
+bool FrameSequenceReader::open(const char *path)
+{
+    if (m_data) close();
+    if (!path) return false;
+
+#ifdef _WIN32
+    // No mapping; read the whole file.
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        ARLOGe("Error opening frame sequence file '%s'.\n", path);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = (size > 0 ? (uint8_t *)malloc((size_t)size) : NULL);
+    if (!data || fread(data, (size_t)size, 1, fp) != 1) {
+        ARLOGe("Error reading frame sequence file '%s'.\n", path);
+        free(data);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    m_data = data;
+    m_dataSize = (size_t)size;
+    m_mapped = false;
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) {
+        ARLOGe("Error opening frame sequence file '%s'.\n", path);
+        ARLOGperror(NULL);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ARLOGe("Error reading frame sequence file '%s'.\n", path);
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping remains valid.
+    if (map == MAP_FAILED) {
+        ARLOGe("Error mapping frame sequence file '%s'.\n", path);
+        ARLOGperror(NULL);
+        return false;
+    }
+    // Frames are mostly read in order.
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    m_data = (const uint8_t *)map;
+    m_dataSize = (size_t)st.st_size;
+    m_mapped = true;
+#endif
+
+    // Validate.
+    FrameSequenceHeader header;
+    bool ok = (m_dataSize >= sizeof(header));
+    if (ok) {
+        memcpy(&header, m_data, sizeof(header));
+        ok = (memcmp(header.magic, FRAME_SEQUENCE_MAGIC, sizeof(FRAME_SEQUENCE_MAGIC)) == 0 && header.version == FRAME_SEQUENCE_VERSION
+              && header.width > 0 && header.height > 0 && header.frameCount > 0
+              && header.indexOffset >= sizeof(header) && header.indexOffset <= m_dataSize
+              && (m_dataSize - header.indexOffset) / sizeof(FrameSequenceIndexEntry) >= header.frameCount);
+    }
+    if (ok) {
+        m_width = (int)header.width;
+        m_height = (int)header.height;
+        m_frameCount = (int)header.frameCount;
+        m_indexOffset = header.indexOffset;
+        for (int i = 0; i < m_frameCount && ok; i++) {
+            const FrameSequenceIndexEntry entry = indexEntry(i);
+            ok = (entry.offset >= sizeof(header) && entry.offset <= m_indexOffset && entry.size <= m_indexOffset - entry.offset
+                  && ((entry.flags & FRAME_SEQUENCE_FRAME_ZLIB) || entry.size == (uint64_t)(m_width*m_height))
+                  && (i == 0 || frameTimeUsec(i) > frameTimeUsec(i - 1)));
+        }
+    }
+    if (!ok) {
+        ARLOGe("Error: '%s' is not a valid frame sequence file, or was not completely written.\n", path);
+        close();
+        return false;
+    }
+
+    m_buff.resize(m_width*m_height);
+    const uint64_t span = frameTimeUsec(m_frameCount - 1) - frameTimeUsec(0);
+    m_passDurationUsec = span + (m_frameCount > 1 ? span / (m_frameCount - 1) : FRAME_SEQUENCE_FRAME_INTERVAL_DEFAULT);
+    rewind();
+    ARLOGi("Opened frame sequence '%s': %d frames of %dx%d.\n", path, m_frameCount, m_width, m_height);
+    return true;
+}
+
+void FrameSequenceReader::close()
+{
+    if (!m_data) return;
+#ifdef _WIN32
+    free((void *)m_data);
+#else
+    if (m_mapped) munmap((void *)m_data, m_dataSize);
+#endif
+    m_data = NULL;
+    m_dataSize = 0;
+    m_mapped = false;
+    m_width = m_height = m_frameCount = 0;
+    m_buff.clear();
+    memset(&m_videoBuffer, 0, sizeof(m_videoBuffer));
+}
+
+void FrameSequenceReader::rewind()
+{
+    m_next = 0;
+    m_loopOffsetUsec = 0;
+    m_playStartUsec = 0;
+}
+
+FrameSequenceIndexEntry FrameSequenceReader::indexEntry(const int index) const
+{
+    // The index need not be aligned in the file, so copy the entry out.
+    FrameSequenceIndexEntry entry;
+    memcpy(&entry, m_data + m_indexOffset + (uint64_t)index*sizeof(FrameSequenceIndexEntry), sizeof(entry));
+    return entry;
+}
+
+uint64_t FrameSequenceReader::frameTimeUsec(const int index) const
+{
+    const FrameSequenceIndexEntry entry = indexEntry(index);
+    return (entry.sec*1000000ull + entry.usec);
+}
+
+bool FrameSequenceReader::decode(const int index)
+{
+    const FrameSequenceIndexEntry entry = indexEntry(index);
+    const uint8_t *src = m_data + entry.offset;
+    if (entry.flags & FRAME_SEQUENCE_FRAME_ZLIB) {
+        uLongf size = (uLongf)m_buff.size();
+        if (uncompress(m_buff.data(), &size, src, (uLong)entry.size) != Z_OK || size != (uLongf)m_buff.size()) {
+            ARLOGe("Error decompressing frame sequence frame %d.\n", index);
+            return false;
+        }
+        m_videoBuffer.buffLuma = m_buff.data();
+    } else {
+        m_videoBuffer.buffLuma = (ARUint8 *)src; // Read-only mapping; callers only read video buffers.
+    }
+    m_videoBuffer.buff = m_videoBuffer.buffLuma;
+    m_videoBuffer.bufPlanes = NULL;
+    m_videoBuffer.bufPlaneCount = 0;
+    m_videoBuffer.fillFlag = 1;
+    return true;
+}
+
+AR2VideoBufferT *FrameSequenceReader::frameAt(const int index)
+{
+    if (!m_data || index < 0 || index >= m_frameCount) return NULL;
+    if (!decode(index)) return NULL;
+    const FrameSequenceIndexEntry entry = indexEntry(index);
+    m_videoBuffer.time.sec = entry.sec;
+    m_videoBuffer.time.usec = entry.usec;
+    return &m_videoBuffer;
+}
+
+AR2VideoBufferT *FrameSequenceReader::checkoutFrameIfNewerThan(const AR2VideoTimestampT& t)
+{
+    if (!m_data) return NULL;
+    if (m_next >= m_frameCount) {
+        if (!m_loop) return NULL;
+        m_next = 0;
+        m_loopOffsetUsec += m_passDurationUsec;
+        if (m_playStartUsec) m_playStartUsec += m_passDurationUsec;
+    }
+
+    int index = m_next;
+    if (m_realtime) {
+        // Take the latest frame which has fallen due, if any.
+        const uint64_t now = timeNowUsec();
+        if (!m_playStartUsec) m_playStartUsec = now;
+        const uint64_t elapsed = now - m_playStartUsec;
+        const uint64_t first = frameTimeUsec(0);
+        if (frameTimeUsec(index) - first > elapsed) return NULL;
+        while (index + 1 < m_frameCount && frameTimeUsec(index + 1) - first <= elapsed) index++;
+    }
+
+    const uint64_t time = frameTimeUsec(index) + m_loopOffsetUsec;
+    if (time <= t.sec*1000000ull + t.usec) {
+        m_next = index + 1;
+        return NULL;
+    }
+    if (!decode(index)) {
+        m_next = index + 1;
+        return NULL;
+    }
+    m_videoBuffer.time.sec = time / 1000000ull;
+    m_videoBuffer.time.usec = (uint32_t)(time % 1000000ull);
+    m_next = index + 1;
+    return &m_videoBuffer;
+}
+
+void FrameSequenceReader::checkinFrame()
+{
+    // Nothing to release; the buffer is reused on the next checkout.
+}
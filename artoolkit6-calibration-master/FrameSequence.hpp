@@ -0,0 +1,137 @@
+/*
+ *  FrameSequence.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+// Recording and replay of sequences of timestamped luma frames, so that the calibration pipeline can be run
+// repeatably without a camera.
+//
+// File layout (all fields little-endian):
+//   header: "AR6LUMA\0", uint32 version, uint32 width, uint32 height, uint32 frameCount, uint64 indexOffset,
+//           padded to 64 bytes.
+//   frame data, each frame either raw (width*height bytes) or zlib-compressed.
+//   index: frameCount entries of {uint64 sec, uint32 usec, uint32 flags, uint64 offset, uint64 size}.
+// The index is written last, so a recording which was not closed cleanly has a frameCount of 0 and is rejected.
+
+#pragma once
+
+#include <AR6/AR/ar.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define FRAME_SEQUENCE_EXTENSION "lseq"
+
+struct FrameSequenceIndexEntry {
+    uint64_t sec;
+    uint32_t usec;
+    uint32_t flags;
+    uint64_t offset; // From the start of the file.
+    uint64_t size; // Bytes stored.
+};
+
+// Writes a sequence of luma frames to a file.
+class FrameSequenceWriter
+{
+public:
+    FrameSequenceWriter();
+    ~FrameSequenceWriter(); // Calls close().
+
+    // If compress is true, each frame is zlib-compressed (at the fastest level) if that makes it smaller.
+    bool open(const char *path, const int width, const int height, const bool compress);
+    // Frames must be appended in order of increasing timestamp.
+    bool append(const uint8_t *luma, const AR2VideoTimestampT& time);
+    // Writes the index and header. Returns false if the recording could not be completed.
+    bool close();
+    bool isOpen() const {return (m_fp != NULL); }
+    int frameCount() const {return (int)m_index.size(); }
+
+private:
+    FrameSequenceWriter(const FrameSequenceWriter&) = delete; // No copy construction.
+    FrameSequenceWriter& operator=(const FrameSequenceWriter&) = delete; // No copy assignment.
+
+    FILE *m_fp;
+    int m_width;
+    int m_height;
+    bool m_compress;
+    uint64_t m_offset;
+    std::vector<uint8_t> m_compressBuff;
+    std::vector<FrameSequenceIndexEntry> m_index;
+};
+
+// Replays a sequence of luma frames from a file written by FrameSequenceWriter. The file is memory-mapped, and
+// uncompressed frames are returned without copying. Provides the checkoutFrameIfNewerThan() and checkinFrame()
+// of ARVideoSource, so can be passed to Calibration::frame().
+class FrameSequenceReader
+{
+public:
+    FrameSequenceReader();
+    ~FrameSequenceReader(); // Calls close().
+
+    bool open(const char *path);
+    void close();
+    bool isOpen() const {return (m_data != NULL); }
+    int getVideoWidth() const {return m_width; }
+    int getVideoHeight() const {return m_height; }
+    int frameCount() const {return m_frameCount; }
+
+    // By default, every frame is returned in turn, as fast as they are asked for. If realtime is true, frames are
+    // paced by their timestamps, and frames which fall due while the caller is busy are skipped, as with a camera.
+    void setRealtime(const bool realtime) {m_realtime = realtime; }
+    bool realtime() const {return m_realtime; }
+    // If loop is true, the sequence restarts after the last frame, with timestamps continuing to increase.
+    void setLoop(const bool loop) {m_loop = loop; }
+    bool loop() const {return m_loop; }
+    void rewind();
+    bool atEnd() const {return (!m_loop && m_next >= m_frameCount); }
+
+    AR2VideoBufferT *checkoutFrameIfNewerThan(const AR2VideoTimestampT& t);
+    void checkinFrame();
+
+    // Random access to a frame, for offline use. The returned buffer is valid until the next call to frameAt()
+    // or checkoutFrameIfNewerThan(). Returns NULL on error.
+    AR2VideoBufferT *frameAt(const int index);
+
+private:
+    FrameSequenceReader(const FrameSequenceReader&) = delete; // No copy construction.
+    FrameSequenceReader& operator=(const FrameSequenceReader&) = delete; // No copy assignment.
+
+    FrameSequenceIndexEntry indexEntry(const int index) const;
+    uint64_t frameTimeUsec(const int index) const; // Not including the loop offset.
+    bool decode(const int index);
+
+    const uint8_t *m_data;
+    size_t m_dataSize;
+    bool m_mapped;
+    int m_width;
+    int m_height;
+    int m_frameCount;
+    uint64_t m_indexOffset;
+    bool m_realtime;
+    bool m_loop;
+    int m_next;
+    uint64_t m_passDurationUsec; // Time from the first frame of one pass through the sequence to that of the next.
+    uint64_t m_loopOffsetUsec; // Added to the timestamps of each pass through the sequence after the first.
+    uint64_t m_playStartUsec; // For realtime pacing: wall clock time at which the current pass started, or 0 if not yet started.
+    std::vector<uint8_t> m_buff; // Decompressed frame.
+    AR2VideoBufferT m_videoBuffer;
+};
@@ -0,0 +1,163 @@
+/*
+ *  LatencyStats.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "LatencyStats.hpp"
+#include <atomic>
+#include <algorithm>
+
+#define LATENCY_STATS_OCTAVE_MIN 8 // Times below 2^8 ns fall in the first bucket.
+#define LATENCY_STATS_SUBBUCKET_BITS 2 // Four buckets per octave.
+#define LATENCY_STATS_BUCKET_COUNT 128 // Up to about 2^40 ns (18 minutes). Longer times fall in the last bucket.
+
+// One thread's histograms. Only the owning thread writes, so updates are plain loads and stores (no read-modify-write),
+// and atomic only so that summaries can read them safely. Blocks are never freed, as a summary may be reading one
+// after its thread has exited. There is one per thread that has ever recorded, so this is bounded in practice.
+struct LatencyStatsThread {
+    std::atomic<uint64_t> counts[LATENCY_STAGE_COUNT][LATENCY_STATS_BUCKET_COUNT];
+    std::atomic<uint64_t> sumNs[LATENCY_STAGE_COUNT];
+    std::atomic<uint64_t> maxNs[LATENCY_STAGE_COUNT];
+    LatencyStatsThread *next;
+};
+
+static std::atomic<LatencyStatsThread *> gLatencyStatsThreads(nullptr); // Lock-free list of all threads' histograms.
+static thread_local LatencyStatsThread *tLatencyStatsThread = nullptr;
+
+static const char *kStageNames[LATENCY_STAGE_COUNT] = {
+    "frame",
+    "detect",
+    "publish",
+    "draw_upload",
+    "draw_overlay",
+    "calc"
+};
+
+static LatencyStatsThread *latencyStatsThreadGet(void)
+{
+    if (!tLatencyStatsThread) {
+        LatencyStatsThread *t = new LatencyStatsThread;
+        for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+            for (int b = 0; b < LATENCY_STATS_BUCKET_COUNT; b++) t->counts[s][b].store(0, std::memory_order_relaxed);
+            t->sumNs[s].store(0, std::memory_order_relaxed);
+            t->maxNs[s].store(0, std::memory_order_relaxed);
+        }
+        // Push onto the list.
+        t->next = gLatencyStatsThreads.load(std::memory_order_relaxed);
+        while (!gLatencyStatsThreads.compare_exchange_weak(t->next, t, std::memory_order_release, std::memory_order_relaxed));
+        tLatencyStatsThread = t;
+    }
+    return tLatencyStatsThread;
+}
+
+static inline int latencyStatsBucket(const uint64_t ns)
+{
+    if (ns < (1ull << LATENCY_STATS_OCTAVE_MIN)) return 0;
+#if defined(__GNUC__) || defined(__clang__)
+    const int octave = 63 - __builtin_clzll(ns);
+#else
+    int octave = 0;
+    for (uint64_t v = ns; v >>= 1; ) octave++;
+#endif
+    const int sub = (int)(ns >> (octave - LATENCY_STATS_SUBBUCKET_BITS)) & ((1 << LATENCY_STATS_SUBBUCKET_BITS) - 1);
+    return std::min(((octave - LATENCY_STATS_OCTAVE_MIN) << LATENCY_STATS_SUBBUCKET_BITS) + sub, LATENCY_STATS_BUCKET_COUNT - 1);
+}
+
+// The middle of a bucket's range, in ns.
+static double latencyStatsBucketValue(const int bucket)
+{
+    if (bucket == 0) return (double)(1ull << (LATENCY_STATS_OCTAVE_MIN - 1));
+    const int octave = (bucket >> LATENCY_STATS_SUBBUCKET_BITS) + LATENCY_STATS_OCTAVE_MIN;
+    const int sub = bucket & ((1 << LATENCY_STATS_SUBBUCKET_BITS) - 1);
+    return ((double)(1ull << octave) * (1.0 + ((double)sub + 0.5) / (double)(1 << LATENCY_STATS_SUBBUCKET_BITS)));
+}
+
+void latencyStatsRecord(const LATENCY_STAGE stage, const LatencyStatsTime& start)
+{
+    const int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(latencyStatsNow() - start).count();
+    const uint64_t ns = (elapsed > 0 ? (uint64_t)elapsed : 0);
+    LatencyStatsThread *t = latencyStatsThreadGet();
+    std::atomic<uint64_t>& count = t->counts[stage][latencyStatsBucket(ns)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    t->sumNs[stage].store(t->sumNs[stage].load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > t->maxNs[stage].load(std::memory_order_relaxed)) t->maxNs[stage].store(ns, std::memory_order_relaxed);
+}
+
+const char *latencyStatsStageName(const LATENCY_STAGE stage)
+{
+    if (stage < 0 || stage >= LATENCY_STAGE_COUNT) return "unknown";
+    return kStageNames[stage];
+}
+
+void latencyStatsSummarise(const LATENCY_STAGE stage, LatencyStatsSummary *summary)
+{
+    uint64_t counts[LATENCY_STATS_BUCKET_COUNT] = {0};
+    uint64_t count = 0, sumNs = 0, maxNs = 0;
+    for (LatencyStatsThread *t = gLatencyStatsThreads.load(std::memory_order_acquire); t; t = t->next) {
+        for (int b = 0; b < LATENCY_STATS_BUCKET_COUNT; b++) {
+            const uint64_t c = t->counts[stage][b].load(std::memory_order_relaxed);
+            counts[b] += c;
+            count += c;
+        }
+        sumNs += t->sumNs[stage].load(std::memory_order_relaxed);
+        maxNs = std::max(maxNs, t->maxNs[stage].load(std::memory_order_relaxed));
+    }
+
+    summary->count = count;
+    summary->meanMs = (count ? (double)sumNs / (double)count * 1.0e-6 : 0.0);
+    summary->maxMs = (double)maxNs * 1.0e-6;
+    const double ps[3] = {0.5, 0.9, 0.99};
+    double *out[3] = {&summary->p50Ms, &summary->p90Ms, &summary->p99Ms};
+    for (int i = 0; i < 3; i++) {
+        *out[i] = 0.0;
+        if (!count) continue;
+        const uint64_t rank = (uint64_t)(ps[i] * (double)(count - 1)) + 1;
+        uint64_t cumulative = 0;
+        for (int b = 0; b < LATENCY_STATS_BUCKET_COUNT; b++) {
+            cumulative += counts[b];
+            if (cumulative >= rank) {
+                *out[i] = std::min(latencyStatsBucketValue(b) * 1.0e-6, summary->maxMs);
+                break;
+            }
+        }
+    }
+}
+
+bool latencyStatsWrite(FILE *fp, const bool json)
+{
+    if (!fp) return false;
+    if (json) fprintf(fp, "{\n  \"latency_ms\": {\n");
+    else fprintf(fp, "%-14s %10s %10s %10s %10s %10s %10s\n", "stage", "count", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        LatencyStatsSummary summary;
+        latencyStatsSummarise((LATENCY_STAGE)s, &summary);
+        if (json) {
+            fprintf(fp, "    \"%s\": {\"count\": %llu, \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n", kStageNames[s],
+                    (unsigned long long)summary.count, summary.meanMs, summary.p50Ms, summary.p90Ms, summary.p99Ms, summary.maxMs, (s + 1 < LATENCY_STAGE_COUNT ? "," : ""));
+        } else {
+            fprintf(fp, "%-14s %10llu %10.3f %10.3f %10.3f %10.3f %10.3f\n", kStageNames[s],
+                    (unsigned long long)summary.count, summary.meanMs, summary.p50Ms, summary.p90Ms, summary.p99Ms, summary.maxMs);
+        }
+    }
+    if (json) fprintf(fp, "  }\n}\n");
+    return (ferror(fp) == 0);
+}
@@ -0,0 +1,80 @@
+/*
+ *  LatencyStats.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+// Always-on timing of the stages of the calibration pipeline. Each thread records into its own histograms,
+// so recording takes no locks and shares no cache lines with other threads. Histogram buckets are spaced
+// logarithmically, four to each doubling of time, from 256 ns upwards. Summaries may be taken at any time
+// from any thread; they merge the histograms of all threads.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+
+typedef enum {
+    LATENCY_STAGE_FRAME = 0,    // Checkout and copy of a new frame in Calibration::frame().
+    LATENCY_STAGE_DETECT,       // Tracking or detection, and refinement, on a corner finder worker.
+    LATENCY_STAGE_PUBLISH,      // Publication of corner finder results.
+    LATENCY_STAGE_DRAW_UPLOAD,  // Upload and drawing of the video frame texture in drawView().
+    LATENCY_STAGE_DRAW_OVERLAY, // Drawing of everything on top of the video frame in drawView().
+    LATENCY_STAGE_CALC,         // calc().
+    LATENCY_STAGE_COUNT
+} LATENCY_STAGE;
+
+typedef struct {
+    uint64_t count;
+    double meanMs;
+    double p50Ms;
+    double p90Ms;
+    double p99Ms;
+    double maxMs;
+} LatencyStatsSummary;
+
+typedef std::chrono::steady_clock::time_point LatencyStatsTime;
+
+inline LatencyStatsTime latencyStatsNow(void) {return std::chrono::steady_clock::now(); }
+
+// Record the time since start against stage, for the calling thread.
+void latencyStatsRecord(const LATENCY_STAGE stage, const LatencyStatsTime& start);
+
+const char *latencyStatsStageName(const LATENCY_STAGE stage);
+
+void latencyStatsSummarise(const LATENCY_STAGE stage, LatencyStatsSummary *summary);
+
+// Write a summary of every stage to fp, as text (one line per stage) or as JSON.
+bool latencyStatsWrite(FILE *fp, const bool json);
+
+// Records the time from construction to destruction against a stage.
+class LatencyStatsScope
+{
+public:
+    explicit LatencyStatsScope(const LATENCY_STAGE stage) : m_stage(stage), m_start(latencyStatsNow()) {}
+    ~LatencyStatsScope() {latencyStatsRecord(m_stage, m_start); }
+private:
+    LatencyStatsScope(const LatencyStatsScope&) = delete; // No copy construction.
+    LatencyStatsScope& operator=(const LatencyStatsScope&) = delete; // No copy assignment.
+    LATENCY_STAGE m_stage;
+    LatencyStatsTime m_start;
+};
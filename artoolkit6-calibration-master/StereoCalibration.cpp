@@ -0,0 +1,122 @@
+/*
+ *  StereoCalibration.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "StereoCalibration.hpp"
+#include <math.h>
+#include "calc.hpp"
+
+#define STEREO_PAIR_TIME_DELTA_MAX_DEFAULT 0.020 // Seconds. Just over half a frame at 30 fps, so unsynchronised cameras at that rate can always pair.
+
+static inline double timestampDelta(const AR2VideoTimestampT& a, const AR2VideoTimestampT& b)
+{
+    return ((double)((int64_t)a.sec - (int64_t)b.sec) + ((double)a.usec - (double)b.usec)*1.0e-6);
+}
+
+StereoCalibration::StereoCalibration(const Calibration::CalibrationPatternType patternType, const int calibImageCountMax, const cv::Size patternSize, const int chessboardSquareWidth, const int videoWidthL, const int videoHeightL, const int videoWidthR, const int videoHeightR, const int cornerFinderWorkerCount) :
+    m_left(NULL),
+    m_right(NULL),
+    m_pairTimeDeltaMax(STEREO_PAIR_TIME_DELTA_MAX_DEFAULT),
+    m_pairRejectedCount(0),
+    m_patternType(patternType),
+    m_patternSize(patternSize),
+    m_chessboardSquareWidth(chessboardSquareWidth),
+    m_videoWidthL(videoWidthL),
+    m_videoHeightL(videoHeightL),
+    m_videoWidthR(videoWidthR),
+    m_videoHeightR(videoHeightR),
+    m_cornersL(),
+    m_cornersR()
+{
+    int workerCount = cornerFinderWorkerCount;
+    if (workerCount <= 0) {
+        workerCount = (threadGetCPU() - 1) / 2;
+        if (workerCount < 1) workerCount = 1;
+    }
+    m_left = new Calibration(patternType, calibImageCountMax, patternSize, chessboardSquareWidth, videoWidthL, videoHeightL, workerCount);
+    m_right = new Calibration(patternType, calibImageCountMax, patternSize, chessboardSquareWidth, videoWidthR, videoHeightR, workerCount);
+    m_cornersL.reserve(patternSize.area());
+    m_cornersR.reserve(patternSize.area());
+}
+
+StereoCalibration::~StereoCalibration()
+{
+    delete m_left;
+    delete m_right;
+}
+
+bool StereoCalibration::capture(const bool automatic)
+{
+    if (m_left->calibImageCount() >= m_left->calibImageCountMax()) return false;
+    
+    // The pattern must be in view of both cameras now.
+    AR2VideoTimestampT timestampL, timestampR;
+    if (!m_left->detectionLatest(&timestampL, m_cornersL) || !m_right->detectionLatest(&timestampR, m_cornersR)) return false;
+    
+    // The stream whose latest detection is newer may also have one from nearer the time of the other's.
+    double delta = timestampDelta(timestampR, timestampL);
+    if (delta > 0.0) m_right->detectionNearest(timestampL, &timestampR, m_cornersR);
+    else if (delta < 0.0) m_left->detectionNearest(timestampR, &timestampL, m_cornersL);
+    delta = fabs(timestampDelta(timestampR, timestampL));
+    if (delta > m_pairTimeDeltaMax) {
+        m_pairRejectedCount++;
+        ARLOGw("Not capturing: left and right frames are %.1f ms apart.\n", delta*1000.0);
+        return false;
+    }
+    
+    // Both views or neither.
+    if (!m_left->captureCorners(m_cornersL, automatic)) return false;
+    if (!m_right->captureCorners(m_cornersR, automatic)) {
+        m_left->uncapture();
+        return false;
+    }
+    ARLOGi("Captured stereo pair %d/%d, frames %.1f ms apart.\n", m_left->calibImageCount(), m_left->calibImageCountMax(), delta*1000.0);
+    return true;
+}
+
+bool StereoCalibration::uncapture()
+{
+    bool ok = m_left->uncapture();
+    return (m_right->uncapture() && ok);
+}
+
+bool StereoCalibration::uncaptureAll()
+{
+    bool ok = m_left->uncaptureAll();
+    return (m_right->uncaptureAll() && ok);
+}
+
+bool StereoCalibration::calib(ARParam *paramL_out, ARParam *paramR_out, ARdouble transL2R_out[3][4], ARdouble *errL_out, ARdouble *errR_out, ARdouble *errStereo_out)
+{
+    CornerSet cornerSetL, cornerSetR;
+    m_left->capturedCorners(cornerSetL);
+    m_right->capturedCorners(cornerSetR);
+    
+    // Start from the background solvers' latest estimates, so that each camera's solve need only refine its own.
+    Calibration::IntrinsicsEstimate estimateL, estimateR;
+    m_left->solverEstimate(&estimateL);
+    m_right->solverEstimate(&estimateR);
+    
+    return calcStereo(m_patternType, m_patternSize, m_chessboardSquareWidth, cornerSetL, m_videoWidthL, m_videoHeightL, cornerSetR, m_videoWidthR, m_videoHeightR,
+                      paramL_out, paramR_out, transL2R_out, errL_out, errR_out, errStereo_out, &estimateL, &estimateR);
+}
@@ -0,0 +1,91 @@
+/*
+ *  StereoCalibration.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+// Calibration of a stereo pair of cameras: the intrinsics of each, and the transform from the left camera to the
+// right, in the form arwStartRunningStereoB() takes. Each camera's stream has its own Calibration, with its own
+// corner finder workers, so both are searched at once. A capture pairs a detection in one stream with the detection
+// in the other whose frame was captured nearest in time, and saves both only if they are close enough to be of the
+// same pose of the pattern. The two streams' timestamps must be from the same clock.
+
+#pragma once
+
+#include <AR6/AR/ar.h>
+#include <opencv2/core/core.hpp>
+#include "Calibration.hpp"
+
+class StereoCalibration
+{
+public:
+    // cornerFinderWorkerCount is the number of corner finder threads for each camera. Pass 0 to share the available
+    // CPU cores, less one for the thread calling frame(), between the two.
+    StereoCalibration(const Calibration::CalibrationPatternType patternType, const int calibImageCountMax, const cv::Size patternSize, const int chessboardSquareWidth, const int videoWidthL, const int videoHeightL, const int videoWidthR, const int videoHeightR, const int cornerFinderWorkerCount = 0);
+    ~StereoCalibration();
+    
+    Calibration& left() {return *m_left; }
+    Calibration& right() {return *m_right; }
+    
+    // Process the next frame from each camera's video source. Neither call waits for corner finding.
+    template <class FrameSource> bool frame(FrameSource *vsL, FrameSource *vsR)
+    {
+        bool ok = m_left->frame(vsL);
+        return (m_right->frame(vsR) && ok);
+    }
+    
+    // Largest difference in capture time between the frames of a pair, in seconds.
+    void setPairTimeDeltaMax(const double seconds) {m_pairTimeDeltaMax = seconds; }
+    double pairTimeDeltaMax() const {return m_pairTimeDeltaMax; }
+    unsigned long pairRejectedCount() const {return m_pairRejectedCount; } // Captures refused because no detections were close enough in time.
+    
+    int calibImageCount() const {return m_left->calibImageCount(); }
+    int calibImageCountMax() const {return m_left->calibImageCountMax(); }
+    void setAutoCaptureEnabled(const bool enabled) {m_left->setAutoCaptureEnabled(enabled); m_right->setAutoCaptureEnabled(enabled); }
+    bool autoCaptureEnabled() const {return m_left->autoCaptureEnabled(); }
+    bool autoCaptureReady() const {return (m_left->autoCaptureReady() && m_right->autoCaptureReady()); } // Call from the same thread as frame().
+    // Save a pair of views. If automatic is true, only do so if both are ready for automatic capture.
+    bool capture(const bool automatic = false);
+    bool uncapture();
+    bool uncaptureAll();
+    bool solverConverged() {return (m_left->solverConverged() && m_right->solverConverged()); }
+    
+    // Calibrate both cameras and the transform between them, from the pairs of views captured. See calcStereo().
+    bool calib(ARParam *paramL_out, ARParam *paramR_out, ARdouble transL2R_out[3][4], ARdouble *errL_out, ARdouble *errR_out, ARdouble *errStereo_out);
+    
+private:
+    StereoCalibration(const StereoCalibration&) = delete; // No copy construction.
+    StereoCalibration& operator=(const StereoCalibration&) = delete; // No copy assignment.
+    
+    Calibration *m_left;
+    Calibration *m_right;
+    double m_pairTimeDeltaMax;
+    unsigned long m_pairRejectedCount;
+    Calibration::CalibrationPatternType m_patternType;
+    cv::Size m_patternSize;
+    int m_chessboardSquareWidth;
+    int m_videoWidthL;
+    int m_videoHeightL;
+    int m_videoWidthR;
+    int m_videoHeightR;
+    std::vector<cv::Point2f> m_cornersL; // Scratch space for capture().
+    std::vector<cv::Point2f> m_cornersR;
+};
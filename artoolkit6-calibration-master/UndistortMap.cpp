@@ -0,0 +1,404 @@
+/*
+ *  UndistortMap.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "UndistortMap.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define UNDISTORT_MAP_SSE2 1
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#  define UNDISTORT_MAP_NEON 1
+#  include <arm_neon.h>
+#endif
+
+#define UNDISTORT_MAP_MAGIC "AR6UMAP"
+#define UNDISTORT_MAP_VERSION 1
+#define UNDISTORT_MAP_FLAG_INVERSE 0x1
+#define UNDISTORT_MAP_FRAC_BITS_MIN 2
+#define UNDISTORT_MAP_FRAC_BITS_MAX 6 // Keeps the intermediate sums of the bilinear blend within 16 bits.
+#define UNDISTORT_MAP_PLANE_ALIGN 64
+#define UNDISTORT_MAP_DIST_FACTOR_COUNT 17
+#define UNDISTORT_MAP_BLOCK 8 // Pixels blended per SIMD step.
+
+struct UndistortMapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t flags;
+    uint32_t fracBits;
+    int32_t distFunctionVersion;
+    double distFactor[UNDISTORT_MAP_DIST_FACTOR_COUNT];
+    uint8_t reserved[256 - 32 - 8*UNDISTORT_MAP_DIST_FACTOR_COUNT];
+};
+
+static_assert(sizeof(UndistortMapHeader) == 256, "UndistortMapHeader must be 256 bytes");
+
+static size_t planeBytes(const int width, const int height)
+{
+    const size_t bytes = (size_t)width*(size_t)height*sizeof(int16_t);
+    return ((bytes + UNDISTORT_MAP_PLANE_ALIGN - 1) / UNDISTORT_MAP_PLANE_ALIGN * UNDISTORT_MAP_PLANE_ALIGN);
+}
+
+static inline int16_t toFixed(const double v, const int fracBits)
+{
+    const double f = floor(v*(double)(1 << fracBits) + 0.5);
+    return (int16_t)(f > 32767.0 ? 32767 : (f < -32768.0 ? -32768 : f));
+}
+
+UndistortMap::UndistortMap() :
+    m_width(0),
+    m_height(0),
+    m_fracBits(0),
+    m_distFunctionVersion(0),
+    m_planes(),
+    m_data(NULL),
+    m_dataSize(0),
+    m_mapped(false),
+    m_mapX(NULL),
+    m_mapY(NULL),
+    m_invX(NULL),
+    m_invY(NULL)
+{
+    memset(m_distFactor, 0, sizeof(m_distFactor));
+}
+
+UndistortMap::~UndistortMap()
+{
+    close();
+}
+
+bool UndistortMap::create(const ARParam *param, const bool inverse)
+{
+    close();
+    if (!param || param->xsize <= 0 || param->ysize <= 0) return false;
+    const int w = param->xsize;
+    const int h = param->ysize;
+
+    // Offsets are largest at the edges of the image, so the perimeter determines how many fractional bits fit.
+    double offsetMax = 0.0;
+    for (int pass = 0; pass < (inverse ? 2 : 1); pass++) {
+        for (int k = 0; k < 2*(w + h); k++) {
+            const int x = (k < w ? k : (k < 2*w ? k - w : (k < 2*w + h ? 0 : w - 1)));
+            const int y = (k < w ? 0 : (k < 2*w ? h - 1 : (k < 2*w + h ? k - 2*w : k - 2*w - h)));
+            ARdouble mx, my;
+            if (pass == 0) arParamIdeal2Observ(param->dist_factor, (ARdouble)x, (ARdouble)y, &mx, &my, param->dist_function_version);
+            else arParamObserv2Ideal(param->dist_factor, (ARdouble)x, (ARdouble)y, &mx, &my, param->dist_function_version);
+            offsetMax = std::max(offsetMax, std::max(fabs(mx - x), fabs(my - y)));
+        }
+    }
+    int fracBits = UNDISTORT_MAP_FRAC_BITS_MAX;
+    while (fracBits > UNDISTORT_MAP_FRAC_BITS_MIN && offsetMax*1.1*(double)(1 << fracBits) > 32767.0) fracBits--;
+    if (offsetMax*(double)(1 << fracBits) > 32767.0) {
+        ARLOGe("Error: distortion of up to %.0f pixels is too large for an undistortion map.\n", offsetMax);
+        return false;
+    }
+
+    const size_t planeLen = planeBytes(w, h) / sizeof(int16_t);
+    m_planes.assign(planeLen*(inverse ? 4 : 2), 0);
+    int16_t *planes = m_planes.data();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            ARdouble ox, oy;
+            arParamIdeal2Observ(param->dist_factor, (ARdouble)x, (ARdouble)y, &ox, &oy, param->dist_function_version);
+            planes[y*w + x] = toFixed(ox - x, fracBits);
+            planes[planeLen + y*w + x] = toFixed(oy - y, fracBits);
+        }
+    }
+    if (inverse) {
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                ARdouble ix, iy;
+                arParamObserv2Ideal(param->dist_factor, (ARdouble)x, (ARdouble)y, &ix, &iy, param->dist_function_version);
+                planes[2*planeLen + y*w + x] = toFixed(ix - x, fracBits);
+                planes[3*planeLen + y*w + x] = toFixed(iy - y, fracBits);
+            }
+        }
+    }
+
+    m_width = w;
+    m_height = h;
+    m_fracBits = fracBits;
+    m_distFunctionVersion = param->dist_function_version;
+    memcpy(m_distFactor, param->dist_factor, sizeof(m_distFactor));
+    m_mapX = planes;
+    m_mapY = planes + planeLen;
+    m_invX = (inverse ? planes + 2*planeLen : NULL);
+    m_invY = (inverse ? planes + 3*planeLen : NULL);
+    return true;
+}
+
+bool UndistortMap::save(const char *path) const
+{
+    if (!isValid() || !path) return false;
+
+    UndistortMapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, UNDISTORT_MAP_MAGIC, sizeof(UNDISTORT_MAP_MAGIC));
+    header.version = UNDISTORT_MAP_VERSION;
+    header.width = (uint32_t)m_width;
+    header.height = (uint32_t)m_height;
+    header.flags = (hasInverse() ? UNDISTORT_MAP_FLAG_INVERSE : 0);
+    header.fracBits = (uint32_t)m_fracBits;
+    header.distFunctionVersion = m_distFunctionVersion;
+    for (int i = 0; i < UNDISTORT_MAP_DIST_FACTOR_COUNT && i < AR_DIST_FACTOR_NUM_MAX; i++) header.distFactor[i] = (double)m_distFactor[i];
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        ARLOGe("Error opening undistortion map file '%s' for writing.\n", path);
+        ARLOGperror(NULL);
+        return false;
+    }
+    const size_t planeSize = (size_t)m_width*(size_t)m_height*sizeof(int16_t);
+    const size_t padSize = planeBytes(m_width, m_height) - planeSize;
+    static const uint8_t pad[UNDISTORT_MAP_PLANE_ALIGN] = {0};
+    const int16_t *planes[4] = {m_mapX, m_mapY, m_invX, m_invY};
+    bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+    for (int i = 0; i < (hasInverse() ? 4 : 2) && ok; i++) {
+        ok = (fwrite(planes[i], planeSize, 1, fp) == 1) && (padSize == 0 || fwrite(pad, padSize, 1, fp) == 1);
+    }
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) {
+        ARLOGe("Error writing undistortion map file '%s'.\n", path);
+        remove(path);
+    }
+    return ok;
+}
+
+bool UndistortMap::load(const char *path)
+{
+    close();
+    if (!path) return false;
+
+#ifdef _WIN32
+    // No mapping; read the whole file.
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        ARLOGe("Error opening undistortion map file '%s'.\n", path);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = (size > 0 ? (uint8_t *)malloc((size_t)size) : NULL);
+    if (!data || fread(data, (size_t)size, 1, fp) != 1) {
+        ARLOGe("Error reading undistortion map file '%s'.\n", path);
+        free(data);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    m_data = data;
+    m_dataSize = (size_t)size;
+    m_mapped = false;
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) {
+        ARLOGe("Error opening undistortion map file '%s'.\n", path);
+        ARLOGperror(NULL);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ARLOGe("Error reading undistortion map file '%s'.\n", path);
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping remains valid.
+    if (map == MAP_FAILED) {
+        ARLOGe("Error mapping undistortion map file '%s'.\n", path);
+        ARLOGperror(NULL);
+        return false;
+    }
+    m_data = (const uint8_t *)map;
+    m_dataSize = (size_t)st.st_size;
+    m_mapped = true;
+#endif
+
+    // Validate.
+    UndistortMapHeader header;
+    bool ok = (m_dataSize >= sizeof(header));
+    if (ok) {
+        memcpy(&header, m_data, sizeof(header));
+        ok = (memcmp(header.magic, UNDISTORT_MAP_MAGIC, sizeof(UNDISTORT_MAP_MAGIC)) == 0 && header.version == UNDISTORT_MAP_VERSION
+              && header.width > 0 && header.height > 0 && header.width <= 32768 && header.height <= 32768
+              && header.fracBits >= UNDISTORT_MAP_FRAC_BITS_MIN && header.fracBits <= UNDISTORT_MAP_FRAC_BITS_MAX
+              && m_dataSize >= sizeof(header) + planeBytes((int)header.width, (int)header.height)*((header.flags & UNDISTORT_MAP_FLAG_INVERSE) ? 4 : 2));
+    }
+    if (!ok) {
+        ARLOGe("Error: '%s' is not a valid undistortion map file.\n", path);
+        close();
+        return false;
+    }
+
+    m_width = (int)header.width;
+    m_height = (int)header.height;
+    m_fracBits = (int)header.fracBits;
+    m_distFunctionVersion = header.distFunctionVersion;
+    for (int i = 0; i < UNDISTORT_MAP_DIST_FACTOR_COUNT && i < AR_DIST_FACTOR_NUM_MAX; i++) m_distFactor[i] = (ARdouble)header.distFactor[i];
+    const size_t planeLen = planeBytes(m_width, m_height) / sizeof(int16_t);
+    const int16_t *planes = (const int16_t *)(m_data + sizeof(header));
+    m_mapX = planes;
+    m_mapY = planes + planeLen;
+    if (header.flags & UNDISTORT_MAP_FLAG_INVERSE) {
+        m_invX = planes + 2*planeLen;
+        m_invY = planes + 3*planeLen;
+    }
+    return true;
+}
+
+void UndistortMap::close()
+{
+    if (m_data) {
+#ifdef _WIN32
+        free((void *)m_data);
+#else
+        if (m_mapped) munmap((void *)m_data, m_dataSize);
+#endif
+    }
+    m_data = NULL;
+    m_dataSize = 0;
+    m_mapped = false;
+    m_planes.clear();
+    m_width = m_height = m_fracBits = 0;
+    m_mapX = m_mapY = m_invX = m_invY = NULL;
+}
+
+void UndistortMap::remap(const uint8_t *src, const int srcStride, uint8_t *dst, const int dstStride, const int rowBegin, int rowEnd) const
+{
+    if (!isValid() || !src || !dst) return;
+    if (rowEnd < 0 || rowEnd > m_height) rowEnd = m_height;
+
+    const int F = m_fracBits;
+    const int one = 1 << F;
+    const int xMax = (m_width - 1) << F;
+    const int yMax = (m_height - 1) << F;
+
+    // For each block of pixels, the four neighbours and fractional weights are gathered with scalar loads
+    // (there is no byte gather in SSE2 or NEON), and the bilinear blend is then done for the whole block at once.
+    int16_t p00[UNDISTORT_MAP_BLOCK], p01[UNDISTORT_MAP_BLOCK], p10[UNDISTORT_MAP_BLOCK], p11[UNDISTORT_MAP_BLOCK];
+    int16_t wx[UNDISTORT_MAP_BLOCK], wy[UNDISTORT_MAP_BLOCK];
+
+    for (int y = rowBegin; y < rowEnd; y++) {
+        const int16_t *mx = m_mapX + y*m_width;
+        const int16_t *my = m_mapY + y*m_width;
+        uint8_t *out = dst + y*dstStride;
+        int x = 0;
+        while (x < m_width) {
+            const int n = std::min(UNDISTORT_MAP_BLOCK, m_width - x);
+            for (int k = 0; k < n; k++) {
+                const int sx = std::min(std::max(((x + k) << F) + mx[x + k], 0), xMax);
+                const int sy = std::min(std::max((y << F) + my[x + k], 0), yMax);
+                const int ix = sx >> F, iy = sy >> F;
+                const uint8_t *r0 = src + iy*srcStride + ix;
+                const uint8_t *r1 = (sy < yMax ? r0 + srcStride : r0);
+                const int dx = (sx < xMax ? 1 : 0);
+                p00[k] = r0[0]; p01[k] = r0[dx];
+                p10[k] = r1[0]; p11[k] = r1[dx];
+                wx[k] = (int16_t)(sx & (one - 1));
+                wy[k] = (int16_t)(sy & (one - 1));
+            }
+            int k = 0;
+#if UNDISTORT_MAP_SSE2
+            if (n == UNDISTORT_MAP_BLOCK) {
+                const __m128i a = _mm_loadu_si128((const __m128i *)p00), b = _mm_loadu_si128((const __m128i *)p01);
+                const __m128i c = _mm_loadu_si128((const __m128i *)p10), d = _mm_loadu_si128((const __m128i *)p11);
+                const __m128i fx = _mm_loadu_si128((const __m128i *)wx), fy = _mm_loadu_si128((const __m128i *)wy);
+                const __m128i shift = _mm_cvtsi32_si128(F);
+                // Horizontal blends, scaled by 2^F. At most 255 * 2^6, so within 16 bits.
+                const __m128i top = _mm_add_epi16(_mm_sll_epi16(a, shift), _mm_mullo_epi16(_mm_sub_epi16(b, a), fx));
+                const __m128i bot = _mm_add_epi16(_mm_sll_epi16(c, shift), _mm_mullo_epi16(_mm_sub_epi16(d, c), fx));
+                // Vertical blend in 32 bits: top*(2^F - fy) + bot*fy, then rounded and scaled back down.
+                const __m128i wTop = _mm_sub_epi16(_mm_set1_epi16((short)one), fy);
+                const __m128i round = _mm_set1_epi32(1 << (2*F - 1));
+                const __m128i shift2 = _mm_cvtsi32_si128(2*F);
+                __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(top, bot), _mm_unpacklo_epi16(wTop, fy));
+                __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(top, bot), _mm_unpackhi_epi16(wTop, fy));
+                lo = _mm_sra_epi32(_mm_add_epi32(lo, round), shift2);
+                hi = _mm_sra_epi32(_mm_add_epi32(hi, round), shift2);
+                const __m128i v = _mm_packs_epi32(lo, hi);
+                _mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(v, v));
+                k = n;
+            }
+#elif UNDISTORT_MAP_NEON
+            if (n == UNDISTORT_MAP_BLOCK) {
+                const int16x8_t a = vld1q_s16(p00), b = vld1q_s16(p01), c = vld1q_s16(p10), d = vld1q_s16(p11);
+                const int16x8_t fx = vld1q_s16(wx), fy = vld1q_s16(wy);
+                const int16x8_t shift = vdupq_n_s16((int16_t)F);
+                // Horizontal blends, scaled by 2^F. At most 255 * 2^6, so within 16 bits.
+                const int16x8_t top = vmlaq_s16(vshlq_s16(a, shift), vsubq_s16(b, a), fx);
+                const int16x8_t bot = vmlaq_s16(vshlq_s16(c, shift), vsubq_s16(d, c), fx);
+                // Vertical blend in 32 bits: top*(2^F - fy) + bot*fy, then rounded and scaled back down.
+                const int16x8_t wTop = vsubq_s16(vdupq_n_s16((int16_t)one), fy);
+                int32x4_t lo = vmlal_s16(vmull_s16(vget_low_s16(top), vget_low_s16(wTop)), vget_low_s16(bot), vget_low_s16(fy));
+                int32x4_t hi = vmlal_s16(vmull_s16(vget_high_s16(top), vget_high_s16(wTop)), vget_high_s16(bot), vget_high_s16(fy));
+                const int32x4_t shift2 = vdupq_n_s32(-2*F); // Rounding shift right.
+                lo = vrshlq_s32(lo, shift2);
+                hi = vrshlq_s32(hi, shift2);
+                vst1_u8(out + x, vqmovun_s16(vcombine_s16(vmovn_s32(lo), vmovn_s32(hi))));
+                k = n;
+            }
+#endif
+            for (; k < n; k++) {
+                const int top = (p00[k] << F) + (p01[k] - p00[k])*wx[k];
+                const int bot = (p10[k] << F) + (p11[k] - p10[k])*wx[k];
+                out[x + k] = (uint8_t)((top*(one - wy[k]) + bot*wy[k] + (1 << (2*F - 1))) >> (2*F));
+            }
+            x += n;
+        }
+    }
+}
+
+bool UndistortMap::observToIdeal(const float ox, const float oy, float *ix, float *iy) const
+{
+    if (!hasInverse() || !ix || !iy) return false;
+    if (!(ox >= 0.0f && oy >= 0.0f && ox <= (float)(m_width - 1) && oy <= (float)(m_height - 1))) return false;
+
+    const int x0 = std::min((int)ox, m_width - 2 >= 0 ? m_width - 2 : 0);
+    const int y0 = std::min((int)oy, m_height - 2 >= 0 ? m_height - 2 : 0);
+    const int x1 = std::min(x0 + 1, m_width - 1);
+    const int y1 = std::min(y0 + 1, m_height - 1);
+    const float fx = ox - (float)x0, fy = oy - (float)y0;
+    const float scale = 1.0f / (float)(1 << m_fracBits);
+    const int i00 = y0*m_width + x0, i01 = y0*m_width + x1, i10 = y1*m_width + x0, i11 = y1*m_width + x1;
+    const float dx = ((1.0f - fy)*((1.0f - fx)*m_invX[i00] + fx*m_invX[i01]) + fy*((1.0f - fx)*m_invX[i10] + fx*m_invX[i11]))*scale;
+    const float dy = ((1.0f - fy)*((1.0f - fx)*m_invY[i00] + fx*m_invY[i01]) + fy*((1.0f - fx)*m_invY[i10] + fx*m_invY[i11]))*scale;
+    *ix = ox + dx;
+    *iy = oy + dy;
+    return true;
+}
@@ -0,0 +1,99 @@
+/*
+ *  UndistortMap.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+// A precomputed lookup table of the lens distortion of a calibrated camera, at the calibrated resolution, so that
+// images and points can be undistorted by table lookup rather than by evaluating the distortion model per pixel.
+//
+// The forward map gives, for each pixel of the ideal (undistorted) image, the offset to its position in the observed
+// image, as produced by arParamIdeal2Observ(). The optional inverse map gives, for each pixel of the observed image,
+// the offset to its ideal position, as produced by the iterative arParamObserv2Ideal(). Offsets are signed 16-bit
+// fixed-point, with the number of fractional bits chosen to fit the largest offset.
+//
+// File layout (all fields little-endian):
+//   header: "AR6UMAP\0", uint32 version, uint32 width, uint32 height, uint32 flags, uint32 fracBits,
+//           int32 distFunctionVersion, double distFactor[17] (of which the distortion function
+//           uses its first few), padded to 256 bytes.
+//   planes: forward x, forward y, then if present inverse x, inverse y. Each is width*height int16 offsets in
+//           row-major order, starting on a 64-byte boundary.
+// The file can be memory-mapped and the planes used in place.
+
+#pragma once
+
+#include <AR6/AR/ar.h>
+#include <stdint.h>
+#include <vector>
+
+#define UNDISTORT_MAP_EXTENSION "umap"
+
+class UndistortMap
+{
+public:
+    UndistortMap();
+    ~UndistortMap(); // Calls close().
+
+    // Compute the map for param, at its xsize x ysize. If inverse is true, the inverse map is computed too.
+    bool create(const ARParam *param, const bool inverse);
+    bool save(const char *path) const;
+    // Memory-map a file written by save().
+    bool load(const char *path);
+    void close();
+
+    bool isValid() const {return (m_mapX != NULL); }
+    int width() const {return m_width; }
+    int height() const {return m_height; }
+    int fracBits() const {return m_fracBits; }
+    bool hasInverse() const {return (m_invX != NULL); }
+    // The raw offset planes, width*height each. The inverse planes are NULL if absent.
+    const int16_t *mapX() const {return m_mapX; }
+    const int16_t *mapY() const {return m_mapY; }
+    const int16_t *inverseMapX() const {return m_invX; }
+    const int16_t *inverseMapY() const {return m_invY; }
+
+    // Undistort rows [rowBegin, rowEnd) of a width x height luma image by bilinear interpolation through the forward
+    // map. Positions beyond the edge of the observed image take the nearest edge pixel. src and dst must not overlap.
+    // Rows are independent, so may be split across threads. rowEnd of -1 means the last row.
+    void remap(const uint8_t *src, const int srcStride, uint8_t *dst, const int dstStride, const int rowBegin = 0, int rowEnd = -1) const;
+
+    // Ideal position of an observed point, interpolated from the inverse map.
+    // Returns false if there is no inverse map or the point is outside the image.
+    bool observToIdeal(const float ox, const float oy, float *ix, float *iy) const;
+
+private:
+    UndistortMap(const UndistortMap&) = delete; // No copy construction.
+    UndistortMap& operator=(const UndistortMap&) = delete; // No copy assignment.
+
+    int m_width;
+    int m_height;
+    int m_fracBits;
+    int m_distFunctionVersion;
+    ARdouble m_distFactor[AR_DIST_FACTOR_NUM_MAX];
+    std::vector<int16_t> m_planes; // Storage when created rather than loaded.
+    const uint8_t *m_data; // Mapping when loaded.
+    size_t m_dataSize;
+    bool m_mapped;
+    const int16_t *m_mapX;
+    const int16_t *m_mapY;
+    const int16_t *m_invX;
+    const int16_t *m_invY;
+};
@@ -0,0 +1,137 @@
+/*
+ *  UndistortPreview.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "UndistortPreview.hpp"
+#include <string.h>
+#include <utility>
+
+UndistortPreview::UndistortPreview() :
+    m_map(),
+    m_thread(NULL),
+    m_back(0),
+    m_middle(1),
+    m_front(2),
+    m_middleFresh(false),
+    m_frontValid(false),
+    m_submittedCount(0),
+    m_droppedCount(0)
+{
+    pthread_mutex_init(&m_lock, NULL);
+}
+
+UndistortPreview::~UndistortPreview()
+{
+    stop();
+    pthread_mutex_destroy(&m_lock);
+}
+
+bool UndistortPreview::start(const ARParam *param)
+{
+    stop();
+    if (!m_map.create(param, false)) {
+        ARLOGe("Error creating undistortion map for preview.\n");
+        return false;
+    }
+    const size_t size = (size_t)m_map.width()*(size_t)m_map.height();
+    for (int i = 0; i < 3; i++) {
+        m_slots[i].original.assign(size, 0);
+        m_slots[i].undistorted.assign(size, 0);
+    }
+    m_back = 0;
+    m_middle = 1;
+    m_front = 2;
+    m_middleFresh = m_frontValid = false;
+    m_submittedCount = m_droppedCount = 0;
+
+    m_thread = threadInit(0, (void *)this, worker);
+    if (!m_thread) {
+        ARLOGe("Error starting undistortion preview thread.\n");
+        m_map.close();
+        return false;
+    }
+    return true;
+}
+
+void UndistortPreview::stop()
+{
+    if (!m_thread) return;
+    threadWaitQuit(m_thread);
+    threadFree(&m_thread);
+    m_map.close();
+    for (int i = 0; i < 3; i++) {
+        std::vector<uint8_t>().swap(m_slots[i].original);
+        std::vector<uint8_t>().swap(m_slots[i].undistorted);
+    }
+}
+
+bool UndistortPreview::submit(const uint8_t *luma)
+{
+    if (!m_thread || !luma) return false;
+    // While the worker is busy, it owns the back slot.
+    if (threadGetBusyStatus(m_thread)) {
+        m_droppedCount++;
+        return false;
+    }
+    Slot& slot = m_slots[m_back];
+    memcpy(slot.original.data(), luma, slot.original.size());
+    m_submittedCount++;
+    threadStartSignal(m_thread);
+    return true;
+}
+
+// static
+void *UndistortPreview::worker(THREAD_HANDLE_T *threadHandle)
+{
+    UndistortPreview *preview = (UndistortPreview *)threadGetArg(threadHandle);
+
+    while (threadStartWait(threadHandle) == 0) {
+        Slot& slot = preview->m_slots[preview->m_back];
+        preview->m_map.remap(slot.original.data(), preview->m_map.width(), slot.undistorted.data(), preview->m_map.width());
+
+        // Publish.
+        pthread_mutex_lock(&preview->m_lock);
+        std::swap(preview->m_back, preview->m_middle);
+        preview->m_middleFresh = true;
+        pthread_mutex_unlock(&preview->m_lock);
+
+        threadEndSignal(threadHandle);
+    }
+    return (NULL);
+}
+
+bool UndistortPreview::acquire(const uint8_t **undistorted, const uint8_t **original)
+{
+    if (!m_thread) return false;
+    pthread_mutex_lock(&m_lock);
+    if (m_middleFresh) {
+        std::swap(m_front, m_middle);
+        m_middleFresh = false;
+        m_frontValid = true;
+    }
+    pthread_mutex_unlock(&m_lock);
+    if (!m_frontValid) return false;
+    if (undistorted) *undistorted = m_slots[m_front].undistorted.data();
+    if (original) *original = m_slots[m_front].original.data();
+    return true;
+}
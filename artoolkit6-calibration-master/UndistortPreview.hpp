@@ -0,0 +1,86 @@
+/*
+ *  UndistortPreview.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+// Live undistortion of a luma stream through a new calibration, so that the result can be checked (e.g. that
+// straight lines are straight) before it is accepted. Frames are undistorted on a worker thread through an
+// UndistortMap. A frame offered while the worker is still busy with the previous one is dropped, so the caller
+// never waits.
+
+#pragma once
+
+#include <AR6/AR/ar.h>
+#include <AR6/ARUtil/thread_sub.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+#include "UndistortMap.hpp"
+
+class UndistortPreview
+{
+public:
+    UndistortPreview();
+    ~UndistortPreview(); // Calls stop().
+
+    // Build the remap table for param (at its xsize x ysize) and start the worker.
+    bool start(const ARParam *param);
+    void stop();
+    bool isRunning() const {return (m_thread != NULL); }
+    int width() const {return m_map.width(); }
+    int height() const {return m_map.height(); }
+
+    // Offer a width x height luma frame. Returns false if it was dropped because the worker was busy.
+    bool submit(const uint8_t *luma);
+    // Get the latest undistorted frame, and the original frame it came from. Never blocks. The frames remain
+    // valid and unchanged until the next call to acquire(), which must always be made from the same thread.
+    // Returns false if no frame has been undistorted yet.
+    bool acquire(const uint8_t **undistorted, const uint8_t **original);
+
+    unsigned long submittedCount() const {return m_submittedCount; }
+    unsigned long droppedCount() const {return m_droppedCount; }
+
+private:
+    UndistortPreview(const UndistortPreview&) = delete; // No copy construction.
+    UndistortPreview& operator=(const UndistortPreview&) = delete; // No copy assignment.
+
+    static void *worker(THREAD_HANDLE_T *threadHandle);
+
+    struct Slot {
+        std::vector<uint8_t> original;
+        std::vector<uint8_t> undistorted;
+    };
+
+    UndistortMap m_map;
+    THREAD_HANDLE_T *m_thread;
+    // Triple buffer. The worker owns the back slot, the display owns the front slot, and the middle slot holds the
+    // newest completed frame. Slot indices are swapped under m_lock.
+    Slot m_slots[3];
+    int m_back;
+    int m_middle;
+    int m_front;
+    bool m_middleFresh; // The middle slot holds a frame not yet acquired.
+    bool m_frontValid;
+    pthread_mutex_t m_lock;
+    unsigned long m_submittedCount;
+    unsigned long m_droppedCount;
+};
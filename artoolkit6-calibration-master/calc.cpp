@@ -24,14 +24,33 @@
  */
 
 #include "calc.hpp"
+#include "LatencyStats.hpp"
+#include "BundleSolver.hpp"
 
 #include <opencv2/calib3d/calib3d.hpp>
-#include <opencv2/core/core_c.h>
+#include <opencv2/core/utility.hpp>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+
+#define CALC_ITERATIONS_MAX 30 // As cv::calibrateCamera()'s default.
+#define CALC_BUNDLE_SOLVER_VIEW_COUNT_MIN 50 // From this many views, solve with bundleCalibrateCamera() if enabled. Its time grows linearly with the view count.
+#define CALC_ROBUST_ROUNDS_MAX 4
+#define CALC_ROBUST_MAD_MULTIPLE 3.0 // Views with error more than this many (MAD-estimated) standard deviations above the median are candidates for rejection.
+#define CALC_ROBUST_THRESHOLD_MIN 0.5 // Pixels. Views with error below this are never rejected.
+#define CALC_ROBUST_VIEW_COUNT_MIN 5
+#define CALC_ROBUST_REJECT_FRACTION_MAX 0.3
+#define CALC_UNCERTAINTY_VIEW_COUNT_MIN 5
+#define CALC_UNCERTAINTY_SAMPLE_COUNT_MIN 3 // Completed solves needed to estimate a spread.
+#define CALC_UNCERTAINTY_ITERATIONS_MAX 10 // Warm-started from the solve of all views, which a resample differs from only a little.
+#define CALC_UNCERTAINTY_TIME_LIMIT 2.0 // Seconds. Resampled solves not begun by then are skipped.
 
 static ARdouble getSizeFactor(ARdouble dist_factor[], int xsize, int ysize, int dist_function_version);
 static void convParam(float intr[3][4], float dist[4], int xsize, int ysize, ARParam *param);
 
-static void calcChessboardCorners(const Calibration::CalibrationPatternType patternType, cv::Size patternSize, float patternSpacing, std::vector<cv::Point3f>& corners)
+void calcChessboardCorners(const Calibration::CalibrationPatternType patternType, cv::Size patternSize, float patternSpacing, std::vector<cv::Point3f>& corners)
 {
     corners.resize(0);
     
@@ -54,20 +73,24 @@ static void calcChessboardCorners(const Calibration::CalibrationPatternType patt
     }
 }
 
-void calc(const int capturedImageNum,
-          const Calibration::CalibrationPatternType patternType,
-          const cv::Size patternSize,
-		  const float patternSpacing,
-		  const std::vector<std::vector<cv::Point2f> >& cornerSet,
-		  const int width,
-		  const int height,
-		  ARParam *param_out,
-		  ARdouble *err_min_out,
-		  ARdouble *err_avg_out,
-		  ARdouble *err_max_out)
+static std::atomic<bool> gCalcBundleSolverEnabled(false);
+
+void calcSetBundleSolverEnabled(const bool enabled)
 {
-    int i, j, k;
+    gCalcBundleSolverEnabled = enabled;
+}
 
+// Solve with cv::calibrateCamera() (or the bundle solver, if enabled), starting from estimate if it holds one, in at most iterationsMax iterations.
+// On return, estimate holds the result, and *ok is false if it is out of range. Returns the RMS error reported by the solver.
+static double calibrate(const std::vector<cv::Point3f>& objectPoints,
+                        const CornerSet& cornerSet,
+                        const cv::Size imageSize,
+                        Calibration::IntrinsicsEstimate *estimate,
+                        std::vector<cv::Mat>& rotationVectors,
+                        std::vector<cv::Mat>& translationVectors,
+                        bool *ok,
+                        const int iterationsMax = CALC_ITERATIONS_MAX)
+{
     // Options.
     int flags = 0;
     double aspectRatio = 1.0;
@@ -76,86 +99,110 @@ void calc(const int capturedImageNum,
     //flags |= cv::CALIB_FIX_PRINCIPAL_POINT;
     //flags |= cv::CALIB_ZERO_TANGENT_DIST;
 
-    // Set up object points.
-    std::vector<std::vector<cv::Point3f> > objectPoints(1);
-    calcChessboardCorners(patternType, patternSize, patternSpacing, objectPoints[0]);
-    objectPoints.resize(capturedImageNum, objectPoints[0]);
-        
-    cv::Mat intrinsics = cv::Mat::eye(3, 3, CV_64F);
-    if (flags & cv::CALIB_FIX_ASPECT_RATIO)
-       intrinsics.at<double>(0,0) = aspectRatio;
-    
-    cv::Mat distortionCoeff = cv::Mat::zeros(4, 1, CV_64F);
-    std::vector<cv::Mat> rotationVectors;
-    std::vector<cv::Mat> translationVectors;
-    
-    double rms = calibrateCamera(objectPoints, cornerSet, cv::Size(width, height), intrinsics,
-                                 distortionCoeff, rotationVectors, translationVectors, flags|cv::CALIB_FIX_K3|cv::CALIB_FIX_K4|cv::CALIB_FIX_K5);
-    
-    ARLOGi("RMS error reported by calibrateCamera: %g\n", rms);
-    
-    bool ok = checkRange(intrinsics) && checkRange(distortionCoeff);
-    if (!ok) ARLOGe("cv::checkRange(intrinsics) && cv::checkRange(distortionCoeff) reported not OK.\n");
+    cv::Mat intrinsics;
+    cv::Mat distortionCoeff;
+    if (!estimate->cameraMatrix.empty()) {
+        // Warm start. The solver then needs only a few iterations to take in the views added since.
+        intrinsics = estimate->cameraMatrix.clone();
+        distortionCoeff = estimate->distortionCoeff.clone();
+        flags |= cv::CALIB_USE_INTRINSIC_GUESS;
+    } else {
+        intrinsics = cv::Mat::eye(3, 3, CV_64F);
+        if (flags & cv::CALIB_FIX_ASPECT_RATIO)
+           intrinsics.at<double>(0,0) = aspectRatio;
+        distortionCoeff = cv::Mat::zeros(4, 1, CV_64F);
+    }
     
+    const cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, iterationsMax, DBL_EPSILON);
+    double rms;
+    if (gCalcBundleSolverEnabled && cornerSet.viewCount() >= CALC_BUNDLE_SOLVER_VIEW_COUNT_MIN && !(flags & (cv::CALIB_FIX_ASPECT_RATIO|cv::CALIB_FIX_PRINCIPAL_POINT|cv::CALIB_ZERO_TANGENT_DIST))) {
+        rms = bundleCalibrateCamera(objectPoints, cornerSet, imageSize, intrinsics, distortionCoeff, rotationVectors, translationVectors, (flags & cv::CALIB_USE_INTRINSIC_GUESS) != 0, criteria);
+    } else {
+        // cv::calibrateCamera() takes the object points and corners of each view as separate arrays.
+        std::vector<std::vector<cv::Point3f> > objectPointSet(cornerSet.viewCount(), objectPoints);
+        std::vector<std::vector<cv::Point2f> > imagePointSet;
+        cornerSet.copyViews(imagePointSet);
+        rms = calibrateCamera(objectPointSet, imagePointSet, imageSize, intrinsics,
+                              distortionCoeff, rotationVectors, translationVectors, flags|cv::CALIB_FIX_K3|cv::CALIB_FIX_K4|cv::CALIB_FIX_K5, criteria);
+    }
     
+    estimate->cameraMatrix = intrinsics;
+    estimate->distortionCoeff = distortionCoeff;
+    estimate->rms = rms;
+    *ok = rms >= 0.0 && checkRange(intrinsics) && checkRange(distortionCoeff); // The bundle solver returns -1 if it failed.
+    return rms;
+}
+
+static void intrinsicsToParam(const cv::Mat& intrinsics, const cv::Mat& distortionCoeff, const int width, const int height, ARParam *param)
+{
     float           intr[3][4];
     float           dist[4];
-    ARParam         param;
+    int             i, j;
 
     for (j = 0; j < 3; j++) {
         for (i = 0; i < 3; i++) {
-            intr[j][i] =  (float)intrinsics.at<double>(j, i);
+            intr[j][i] = (float)intrinsics.at<double>(j, i);
         }
         intr[j][3] = 0.0f;
     }
     for (i = 0; i < 4; i++) {
         dist[i] = (float)distortionCoeff.at<double>(i);
     }
-    convParam(intr, dist, width, height, &param);
-    arParamDisp(&param);
+    convParam(intr, dist, width, height, param);
+}
+
+void calc(const int capturedImageNum,
+          const Calibration::CalibrationPatternType patternType,
+          const cv::Size patternSize,
+		  const float patternSpacing,
+		  const CornerSet& cornerSet,
+		  const int width,
+		  const int height,
+		  ARParam *param_out,
+		  ARdouble *err_min_out,
+		  ARdouble *err_avg_out,
+		  ARdouble *err_max_out,
+          Calibration::IntrinsicsEstimate *estimate,
+          CalibrationResiduals *residuals_out)
+{
+    LatencyStatsScope latency(LATENCY_STAGE_CALC);
+    int k;
 
-    CvMat          *rotationVector;
-    CvMat          *rotationMatrix;
-    double          trans[3][4];
-    ARdouble        cx, cy, cz, hx, hy, h, sx, sy, ox, oy, err;
-    ARdouble        err_min = 1000000.0f, err_avg = 0.0f, err_max = 0.0f;
-    rotationVector     = cvCreateMat(1, 3, CV_32FC1);
-    rotationMatrix     = cvCreateMat(3, 3, CV_32FC1);
+    // Set up object points.
+    std::vector<cv::Point3f> objectPoints;
+    calcChessboardCorners(patternType, patternSize, patternSpacing, objectPoints);
+        
+    Calibration::IntrinsicsEstimate solved;
+    if (estimate) solved = *estimate;
+    std::vector<cv::Mat> rotationVectors;
+    std::vector<cv::Mat> translationVectors;
+    
+    bool ok;
+    double rms = calibrate(objectPoints, cornerSet, cv::Size(width, height), &solved, rotationVectors, translationVectors, &ok);
+    
+    ARLOGi("RMS error reported by calibrateCamera: %g\n", rms);
+    
+    if (!ok) ARLOGe("Calibration solve failed, or its result is out of range.\n");
+    if (estimate) {
+        if (ok) {
+            *estimate = solved;
+        } else {
+            // Don't warm-start from a bad solve.
+            estimate->cameraMatrix.release();
+            estimate->distortionCoeff.release();
+        }
+    }
+    
+    ARParam         param;
+    intrinsicsToParam(solved.cameraMatrix, solved.distortionCoeff, width, height, &param);
+    arParamDisp(&param);
 
+    CalibrationResiduals residuals;
+    calcResiduals(param, objectPoints, cornerSet, rotationVectors, translationVectors, &residuals);
+    
+    ARdouble err_min = 1000000.0, err_avg = 0.0, err_max = 0.0;
     for (k = 0; k < capturedImageNum; k++) {
-        for (i = 0; i < 3; i++) {
-            ((float *)(rotationVector->data.ptr))[i] = (float)rotationVectors.at(k).at<double>(i);
-        }
-        cvRodrigues2(rotationVector, rotationMatrix, 0);
-        for (j = 0; j < 3; j++) {
-            for (i = 0; i < 3; i++) {
-                trans[j][i] = ((float *)(rotationMatrix->data.ptr + rotationMatrix->step*j))[i];
-            }
-            trans[j][3] = (float)translationVectors.at(k).at<double>(j);
-        }
-        //arParamDispExt(trans);
-
-        err = 0.0;
-        for (i = 0; i < patternSize.width; i++) {
-            for (j = 0; j < patternSize.height; j++) {
-                float x = objectPoints[0][i * patternSize.height + j].x;
-                float y = objectPoints[0][i * patternSize.height + j].y;
-                cx = trans[0][0] * x + trans[0][1] * y + trans[0][3];
-                cy = trans[1][0] * x + trans[1][1] * y + trans[1][3];
-                cz = trans[2][0] * x + trans[2][1] * y + trans[2][3];
-                hx = param.mat[0][0] * cx + param.mat[0][1] * cy + param.mat[0][2] * cz + param.mat[0][3];
-                hy = param.mat[1][0] * cx + param.mat[1][1] * cy + param.mat[1][2] * cz + param.mat[1][3];
-                h  = param.mat[2][0] * cx + param.mat[2][1] * cy + param.mat[2][2] * cz + param.mat[2][3];
-                if (h == 0.0) continue;
-                sx = hx / h;
-                sy = hy / h;
-                arParamIdeal2Observ(param.dist_factor, sx, sy, &ox, &oy, param.dist_function_version);
-                sx = (ARdouble)cornerSet[k][i * patternSize.height + j].x;
-                sy = (ARdouble)cornerSet[k][i * patternSize.height + j].y;
-                err += (ox - sx)*(ox - sx) + (oy - sy)*(oy - sy);
-            }
-        }
-        err = sqrtf(err/(patternSize.width*patternSize.height));
+        const ARdouble err = residuals.viewErr[k];
         ARLOG("Err[%2d]: %f[pixel]\n", k + 1, err);
 
         // Track min, avg, and max error.
@@ -163,15 +210,518 @@ void calc(const int capturedImageNum,
         err_avg += err;
         if (err > err_max) err_max = err;
     }
-    err_avg /= (ARdouble)(capturedImageNum + 1);
+    if (capturedImageNum > 0) err_avg /= (ARdouble)capturedImageNum;
     *err_min_out = err_min;
     *err_avg_out = err_avg;
     *err_max_out = err_max;
 
     *param_out = param;
+    if (residuals_out) *residuals_out = std::move(residuals);
+}
+
+// Evaluates the residuals of a range of views. The pattern is planar, so each view's projection
+// (camera matrix times pose) reduces to a 3x3 homography of the pattern plane. Points are held as
+// separate x and y arrays so that the projection and distortion loops vectorise.
+class CalcResidualsBody : public cv::ParallelLoopBody
+{
+public:
+    CalcResidualsBody(const ARParam& param,
+                      const std::vector<float>& objectX,
+                      const std::vector<float>& objectY,
+                      const CornerSet& cornerSet,
+                      const std::vector<cv::Mat>& rotationVectors,
+                      const std::vector<cv::Mat>& translationVectors,
+                      CalibrationResiduals *residuals) :
+        m_param(param),
+        m_objectX(objectX),
+        m_objectY(objectY),
+        m_cornerSet(cornerSet),
+        m_rotationVectors(rotationVectors),
+        m_translationVectors(translationVectors),
+        m_residuals(residuals)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        const int n = m_residuals->pointCount;
+        const float *X = m_objectX.data();
+        const float *Y = m_objectY.data();
+        std::vector<double> buff(4*n);
+        double *ix = &buff[0], *iy = &buff[n], *ox = &buff[2*n], *oy = &buff[3*n];
+        
+        for (int k = range.start; k < range.end; k++) {
+            cv::Matx33d R;
+            cv::Rodrigues(m_rotationVectors[k], R);
+            const cv::Mat& t = m_translationVectors[k];
+            double H[3][3];
+            for (int j = 0; j < 3; j++) {
+                H[j][0] = m_param.mat[j][0]*R(0, 0) + m_param.mat[j][1]*R(1, 0) + m_param.mat[j][2]*R(2, 0);
+                H[j][1] = m_param.mat[j][0]*R(0, 1) + m_param.mat[j][1]*R(1, 1) + m_param.mat[j][2]*R(2, 1);
+                H[j][2] = m_param.mat[j][0]*t.at<double>(0) + m_param.mat[j][1]*t.at<double>(1) + m_param.mat[j][2]*t.at<double>(2) + m_param.mat[j][3];
+            }
+            
+            // Project to ideal screen coordinates.
+            for (int i = 0; i < n; i++) {
+                const double hx = H[0][0]*X[i] + H[0][1]*Y[i] + H[0][2];
+                const double hy = H[1][0]*X[i] + H[1][1]*Y[i] + H[1][2];
+                const double h  = H[2][0]*X[i] + H[2][1]*Y[i] + H[2][2];
+                const double hInv = (h != 0.0 ? 1.0/h : NAN);
+                ix[i] = hx*hInv;
+                iy[i] = hy*hInv;
+            }
+            
+            // Distort to observed screen coordinates.
+            if (m_param.dist_function_version == 4) {
+                // As arParamIdeal2Observ(), inlined so that it vectorises.
+                const double k1 = m_param.dist_factor[0], k2 = m_param.dist_factor[1], p1 = m_param.dist_factor[2], p2 = m_param.dist_factor[3];
+                const double fx = m_param.dist_factor[4], fy = m_param.dist_factor[5], x0 = m_param.dist_factor[6], y0 = m_param.dist_factor[7];
+                const double sx = m_param.dist_factor[8]/fx, sy = m_param.dist_factor[8]/fy;
+                for (int i = 0; i < n; i++) {
+                    const double x = (ix[i] - x0)*sx;
+                    const double y = (iy[i] - y0)*sy;
+                    const double l = x*x + y*y;
+                    const double radial = 1.0 + k1*l + k2*l*l;
+                    ox[i] = fx*(x*radial + 2.0*p1*x*y + p2*(l + 2.0*x*x)) + x0;
+                    oy[i] = fy*(y*radial + p1*(l + 2.0*y*y) + 2.0*p2*x*y) + y0;
+                }
+            } else {
+                for (int i = 0; i < n; i++) {
+                    ARdouble oxi, oyi;
+                    arParamIdeal2Observ(m_param.dist_factor, ix[i], iy[i], &oxi, &oyi, m_param.dist_function_version);
+                    ox[i] = oxi;
+                    oy[i] = oyi;
+                }
+            }
+            
+            // Residuals, and the view's RMS error.
+            const float *cx = m_cornerSet.x(k);
+            const float *cy = m_cornerSet.y(k);
+            float *dx = &m_residuals->dx[(size_t)k*n];
+            float *dy = &m_residuals->dy[(size_t)k*n];
+            double err = 0.0;
+            int valid = 0;
+            for (int i = 0; i < n; i++) {
+                dx[i] = (float)(cx[i] - ox[i]);
+                dy[i] = (float)(cy[i] - oy[i]);
+                const double e = (double)dx[i]*dx[i] + (double)dy[i]*dy[i];
+                if (e == e) { // Not NaN.
+                    err += e;
+                    valid++;
+                }
+            }
+            m_residuals->viewErr[k] = (valid ? sqrt(err/valid) : NAN);
+        }
+    }
+
+private:
+    const ARParam& m_param;
+    const std::vector<float>& m_objectX;
+    const std::vector<float>& m_objectY;
+    const CornerSet& m_cornerSet;
+    const std::vector<cv::Mat>& m_rotationVectors;
+    const std::vector<cv::Mat>& m_translationVectors;
+    CalibrationResiduals *m_residuals;
+};
+
+void calcResiduals(const ARParam& param,
+                   const std::vector<cv::Point3f>& objectPoints,
+                   const CornerSet& cornerSet,
+                   const std::vector<cv::Mat>& rotationVectors,
+                   const std::vector<cv::Mat>& translationVectors,
+                   CalibrationResiduals *residuals)
+{
+    const int n = (int)objectPoints.size();
+    const int viewCount = cornerSet.viewCount();
+    residuals->viewCount = viewCount;
+    residuals->pointCount = n;
+    residuals->dx.assign((size_t)viewCount*n, 0.0f);
+    residuals->dy.assign((size_t)viewCount*n, 0.0f);
+    residuals->viewErr.assign(viewCount, 0.0);
+    if (!viewCount || !n) return;
+    
+    std::vector<float> objectX(n), objectY(n);
+    for (int i = 0; i < n; i++) {
+        objectX[i] = objectPoints[i].x;
+        objectY[i] = objectPoints[i].y;
+    }
+    cv::parallel_for_(cv::Range(0, viewCount), CalcResidualsBody(param, objectX, objectY, cornerSet, rotationVectors, translationVectors, residuals));
+}
+
+// Result of a solve which leaves one candidate view out.
+typedef struct {
+    int view; // Index into the active views.
+    bool ok;
+    double rmsWithout; // RMS error of the other views' solve.
+    ARdouble heldOutErr; // RMS error of the left-out view, posed by cv::solvePnP() under the solve's intrinsics.
+} CalcLeaveOneOut;
+
+class CalcLeaveOneOutBody : public cv::ParallelLoopBody
+{
+public:
+    CalcLeaveOneOutBody(const std::vector<cv::Point3f>& objectPoints,
+                        const CornerSet& cornerSet,
+                        const cv::Size imageSize,
+                        const Calibration::IntrinsicsEstimate& estimate,
+                        std::vector<CalcLeaveOneOut>& results) :
+        m_objectPoints(objectPoints),
+        m_cornerSet(cornerSet),
+        m_imageSize(imageSize),
+        m_estimate(estimate),
+        m_results(results)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        for (int c = range.start; c < range.end; c++) {
+            CalcLeaveOneOut& result = m_results[c];
+            const int view = result.view;
+            std::vector<int> otherViews;
+            for (int k = 0; k < m_cornerSet.viewCount(); k++) if (k != view) otherViews.push_back(k);
+            const CornerSet others = m_cornerSet.subset(otherViews);
+            
+            Calibration::IntrinsicsEstimate solved = {m_estimate.cameraMatrix.clone(), m_estimate.distortionCoeff.clone(), m_estimate.rms};
+            std::vector<cv::Mat> rotationVectors, translationVectors;
+            result.rmsWithout = calibrate(m_objectPoints, others, m_imageSize, &solved, rotationVectors, translationVectors, &result.ok);
+            if (!result.ok) continue;
+            
+            cv::Mat rotationVector, translationVector;
+            std::vector<cv::Point2f> corners;
+            m_cornerSet.copyView(view, corners);
+            if (!cv::solvePnP(m_objectPoints, corners, solved.cameraMatrix, solved.distortionCoeff, rotationVector, translationVector)) {
+                result.ok = false;
+                continue;
+            }
+            ARParam param;
+            intrinsicsToParam(solved.cameraMatrix, solved.distortionCoeff, m_imageSize.width, m_imageSize.height, &param);
+            CalibrationResiduals residuals;
+            calcResiduals(param, m_objectPoints, m_cornerSet.subset(std::vector<int>(1, view)), std::vector<cv::Mat>(1, rotationVector), std::vector<cv::Mat>(1, translationVector), &residuals);
+            result.heldOutErr = residuals.viewErr[0];
+        }
+    }
+
+private:
+    const std::vector<cv::Point3f>& m_objectPoints;
+    const CornerSet& m_cornerSet;
+    const cv::Size m_imageSize;
+    const Calibration::IntrinsicsEstimate& m_estimate;
+    std::vector<CalcLeaveOneOut>& m_results;
+};
+
+// Errors ordered with NaN (a view whose error couldn't be evaluated) as the worst, above +infinity. NaN compares
+// false with everything, so it can't be given to std::sort() or std::nth_element() as is.
+static bool viewErrLess(const ARdouble a, const ARdouble b)
+{
+    if (b != b) return (a == a);
+    return (a < b);
+}
+
+// Median, counting NaN as the largest value.
+static ARdouble median(std::vector<ARdouble> v)
+{
+    for (ARdouble& e : v) if (e != e) e = HUGE_VAL;
+    const size_t n = v.size();
+    std::nth_element(v.begin(), v.begin() + n/2, v.end());
+    ARdouble m = v[n/2];
+    if (n % 2 == 0) m = 0.5*(m + *std::max_element(v.begin(), v.begin() + n/2));
+    return m;
+}
+
+void calcRobust(const int capturedImageNum,
+                const Calibration::CalibrationPatternType patternType,
+                const cv::Size patternSize,
+                const float patternSpacing,
+                const CornerSet& cornerSet,
+                const int width,
+                const int height,
+                ARParam *param_out,
+                ARdouble *err_min_out,
+                ARdouble *err_avg_out,
+                ARdouble *err_max_out,
+                std::vector<CalibrationRejectedView> *rejected_out,
+                Calibration::IntrinsicsEstimate *estimate,
+                CalibrationResiduals *residuals_out)
+{
+    std::vector<cv::Point3f> objectPoints;
+    calcChessboardCorners(patternType, patternSize, patternSpacing, objectPoints);
+    const cv::Size imageSize(width, height);
+    
+    // Never reject more than a fraction of the views, nor leave fewer than the minimum.
+    const int activeCountMin = std::max(CALC_ROBUST_VIEW_COUNT_MIN, capturedImageNum - (int)(capturedImageNum*CALC_ROBUST_REJECT_FRACTION_MAX));
+    
+    std::vector<int> active(capturedImageNum); // Indices into cornerSet of views not yet rejected.
+    for (int k = 0; k < capturedImageNum; k++) active[k] = k;
+    Calibration::IntrinsicsEstimate solved;
+    if (estimate) solved = *estimate;
+    if (rejected_out) rejected_out->clear();
+    
+    for (int round = 1; round <= CALC_ROBUST_ROUNDS_MAX && (int)active.size() > activeCountMin; round++) {
+        
+        const CornerSet activeCornerSet = cornerSet.subset(active);
+        
+        std::vector<cv::Mat> rotationVectors, translationVectors;
+        bool ok;
+        calibrate(objectPoints, activeCornerSet, imageSize, &solved, rotationVectors, translationVectors, &ok);
+        if (!ok) {
+            ARLOGe("Robust calibration: solve of %d views out of range; no more views will be rejected.\n", (int)active.size());
+            solved.cameraMatrix.release();
+            solved.distortionCoeff.release();
+            break;
+        }
+        ARParam param;
+        intrinsicsToParam(solved.cameraMatrix, solved.distortionCoeff, width, height, &param);
+        CalibrationResiduals residuals;
+        calcResiduals(param, objectPoints, activeCornerSet, rotationVectors, translationVectors, &residuals);
+        
+        // Outlier threshold from the median and median absolute deviation (scaled to estimate a standard deviation).
+        const ARdouble med = median(residuals.viewErr);
+        std::vector<ARdouble> deviations(residuals.viewErr.size());
+        for (size_t k = 0; k < deviations.size(); k++) deviations[k] = fabs(residuals.viewErr[k] - med);
+        const ARdouble mad = median(deviations);
+        const ARdouble threshold = std::max(med + CALC_ROBUST_MAD_MULTIPLE*1.4826*mad, (ARdouble)CALC_ROBUST_THRESHOLD_MIN);
+        
+        // Candidates, worst first, no more than may be rejected.
+        std::vector<CalcLeaveOneOut> candidates;
+        for (int k = 0; k < (int)active.size(); k++) {
+            if (residuals.viewErr[k] > threshold || residuals.viewErr[k] != residuals.viewErr[k]) candidates.push_back({k, false, 0.0, 0.0});
+        }
+        if (candidates.empty()) break;
+        std::sort(candidates.begin(), candidates.end(), [&](const CalcLeaveOneOut& a, const CalcLeaveOneOut& b) {return viewErrLess(residuals.viewErr[b.view], residuals.viewErr[a.view]); });
+        const int rejectableCount = (int)active.size() - activeCountMin;
+        if ((int)candidates.size() > rejectableCount) candidates.resize(rejectableCount);
+        
+        cv::parallel_for_(cv::Range(0, (int)candidates.size()), CalcLeaveOneOutBody(objectPoints, activeCornerSet, imageSize, solved, candidates));
+        
+        // RMS error of all views, from which a candidate's own contribution is taken out for comparison with its leave-one-out solve.
+        double sumSq = 0.0;
+        for (ARdouble e : residuals.viewErr) if (e == e) sumSq += e*e;
+        
+        std::vector<bool> reject(active.size(), false);
+        int rejectCount = 0;
+        for (const CalcLeaveOneOut& c : candidates) {
+            const ARdouble err = residuals.viewErr[c.view];
+            if (!c.ok || c.heldOutErr <= threshold) continue; // A model it didn't influence fits it, so keep it.
+            const double rmsWith = (active.size() > 1 && err == err ? sqrt((sumSq - err*err)/(active.size() - 1)) : 0.0);
+            char reason[256];
+            snprintf(reason, sizeof(reason), "error %.3f px above threshold %.3f px (median %.3f px, MAD %.3f px); %.3f px when left out of the solve, which changes the other views' RMS error from %.3f px to %.3f px",
+                     err, threshold, med, mad, c.heldOutErr, rmsWith, c.rmsWithout);
+            ARLOGi("Robust calibration round %d: rejecting view %d: %s.\n", round, active[c.view], reason);
+            if (rejected_out) rejected_out->push_back({active[c.view], round, err, threshold, c.heldOutErr, reason});
+            reject[c.view] = true;
+            rejectCount++;
+        }
+        if (!rejectCount) break;
+        
+        std::vector<int> kept;
+        for (int k = 0; k < (int)active.size(); k++) if (!reject[k]) kept.push_back(active[k]);
+        active.swap(kept);
+    }
+    
+    // Final solve of the views kept, warm-started from the last round.
+    const CornerSet activeCornerSet = cornerSet.subset(active);
+    ARLOGi("Robust calibration: %d of %d views kept.\n", (int)active.size(), capturedImageNum);
+    calc(activeCornerSet.viewCount(), patternType, patternSize, patternSpacing, activeCornerSet, width, height, param_out, err_min_out, err_avg_out, err_max_out, &solved, residuals_out);
+    if (estimate) *estimate = solved;
+}
 
-    cvReleaseMat(&rotationVector);
-    cvReleaseMat(&rotationMatrix);
+// Result of one resampled solve.
+typedef struct {
+    bool ok;
+    ARdouble distFactor[AR_DIST_FACTOR_NUM_MAX];
+} CalcUncertaintySample;
+
+class CalcUncertaintyBody : public cv::ParallelLoopBody
+{
+public:
+    CalcUncertaintyBody(const std::vector<cv::Point3f>& objectPoints,
+                        const CornerSet& cornerSet,
+                        const cv::Size imageSize,
+                        const Calibration::IntrinsicsEstimate& estimate,
+                        const Calibration::UncertaintyMethod method,
+                        const std::chrono::steady_clock::time_point deadline,
+                        std::vector<CalcUncertaintySample>& samples) :
+        m_objectPoints(objectPoints),
+        m_cornerSet(cornerSet),
+        m_imageSize(imageSize),
+        m_estimate(estimate),
+        m_method(method),
+        m_deadline(deadline),
+        m_samples(samples)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        const int viewCount = m_cornerSet.viewCount();
+        const int sampleCount = (int)m_samples.size();
+        std::vector<int> resampled;
+        
+        for (int s = range.start; s < range.end; s++) {
+            CalcUncertaintySample& sample = m_samples[s];
+            sample.ok = false;
+            if (std::chrono::steady_clock::now() > m_deadline) continue;
+            
+            resampled.clear();
+            if (m_method == Calibration::UncertaintyMethod::BOOTSTRAP) {
+                cv::RNG rng((uint64)s + 1); // Seeded per sample, so the result doesn't depend on scheduling.
+                for (int k = 0; k < viewCount; k++) resampled.push_back(rng.uniform(0, viewCount));
+            } else {
+                for (int k = 0; k < viewCount; k++) if (k % sampleCount != s) resampled.push_back(k);
+            }
+            
+            Calibration::IntrinsicsEstimate solved = {m_estimate.cameraMatrix.clone(), m_estimate.distortionCoeff.clone(), m_estimate.rms};
+            std::vector<cv::Mat> rotationVectors, translationVectors;
+            calibrate(m_objectPoints, m_cornerSet.subset(resampled), m_imageSize, &solved, rotationVectors, translationVectors, &sample.ok, CALC_UNCERTAINTY_ITERATIONS_MAX);
+            if (!sample.ok) continue;
+            ARParam param;
+            intrinsicsToParam(solved.cameraMatrix, solved.distortionCoeff, m_imageSize.width, m_imageSize.height, &param);
+            for (int i = 0; i < AR_DIST_FACTOR_NUM_MAX; i++) sample.distFactor[i] = param.dist_factor[i];
+        }
+    }
+
+private:
+    const std::vector<cv::Point3f>& m_objectPoints;
+    const CornerSet& m_cornerSet;
+    const cv::Size m_imageSize;
+    const Calibration::IntrinsicsEstimate& m_estimate;
+    const Calibration::UncertaintyMethod m_method;
+    const std::chrono::steady_clock::time_point m_deadline;
+    std::vector<CalcUncertaintySample>& m_samples;
+};
+
+bool calcUncertainty(const Calibration::CalibrationPatternType patternType,
+                     const cv::Size patternSize,
+                     const float patternSpacing,
+                     const CornerSet& cornerSet,
+                     const int width,
+                     const int height,
+                     const Calibration::IntrinsicsEstimate& estimate,
+                     const Calibration::UncertaintyMethod method,
+                     const int sampleCount,
+                     Calibration::Uncertainty *uncertainty_out)
+{
+    const int viewCount = cornerSet.viewCount();
+    if (viewCount < CALC_UNCERTAINTY_VIEW_COUNT_MIN) {
+        ARLOGe("Uncertainty: needs at least %d views.\n", CALC_UNCERTAINTY_VIEW_COUNT_MIN);
+        return false;
+    }
+    if (estimate.cameraMatrix.empty()) {
+        ARLOGe("Uncertainty: no solve of all views to start from.\n");
+        return false;
+    }
+    const int count = (method == Calibration::UncertaintyMethod::K_FOLD ? std::min(sampleCount, viewCount) : sampleCount);
+    if (count < CALC_UNCERTAINTY_SAMPLE_COUNT_MIN) {
+        ARLOGe("Uncertainty: needs at least %d samples.\n", CALC_UNCERTAINTY_SAMPLE_COUNT_MIN);
+        return false;
+    }
+    
+    std::vector<cv::Point3f> objectPoints;
+    calcChessboardCorners(patternType, patternSize, patternSpacing, objectPoints);
+    
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const std::chrono::steady_clock::time_point deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(CALC_UNCERTAINTY_TIME_LIMIT));
+    std::vector<CalcUncertaintySample> samples(count);
+    cv::parallel_for_(cv::Range(0, count), CalcUncertaintyBody(objectPoints, cornerSet, cv::Size(width, height), estimate, method, deadline, samples));
+    
+    int ok = 0;
+    double mean[AR_DIST_FACTOR_NUM_MAX] = {0.0};
+    for (const CalcUncertaintySample& sample : samples) {
+        if (!sample.ok) continue;
+        for (int i = 0; i < AR_DIST_FACTOR_NUM_MAX; i++) mean[i] += sample.distFactor[i];
+        ok++;
+    }
+    ARLOGi("Uncertainty: %d of %d %s solves completed in %.2f s.\n", ok, count, (method == Calibration::UncertaintyMethod::BOOTSTRAP ? "bootstrap" : "K-fold"),
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if (ok < CALC_UNCERTAINTY_SAMPLE_COUNT_MIN) return false;
+    // The jackknife's scale assumes every one of the K folds it was built with, so a partial set can't be used.
+    if (method == Calibration::UncertaintyMethod::K_FOLD && ok < count) {
+        ARLOGe("Uncertainty: %d of %d K-fold solves did not complete.\n", count - ok, count);
+        return false;
+    }
+    
+    double sumSq[AR_DIST_FACTOR_NUM_MAX] = {0.0};
+    for (int i = 0; i < AR_DIST_FACTOR_NUM_MAX; i++) mean[i] /= ok;
+    for (const CalcUncertaintySample& sample : samples) {
+        if (!sample.ok) continue;
+        for (int i = 0; i < AR_DIST_FACTOR_NUM_MAX; i++) sumSq[i] += (sample.distFactor[i] - mean[i])*(sample.distFactor[i] - mean[i]);
+    }
+    // Bootstrap: the sample variance of the solves. Jackknife: solves each see most of the views, so their spread is
+    // scaled up by (K - 1).
+    const double scale = (method == Calibration::UncertaintyMethod::BOOTSTRAP ? 1.0/(ok - 1) : (double)(count - 1)/count);
+    uncertainty_out->method = method;
+    uncertainty_out->sampleCount = ok;
+    for (int i = 0; i < AR_DIST_FACTOR_NUM_MAX; i++) uncertainty_out->distFactorStdDev[i] = sqrt(sumSq[i]*scale);
+    return true;
+}
+
+bool calcStereo(const Calibration::CalibrationPatternType patternType,
+                const cv::Size patternSize,
+                const float patternSpacing,
+                const CornerSet& cornerSetL,
+                const int widthL,
+                const int heightL,
+                const CornerSet& cornerSetR,
+                const int widthR,
+                const int heightR,
+                ARParam *paramL_out,
+                ARParam *paramR_out,
+                ARdouble transL2R_out[3][4],
+                ARdouble *errL_out,
+                ARdouble *errR_out,
+                ARdouble *errStereo_out,
+                Calibration::IntrinsicsEstimate *estimateL,
+                Calibration::IntrinsicsEstimate *estimateR)
+{
+    const int viewCount = cornerSetL.viewCount();
+    if (viewCount == 0 || cornerSetR.viewCount() != viewCount || cornerSetR.pointCount() != cornerSetL.pointCount()) {
+        ARLOGe("Stereo: the left and right views are not paired.\n");
+        return false;
+    }
+    
+    // Each camera's intrinsics. calc() leaves an estimate empty if its solve was out of range.
+    Calibration::IntrinsicsEstimate solvedL, solvedR;
+    if (estimateL) solvedL = *estimateL;
+    if (estimateR) solvedR = *estimateR;
+    ARdouble errMin, errMax;
+    ARLOGi("Stereo: calibrating left camera.\n");
+    calc(viewCount, patternType, patternSize, patternSpacing, cornerSetL, widthL, heightL, paramL_out, &errMin, errL_out, &errMax, &solvedL);
+    ARLOGi("Stereo: calibrating right camera.\n");
+    calc(viewCount, patternType, patternSize, patternSpacing, cornerSetR, widthR, heightR, paramR_out, &errMin, errR_out, &errMax, &solvedR);
+    if (estimateL) *estimateL = solvedL;
+    if (estimateR) *estimateR = solvedR;
+    if (solvedL.cameraMatrix.empty() || solvedR.cameraMatrix.empty()) {
+        ARLOGe("Stereo: calibration of the %s camera failed.\n", (solvedL.cameraMatrix.empty() ? "left" : "right"));
+        return false;
+    }
+    
+    // Then the transform between them, with the intrinsics fixed.
+    std::vector<cv::Point3f> objectPoints;
+    calcChessboardCorners(patternType, patternSize, patternSpacing, objectPoints);
+    std::vector<std::vector<cv::Point3f> > objectPointSet(viewCount, objectPoints);
+    std::vector<std::vector<cv::Point2f> > imagePointSetL, imagePointSetR;
+    cornerSetL.copyViews(imagePointSetL);
+    cornerSetR.copyViews(imagePointSetR);
+    cv::Mat R, T, E, F;
+    const cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, CALC_ITERATIONS_MAX, DBL_EPSILON);
+    const double rms = cv::stereoCalibrate(objectPointSet, imagePointSetL, imagePointSetR,
+                                           solvedL.cameraMatrix, solvedL.distortionCoeff, solvedR.cameraMatrix, solvedR.distortionCoeff,
+                                           cv::Size(widthL, heightL), R, T, E, F, cv::CALIB_FIX_INTRINSIC, criteria);
+    ARLOGi("RMS error reported by stereoCalibrate: %g\n", rms);
+    if (!checkRange(R) || !checkRange(T)) {
+        ARLOGe("Stereo: cv::checkRange(R) && cv::checkRange(T) reported not OK.\n");
+        return false;
+    }
+    
+    // OpenCV's camera coordinate system (x right, y down, z forward) is ARToolKit's, so [R|T] maps left camera
+    // coordinates to right camera coordinates as they are.
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < 3; i++) transL2R_out[j][i] = (ARdouble)R.at<double>(j, i);
+        transL2R_out[j][3] = (ARdouble)T.at<double>(j);
+    }
+    ARLOGi("Stereo: baseline %.1f.\n", cv::norm(T));
+    *errStereo_out = rms;
+    return true;
 }
 
 void convParam(float intr[3][4], float dist[4], int xsize, int ysize, ARParam *param)
@@ -25,16 +25,124 @@
 
 #include <AR6/AR/ar.h>
 #include <opencv2/core/core.hpp>
+#include <string>
 #include "Calibration.hpp"
+#include "CornerSet.hpp"
 
+// Positions of the pattern's corners (or circle centres) on the pattern plane (z = 0), in the same order as
+// they are reported by the corner finder.
+void calcChessboardCorners(const Calibration::CalibrationPatternType patternType, cv::Size patternSize, float patternSpacing, std::vector<cv::Point3f>& corners);
+
+// Reprojection residuals of each corner of each view: the observed position minus the position projected
+// through the calibrated camera, in pixels. Stored view by view, each view's corners in corner finder order.
+// A corner whose projection is undefined has NaN residuals and is excluded from its view's error.
+struct CalibrationResiduals {
+    int viewCount;
+    int pointCount; // Per view.
+    std::vector<float> dx;
+    std::vector<float> dy;
+    std::vector<ARdouble> viewErr; // RMS error of each view, in pixels.
+};
+
+// Evaluate the residuals of all views, in parallel, for camera parameters param and the views' poses
+// (as returned by cv::calibrateCamera()). objectPoints must lie in the plane z = 0.
+void calcResiduals(const ARParam& param,
+                   const std::vector<cv::Point3f>& objectPoints,
+                   const CornerSet& cornerSet,
+                   const std::vector<cv::Mat>& rotationVectors,
+                   const std::vector<cv::Mat>& translationVectors,
+                   CalibrationResiduals *residuals);
+
+// Solve calibrations of 50 or more views with bundleCalibrateCamera(), whose time grows linearly with the view count,
+// instead of cv::calibrateCamera(). Off by default. calib_camera_bench checks that the two solvers agree.
+void calcSetBundleSolverEnabled(const bool enabled);
+
+// Calibrate from the corners found in capturedImageNum views. If estimate is non-NULL and holds an estimate,
+// the solve starts from it rather than from scratch. On return, it holds the new estimate.
+// If residuals_out is non-NULL, it receives the reprojection residuals of every corner.
 void calc(const int capturedImageNum,
           const Calibration::CalibrationPatternType patternType,
 		  const cv::Size patternSize,
 		  const float chessboardSquareWidth,
-          const std::vector<std::vector<cv::Point2f> >& cornerSet,
+          const CornerSet& cornerSet,
 		  const int width,
 		  const int height,
 		  ARParam *param_out,
 		  ARdouble *err_min_out,
 		  ARdouble *err_avg_out,
-		  ARdouble *err_max_out);
+		  ARdouble *err_max_out,
+          Calibration::IntrinsicsEstimate *estimate = NULL,
+          CalibrationResiduals *residuals_out = NULL);
+
+// A view rejected by calcRobust().
+struct CalibrationRejectedView {
+    int index; // Into the cornerSet passed to calcRobust().
+    int round; // Rejection round in which it was rejected, from 1.
+    ARdouble err; // RMS error of the view in that round's solve, in pixels.
+    ARdouble threshold; // Rejection threshold in that round, in pixels.
+    ARdouble heldOutErr; // RMS error of the view under a solve which left it out, in pixels.
+    std::string reason;
+};
+
+// As calc(), but robust to bad views (e.g. a misordered grid, or motion blur). After each solve, views whose error
+// is an outlier (above the median by more than a multiple of the median absolute deviation) become candidates.
+// Each candidate is checked by a solve which leaves it out, run in parallel, and is rejected if its error under that
+// solve is still an outlier. The remaining views are then re-solved, warm-started, until no more are rejected.
+// Views rejected, in order of rejection, are returned in rejected_out. If residuals_out is non-NULL, it receives the
+// residuals of the views kept, in their order in cornerSet, under the final solve.
+void calcRobust(const int capturedImageNum,
+                const Calibration::CalibrationPatternType patternType,
+                const cv::Size patternSize,
+                const float chessboardSquareWidth,
+                const CornerSet& cornerSet,
+                const int width,
+                const int height,
+                ARParam *param_out,
+                ARdouble *err_min_out,
+                ARdouble *err_avg_out,
+                ARdouble *err_max_out,
+                std::vector<CalibrationRejectedView> *rejected_out,
+                Calibration::IntrinsicsEstimate *estimate = NULL,
+                CalibrationResiduals *residuals_out = NULL);
+
+// Estimate the uncertainty of a calibration of the views in cornerSet, from the spread of solves of resampled views.
+// estimate must hold the solve of all of those views; each resampled solve is warm-started from it, with a reduced
+// iteration limit. Solves which stop short stay nearer estimate, which narrows the spread, so the result is a lower
+// bound on the true uncertainty. sampleCount is the number of resamples for BOOTSTRAP, or K for K_FOLD. Solves run
+// in parallel, and any not begun within a time limit are skipped. Returns false if too few bootstrap solves
+// completed to estimate a spread, or if any K-fold solve didn't complete.
+bool calcUncertainty(const Calibration::CalibrationPatternType patternType,
+                     const cv::Size patternSize,
+                     const float chessboardSquareWidth,
+                     const CornerSet& cornerSet,
+                     const int width,
+                     const int height,
+                     const Calibration::IntrinsicsEstimate& estimate,
+                     const Calibration::UncertaintyMethod method,
+                     const int sampleCount,
+                     Calibration::Uncertainty *uncertainty_out);
+
+// Calibrate a stereo pair of cameras from views of the pattern seen by both at once. View k of cornerSetL and view k
+// of cornerSetR must be of the same pose of the pattern. Each camera is first calibrated as by calc(), and its
+// intrinsics are then held fixed while the rigid transform between the cameras is solved. transL2R_out receives that
+// transform, from the left camera's coordinate system to the right's, as [R|t] with t in the units of
+// chessboardSquareWidth, as read by arParamLoadExt(). errL_out and errR_out receive each camera's average view error,
+// and errStereo_out the RMS error of the joint solve, in pixels. estimateL and estimateR are as for calc().
+// Returns false if either camera or the transform could not be solved.
+bool calcStereo(const Calibration::CalibrationPatternType patternType,
+                const cv::Size patternSize,
+                const float chessboardSquareWidth,
+                const CornerSet& cornerSetL,
+                const int widthL,
+                const int heightL,
+                const CornerSet& cornerSetR,
+                const int widthR,
+                const int heightR,
+                ARParam *paramL_out,
+                ARParam *paramR_out,
+                ARdouble transL2R_out[3][4],
+                ARdouble *errL_out,
+                ARdouble *errR_out,
+                ARdouble *errStereo_out,
+                Calibration::IntrinsicsEstimate *estimateL = NULL,
+                Calibration::IntrinsicsEstimate *estimateR = NULL);
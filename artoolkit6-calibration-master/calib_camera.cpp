@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
 #ifdef _WIN32
 #  include <windows.h>
 #  define MAXPATHLEN MAX_PATH
@@ -56,6 +57,11 @@
 
 #include "fileUploader.h"
 #include "Calibration.hpp"
+#include "StereoCalibration.hpp"
+#include "FrameSequence.hpp"
+#include "UndistortMap.hpp"
+#include "UndistortPreview.hpp"
+#include "LatencyStats.hpp"
 #include "flow.hpp"
 #include "Eden/EdenMessage.h"
 #include "Eden/EdenGLFont.h"
@@ -77,7 +83,11 @@
 #define      CHESSBOARD_CORNER_NUM_Y        5
 #define      CHESSBOARD_PATTERN_WIDTH      30.0
 #define      CALIB_IMAGE_NUM               10
+#define      CORNER_FINDER_WORKER_NUM       0 // 0 = one per CPU core, less one for the main thread.
 #define      SAVE_FILENAME                 "camera_para.dat"
+#define      CALIB_UNCERTAINTY_SAMPLES     32 // Bootstrap resamples for the standard deviations of the camera parameters. 0 to disable.
+#define      SEQUENCE_RECORD_COMPRESS      false // zlib on the main thread can take longer than a frame interval at HD sizes.
+#define      UNDISTORT_MAP_SAVE_INVERSE    true
 
 // Data upload.
 #define QUEUE_DIR "queue"
@@ -116,6 +126,7 @@ unsigned char *MD5(const unsigned char *d, size_t n, unsigned char *md);
 // Prefs.
 static void *gPreferences = NULL;
 Uint32 gSDLEventPreferencesChanged = 0;
+Uint32 gSDLEventPreferencesModal = 0;
 static char *gPreferenceCameraOpenToken = NULL;
 static char *gPreferenceCameraResolutionToken = NULL;
 static bool gCalibrationSave = false;
@@ -123,6 +134,8 @@ static char *gCalibrationSaveDir = NULL;
 static char *gCalibrationServerUploadURL = NULL;
 static char *gCalibrationServerAuthenticationToken = NULL;
 static int gPreferencesCalibImageCountMax = CALIB_IMAGE_NUM;
+static int gPreferencesCalibViewSubsetCount = 0; // 0 calibrates with every captured view.
+static int gPreferencesCornerFinderWorkerCount = CORNER_FINDER_WORKER_NUM;
 static Calibration::CalibrationPatternType gCalibrationPatternType;
 static cv::Size gCalibrationPatternSize;
 static float gCalibrationPatternSpacing;
@@ -131,7 +144,66 @@ static float gCalibrationPatternSpacing;
 // Calibration.
 //
 
-static Calibration *gCalibration = nullptr;
+static bool gAutoCapture = false;
+static Calibration::CornerFinderPool *gCornerFinderPool = nullptr; // Shared by the calibrations of all sessions.
+
+// Live undistorted preview of the camera stream through the latest calibration, shown once calibration is done.
+typedef enum {
+    PREVIEW_MODE_OFF = 0,
+    PREVIEW_MODE_WIPE, // Undistorted to the right of a movable divider, original to the left.
+    PREVIEW_MODE_SIDE_BY_SIDE,
+    PREVIEW_MODE_COUNT
+} PREVIEW_MODE;
+static PREVIEW_MODE gPreviewMode = PREVIEW_MODE_WIPE;
+static float gPreviewWipe = 0.5f; // Position of the divider, as a fraction of the view width.
+
+// One camera being calibrated. Each session has its own video source, calibration, flow, and tile of the window.
+// All sessions share the corner finder pool and the upload queue. The first is the camera chosen in the settings,
+// and the rest are given on the command line with --camera.
+struct CameraSession {
+    int                  index; // Also the camera index of its saved and uploaded calibrations.
+    char                *vconf; // Video configuration, or NULL for the camera chosen in the settings.
+    ARVideoSource       *vs;
+    ARView              *vv;
+    bool                 postVideoSetupDone;
+    bool                 cameraIsFrontFacing;
+    int32_t              tile[4]; // The session's part of the window, {x, y, width, height}.
+    int32_t              viewport[4]; // Where its video is drawn, within the tile.
+    AR2VideoTimestampT   displayLastTimestamp; // Of the last frame drawn straight from the video source, when tiled.
+    Calibration         *calibration;
+    Flow                *flow;
+    ARGL_CONTEXT_SETTINGS_REF arglSettingsCornerFinderImage; // Corner finder results copy, for display to user.
+    // Undistorted preview.
+    UndistortPreview    *undistortPreview;
+    ARParam              undistortPreviewParam;
+    bool                 undistortPreviewParamPending; // Set by saveParam() (on the flow thread); guarded by undistortPreviewLock.
+    pthread_mutex_t      undistortPreviewLock;
+    AR2VideoTimestampT   undistortPreviewLastTimestamp;
+    ARGL_CONTEXT_SETTINGS_REF arglSettingsPreviewImage;
+    // Left by drawSessionImage() for drawSessionOverlay().
+    Calibration::CornerFinderResultInfo cornerFinderResultInfo;
+    Calibration::CornerFinderResultInfo cornerFinderResultInfoR; // Of the right camera, in stereo mode.
+    bool                 previewShown;
+};
+static std::vector<CameraSession *> gSessions;
+static int gSessionActive = 0; // The session which keyboard input goes to.
+
+// Stereo mode, with a single session. The session's camera is the left camera, and the right camera is opened with
+// gStereoVconfR. Both cameras' streams are searched for the pattern continuously, and shown side by side.
+static char *gStereoVconfR = NULL;
+static StereoCalibration *gStereoCalibration = nullptr;
+static ARVideoSource *vsR = nullptr;
+static bool gVideoRFrameSeen = false;
+static ARGL_CONTEXT_SETTINGS_REF gArglSettingsCornerFinderImageR = NULL;
+
+// Recording of the camera's luma frames, for replay through a FrameSequenceReader.
+static FrameSequenceWriter *gSequenceRecorder = nullptr;
+static CameraSession *gSequenceRecorderSession = nullptr;
+static AR2VideoTimestampT gSequenceRecorderLastTimestamp = {0, 0};
+
+// Pipeline latency statistics.
+static bool gLatencyStatsShow = false;
+static char *gLatencyStatsPath = NULL; // If set, statistics are written here on exit.
 
 //
 // Data upload.
@@ -141,11 +213,7 @@ static char *gFileUploadQueuePath = NULL;
 FILE_UPLOAD_HANDLE_t *fileUploadHandle = NULL;
 
 // Video acquisition and rendering.
-static ARVideoSource *vs = nullptr;
-static ARView *vv = nullptr;
-static bool gPostVideoSetupDone = false;
-static bool gCameraIsFrontFacing = false;
-static long gFrameCount = 0;
+static long gFrameCount = 0; // Of the first session.
 
 // Window and GL context.
 static SDL_GLContext gSDLContext = NULL;
@@ -153,16 +221,12 @@ static int contextWidth = 0;
 static int contextHeight = 0;
 static bool contextWasUpdated = false;
 static SDL_Window* gSDLWindow = NULL;
-static int32_t gViewport[4] = {0, 0, 0, 0}; // {x, y, width, height}
 static int gDisplayOrientation = 1; // range [0-3]. 1=landscape.
 static float gDisplayDPI = 72.0f;
 
 // Main state.
 static struct timeval gStartTime;
 
-// Corner finder results copy, for display to user.
-static ARGL_CONTEXT_SETTINGS_REF gArglSettingsCornerFinderImage = NULL;
-
 // ============================================================================
 //	Function prototypes
 // ============================================================================
@@ -172,47 +236,202 @@ static void reshape(int w, int h);
 static void drawView(void);
 
 //static void          init(int argc, char *argv[]);
-//static void          usage(char *com);
+static void usage(char *com);
 static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, void *userdata);
+static void saveStereoParam(const ARParam *paramL, const ARParam *paramR, ARdouble transL2R[3][4], ARdouble errL, ARdouble errR, ARdouble errStereo, void *userdata);
+
+static CameraSession *sessionNew(const int index, const char *vconf)
+{
+    CameraSession *session = new CameraSession;
+    session->index = index;
+    session->vconf = (vconf ? strdup(vconf) : NULL);
+    session->vs = nullptr;
+    session->vv = nullptr;
+    session->postVideoSetupDone = false;
+    session->cameraIsFrontFacing = false;
+    for (int i = 0; i < 4; i++) session->tile[i] = session->viewport[i] = 0;
+    session->displayLastTimestamp = {0, 0};
+    session->calibration = nullptr;
+    session->flow = nullptr;
+    session->arglSettingsCornerFinderImage = NULL;
+    session->undistortPreview = nullptr;
+    session->undistortPreviewParamPending = false;
+    pthread_mutex_init(&session->undistortPreviewLock, NULL);
+    session->undistortPreviewLastTimestamp = {0, 0};
+    session->arglSettingsPreviewImage = NULL;
+    session->previewShown = false;
+    return session;
+}
+
+static void sessionDelete(CameraSession **session_p)
+{
+    pthread_mutex_destroy(&(*session_p)->undistortPreviewLock);
+    free((*session_p)->vconf);
+    delete *session_p;
+    *session_p = nullptr;
+}
+
+// The session's part of the window: all of it for a single camera, otherwise a cell of a grid, filled from the top left.
+static void sessionTile(const int index, int32_t tile[4])
+{
+    const int count = (int)gSessions.size();
+    int columns = 1;
+    while (columns*columns < count) columns++;
+    const int rows = (count + columns - 1) / columns;
+    tile[2] = contextWidth / columns;
+    tile[3] = contextHeight / rows;
+    tile[0] = (index % columns) * tile[2];
+    tile[1] = contextHeight - (index / columns + 1) * tile[3];
+}
+
+// Fit an image of the given size into area, keeping its aspect ratio, and centred.
+static void fitViewport(const int32_t area[4], const int videoWidth, const int videoHeight, const bool rotate90, int32_t viewport[4])
+{
+    const float w = (float)(rotate90 ? videoHeight : videoWidth);
+    const float h = (float)(rotate90 ? videoWidth : videoHeight);
+    const float scale = MIN((float)area[2] / w, (float)area[3] / h);
+    viewport[2] = (int32_t)(w * scale);
+    viewport[3] = (int32_t)(h * scale);
+    viewport[0] = area[0] + (area[2] - viewport[2]) / 2;
+    viewport[1] = area[1] + (area[3] - viewport[3]) / 2;
+}
+
+// Place the session's video in its tile. A single camera keeps the layout ARView gives it.
+static void sessionLayout(CameraSession *session)
+{
+    sessionTile(session->index, session->tile);
+    if (gSessions.size() == 1) {
+        session->vv->setContextSize({contextWidth, contextHeight});
+        session->vv->getViewport(session->viewport);
+    } else {
+        fitViewport(session->tile, session->vs->getVideoWidth(), session->vs->getVideoHeight(), session->vv->rotate90(), session->viewport);
+    }
+}
 
 static void startVideo(void)
 {
     char buf[256];
     snprintf(buf, sizeof(buf), "%s %s", (gPreferenceCameraOpenToken ? gPreferenceCameraOpenToken : ""), (gPreferenceCameraResolutionToken ? gPreferenceCameraResolutionToken : ""));
     
-    vs = new ARVideoSource;
-    if (!vs) {
-        ARLOGe("Error: Unable to create video source.\n");
-        quit(-1);
-    } else {
-        vs->configure(buf, true, NULL, NULL, 0);
-        if (!vs->open()) {
-            ARLOGe("Error: Unable to open video source.\n");
-            EdenMessageShow((const unsigned char *)"Welcome to ARToolKit Camera Calibrator\n(c)2017 DAQRI LLC.\n\nUnable to open video source.\n\nPress 'p' for settings and help.");
+    EdenMessageHide(); // Any message from a previous failure to open.
+    for (CameraSession *session : gSessions) {
+        session->vs = new ARVideoSource;
+        if (!session->vs) {
+            ARLOGe("Error: Unable to create video source.\n");
+            quit(-1);
+        } else {
+            session->vs->configure((session->vconf ? session->vconf : buf), true, NULL, NULL, 0);
+            if (!session->vs->open()) {
+                if (gSessions.size() == 1) {
+                    ARLOGe("Error: Unable to open video source.\n");
+                    EdenMessageShow((const unsigned char *)"Welcome to ARToolKit Camera Calibrator\n(c)2017 DAQRI LLC.\n\nUnable to open video source.\n\nPress 'p' for settings and help.");
+                } else {
+                    ARLOGe("Error: Unable to open video source for camera %d.\n", session->index + 1);
+                    char message[128];
+                    snprintf(message, sizeof(message), "Welcome to ARToolKit Camera Calibrator\n(c)2017 DAQRI LLC.\n\nUnable to open video source for camera %d.\n\nPress 'p' for settings and help.", session->index + 1);
+                    EdenMessageShow((const unsigned char *)message);
+                }
+            }
         }
+        session->postVideoSetupDone = false;
+    }
+    
+    if (gStereoVconfR) {
+        vsR = new ARVideoSource;
+        if (!vsR) {
+            ARLOGe("Error: Unable to create right video source.\n");
+            quit(-1);
+        }
+        vsR->configure(gStereoVconfR, true, NULL, NULL, 0);
+        if (!vsR->open()) {
+            ARLOGe("Error: Unable to open right video source.\n");
+            EdenMessageShow((const unsigned char *)"Welcome to ARToolKit Camera Calibrator\n(c)2017 DAQRI LLC.\n\nUnable to open right video source.\n\nPress 'p' for settings and help.");
+        }
+        gVideoRFrameSeen = false;
     }
-    gPostVideoSetupDone = false;
 }
 
-static void stopVideo(void)
+static void recordStart(CameraSession *session)
 {
-    // Stop calibration flow.
-    flowStopAndFinal();
+    char path[MAXPATHLEN];
+    char timestamp[32];
+    time_t now = time(NULL);
+    if (!strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", localtime(&now))) timestamp[0] = '\0';
+    snprintf(path, sizeof(path), "%s/sequence-%s-%dx%d." FRAME_SEQUENCE_EXTENSION, (gCalibrationSaveDir ? gCalibrationSaveDir : "."), timestamp, session->vs->getVideoWidth(), session->vs->getVideoHeight());
     
-    if (gCalibration) {
-        delete gCalibration;
-        gCalibration = nullptr;
+    gSequenceRecorder = new FrameSequenceWriter;
+    if (!gSequenceRecorder->open(path, session->vs->getVideoWidth(), session->vs->getVideoHeight(), SEQUENCE_RECORD_COMPRESS)) {
+        delete gSequenceRecorder;
+        gSequenceRecorder = nullptr;
+        return;
     }
+    gSequenceRecorderSession = session;
+    gSequenceRecorderLastTimestamp = {0, 0};
+    ARLOGi("Recording frames to '%s'.\n", path);
+}
+
+static void recordStop(void)
+{
+    if (!gSequenceRecorder) return;
+    int frameCount = gSequenceRecorder->frameCount();
+    if (gSequenceRecorder->close()) ARLOGi("Recorded %d frames.\n", frameCount);
+    delete gSequenceRecorder;
+    gSequenceRecorder = nullptr;
+    gSequenceRecorderSession = nullptr;
+}
+
+static void recordFrame(void)
+{
+    ARVideoSource *vs = gSequenceRecorderSession->vs;
+    AR2VideoBufferT *buff = vs->checkoutFrameIfNewerThan(gSequenceRecorderLastTimestamp);
+    if (!buff) return;
+    gSequenceRecorderLastTimestamp = buff->time;
+    if (!gSequenceRecorder->append(buff->buffLuma, buff->time)) recordStop();
+    vs->checkinFrame();
+}
+
+static void stopVideo(void)
+{
+    recordStop();
     
-    if (gArglSettingsCornerFinderImage) {
-        arglCleanup(gArglSettingsCornerFinderImage); // Clean up any left-over ARGL data.
-        gArglSettingsCornerFinderImage = NULL;
+    for (CameraSession *session : gSessions) {
+        
+        // Stop calibration flow.
+        delete session->flow;
+        session->flow = nullptr;
+        
+        delete session->calibration;
+        session->calibration = nullptr;
+        
+        if (session->arglSettingsCornerFinderImage) {
+            arglCleanup(session->arglSettingsCornerFinderImage); // Clean up any left-over ARGL data.
+            session->arglSettingsCornerFinderImage = NULL;
+        }
+        
+        delete session->undistortPreview; // Its calibration is for this video source's resolution.
+        session->undistortPreview = nullptr;
+        session->undistortPreviewParamPending = false;
+        if (session->arglSettingsPreviewImage) {
+            arglCleanup(session->arglSettingsPreviewImage);
+            session->arglSettingsPreviewImage = NULL;
+        }
+        
+        delete session->vv;
+        session->vv = nullptr;
+        delete session->vs;
+        session->vs = nullptr;
     }
     
-    delete vv;
-    vv = nullptr;
-    delete vs;
-    vs = nullptr;
+    if (gStereoCalibration) {
+        delete gStereoCalibration;
+        gStereoCalibration = nullptr;
+    }
+    if (gArglSettingsCornerFinderImageR) {
+        arglCleanup(gArglSettingsCornerFinderImageR);
+        gArglSettingsCornerFinderImageR = NULL;
+    }
+    delete vsR;
+    vsR = nullptr;
 }
 
 static void rereadPreferences(void)
@@ -282,11 +501,267 @@ static void rereadPreferences(void)
     }
 }
 
+// Set up a session once its camera has delivered its first frame.
+static void sessionSetup(CameraSession *session)
+{
+    ARVideoSource *vs = session->vs;
+    
+    session->cameraIsFrontFacing = false;
+    AR2VideoParamT *vid = vs->getAR2VideoParam();
+    
+    if (vid->module == AR_VIDEO_MODULE_AVFOUNDATION) {
+        int frontCamera;
+        if (ar2VideoGetParami(vid, AR_VIDEO_PARAM_AVFOUNDATION_CAMERA_POSITION, &frontCamera) >= 0) {
+            session->cameraIsFrontFacing = (frontCamera == AR_VIDEO_AVFOUNDATION_CAMERA_POSITION_FRONT);
+        }
+    }
+    bool contentRotate90, contentFlipV, contentFlipH;
+    if (gDisplayOrientation == 1) { // Landscape with top of device at left.
+        contentRotate90 = false;
+        contentFlipV = session->cameraIsFrontFacing;
+        contentFlipH = session->cameraIsFrontFacing;
+    } else if (gDisplayOrientation == 2) { // Portrait upside-down.
+        contentRotate90 = true;
+        contentFlipV = !session->cameraIsFrontFacing;
+        contentFlipH = true;
+    } else if (gDisplayOrientation == 3) { // Landscape with top of device at right.
+        contentRotate90 = false;
+        contentFlipV = !session->cameraIsFrontFacing;
+        contentFlipH = (!session->cameraIsFrontFacing);
+    } else /*(gDisplayOrientation == 0)*/ { // Portait
+        contentRotate90 = true;
+        contentFlipV = session->cameraIsFrontFacing;
+        contentFlipH = false;
+    }
+    
+    // Setup a route for rendering the colour background image.
+    session->vv = new ARView;
+    if (!session->vv) {
+        ARLOGe("Error: unable to create video view.\n");
+        quit(-1);
+    }
+    session->vv->setRotate90(contentRotate90);
+    session->vv->setFlipH(contentFlipH);
+    session->vv->setFlipV(contentFlipV);
+    session->vv->setScalingMode(ARView::ScalingMode::SCALE_MODE_FIT);
+    session->vv->initWithVideoSource(*vs, contextWidth, contextHeight);
+    ARLOGi("Content %dx%d (wxh) will display in GL context %dx%d%s.\n", vs->getVideoWidth(), vs->getVideoHeight(), contextWidth, contextHeight, (contentRotate90 ? " rotated" : ""));
+    sessionLayout(session);
+    
+    // Setup a route for rendering the mono background image.
+    ARParam idealParam;
+    arParamClear(&idealParam, vs->getVideoWidth(), vs->getVideoHeight(), AR_DIST_FUNCTION_VERSION_DEFAULT);
+    if ((session->arglSettingsCornerFinderImage = arglSetupForCurrentContext(&idealParam, AR_PIXEL_FORMAT_MONO)) == NULL) {
+        ARLOGe("Unable to setup argl.\n");
+        quit(-1);
+    }
+    if (!arglDistortionCompensationSet(session->arglSettingsCornerFinderImage, FALSE)) {
+        ARLOGe("Unable to setup argl.\n");
+        quit(-1);
+    }
+    arglSetRotate90(session->arglSettingsCornerFinderImage, contentRotate90);
+    arglSetFlipV(session->arglSettingsCornerFinderImage, contentFlipV);
+    arglSetFlipH(session->arglSettingsCornerFinderImage, contentFlipH);
+    
+    // And for the undistorted preview image.
+    if ((session->arglSettingsPreviewImage = arglSetupForCurrentContext(&idealParam, AR_PIXEL_FORMAT_MONO)) == NULL) {
+        ARLOGe("Unable to setup argl.\n");
+        quit(-1);
+    }
+    if (!arglDistortionCompensationSet(session->arglSettingsPreviewImage, FALSE)) {
+        ARLOGe("Unable to setup argl.\n");
+        quit(-1);
+    }
+    arglSetRotate90(session->arglSettingsPreviewImage, contentRotate90);
+    arglSetFlipV(session->arglSettingsPreviewImage, contentFlipV);
+    arglSetFlipH(session->arglSettingsPreviewImage, contentFlipH);
+    
+    //
+    // Calibration init.
+    //
+    
+    if (vsR) {
+        
+        // The right camera's image, shown beside the left.
+        ARParam idealParamR;
+        arParamClear(&idealParamR, vsR->getVideoWidth(), vsR->getVideoHeight(), AR_DIST_FUNCTION_VERSION_DEFAULT);
+        if ((gArglSettingsCornerFinderImageR = arglSetupForCurrentContext(&idealParamR, AR_PIXEL_FORMAT_MONO)) == NULL) {
+            ARLOGe("Unable to setup argl.\n");
+            quit(-1);
+        }
+        if (!arglDistortionCompensationSet(gArglSettingsCornerFinderImageR, FALSE)) {
+            ARLOGe("Unable to setup argl.\n");
+            quit(-1);
+        }
+        arglSetRotate90(gArglSettingsCornerFinderImageR, contentRotate90);
+        arglSetFlipV(gArglSettingsCornerFinderImageR, contentFlipV);
+        arglSetFlipH(gArglSettingsCornerFinderImageR, contentFlipH);
+        ARLOGi("Stereo: right camera %dx%d (wxh).\n", vsR->getVideoWidth(), vsR->getVideoHeight());
+        
+        gStereoCalibration = new StereoCalibration(gCalibrationPatternType, gPreferencesCalibImageCountMax, gCalibrationPatternSize, gCalibrationPatternSpacing, vs->getVideoWidth(), vs->getVideoHeight(), vsR->getVideoWidth(), vsR->getVideoHeight(), gPreferencesCornerFinderWorkerCount);
+        if (!gStereoCalibration) {
+            ARLOGe("Error initialising stereo calibration.\n");
+            quit(-1);
+        }
+        gStereoCalibration->setAutoCaptureEnabled(gAutoCapture);
+        
+        session->flow = new Flow(gStereoCalibration, saveStereoParam, NULL);
+        
+    } else {
+        
+        session->calibration = new Calibration(gCalibrationPatternType, gPreferencesCalibImageCountMax, gCalibrationPatternSize, gCalibrationPatternSpacing, vs->getVideoWidth(), vs->getVideoHeight(), gCornerFinderPool);
+        if (!session->calibration) {
+            ARLOGe("Error initialising calibration.\n");
+            quit(-1);
+        }
+        session->calibration->setAutoCaptureEnabled(gAutoCapture);
+        session->calibration->setCalibUncertainty(Calibration::UncertaintyMethod::BOOTSTRAP, CALIB_UNCERTAINTY_SAMPLES);
+        session->calibration->setCalibViewSubsetCount(gPreferencesCalibViewSubsetCount);
+        
+        session->flow = new Flow(session->calibration, saveParam, session);
+    }
+    if (!session->flow || !session->flow->start()) {
+        ARLOGe("Error: Could not initialise and start flow.\n");
+        quit(-1);
+    }
+    
+    // For FPS statistics.
+    if (session->index == 0) {
+        arUtilTimerReset();
+        gFrameCount = 0;
+    }
+    
+    session->postVideoSetupDone = true;
+}
+
+// Process the session's latest frame, if its camera has delivered a new one.
+static void sessionUpdate(CameraSession *session)
+{
+    ARVideoSource *vs = session->vs;
+    
+    if (!vs->isOpen() || (vsR && !gVideoRFrameSeen)) return;
+    if (!vs->captureFrame()) return;
+    
+    if (session->index == 0) {
+        gFrameCount++; // Increment ARToolKit FPS counter.
+#ifdef DEBUG
+        if (gFrameCount % 150 == 0) {
+            ARLOGi("*** Camera - %f (frame/sec)\n", (double)gFrameCount/arUtilTimer());
+            for (CameraSession *s : gSessions) {
+                if (s->calibration) ARLOGi("*** Corner finder %d - %lu submitted, %lu dropped, ROI hit rate %.2f, track hit rate %.2f, %lu blurred\n", s->index + 1, s->calibration->frameSubmittedCount(), s->calibration->frameDroppedCount(), s->calibration->roiHitRate(), s->calibration->trackHitRate(), s->calibration->frameBlurredCount());
+            }
+            gFrameCount = 0;
+            arUtilTimerReset();
+        }
+#endif
+    }
+    
+    if (!session->postVideoSetupDone) sessionSetup(session);
+    
+    if (gSequenceRecorder && gSequenceRecorderSession == session) recordFrame();
+    
+    // Pick up a new calibration for the undistorted preview.
+    pthread_mutex_lock(&session->undistortPreviewLock);
+    if (session->undistortPreviewParamPending) {
+        session->undistortPreviewParamPending = false;
+        if (!session->undistortPreview) session->undistortPreview = new UndistortPreview;
+        if (!session->undistortPreview->start(&session->undistortPreviewParam)) {
+            delete session->undistortPreview;
+            session->undistortPreview = nullptr;
+        }
+        session->undistortPreviewLastTimestamp = {0, 0};
+    }
+    pthread_mutex_unlock(&session->undistortPreviewLock);
+    
+    FLOW_STATE state = session->flow->state();
+    if (gStereoCalibration) {
+        
+        // Both streams are searched in every state, as both cameras' images are drawn from the results.
+        // Each has its own corner finders, so neither waits for the other.
+        gStereoCalibration->frame(vs, vsR);
+        
+    } else if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
+        
+        // Upload the frame to OpenGL.
+        // Now done as part of the draw call.
+        
+        // Pass new frames to the undistorted preview. Frames arriving while it is busy are dropped.
+        if (state == FLOW_STATE_DONE && session->undistortPreview && gPreviewMode != PREVIEW_MODE_OFF) {
+            AR2VideoBufferT *buff = vs->checkoutFrameIfNewerThan(session->undistortPreviewLastTimestamp);
+            if (buff) {
+                session->undistortPreviewLastTimestamp = buff->time;
+                session->undistortPreview->submit(buff->buffLuma);
+                vs->checkinFrame();
+            }
+        }
+        
+    } else if (state == FLOW_STATE_CAPTURING) {
+        
+        // A new run. The preview of the last calibration no longer applies.
+        if (session->undistortPreview) {
+            delete session->undistortPreview;
+            session->undistortPreview = nullptr;
+        }
+        
+        session->calibration->frame(vs);
+        
+    }
+    
+    // With automatic capture on, the pattern is also looked for while waiting to begin the first run, so that
+    // presenting it begins the run. Once a run is done, the next must be begun with a press (see Flow::run()).
+    if (session->calibration) {
+        if (state == FLOW_STATE_WELCOME && gAutoCapture) session->calibration->frame(vs);
+        if (session->calibration->autoCaptureReady()) session->flow->handleEvent(EVENT_AUTO_CAPTURE);
+    } else if (gStereoCalibration) {
+        if (gStereoCalibration->autoCaptureReady()) session->flow->handleEvent(EVENT_AUTO_CAPTURE);
+    }
+}
+
+// The session whose tile contains the window point (x, y), or -1.
+static int sessionAtPoint(const int x, const int y)
+{
+    int w, h;
+    SDL_GetWindowSize(gSDLWindow, &w, &h);
+    if (w <= 0 || h <= 0) return -1;
+    // Window points to drawable pixels, with y up.
+    const int32_t px = (int32_t)((float)x * (float)contextWidth / (float)w);
+    const int32_t py = contextHeight - (int32_t)((float)y * (float)contextHeight / (float)h);
+    for (CameraSession *session : gSessions) {
+        int32_t tile[4];
+        sessionTile(session->index, tile);
+        if (px >= tile[0] && px < tile[0] + tile[2] && py >= tile[1] && py < tile[1] + tile[3]) return session->index;
+    }
+    return -1;
+}
+
 int main(int argc, char *argv[])
 {
 #ifdef DEBUG
     arLogLevel = AR_LOG_LEVEL_DEBUG;
 #endif
+    
+    std::vector<const char *> cameraVconfs; // Cameras after the first.
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--latency-stats") == 0 && i + 1 < argc) {
+            gLatencyStatsPath = strdup(argv[++i]);
+        } else if (strcmp(argv[i], "--stereo") == 0 && i + 1 < argc) {
+            gStereoVconfR = strdup(argv[++i]);
+        } else if (strcmp(argv[i], "--camera") == 0 && i + 1 < argc) {
+            cameraVconfs.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--calib-views") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d", &gPreferencesCalibViewSubsetCount) != 1 || gPreferencesCalibViewSubsetCount < 0) usage(argv[0]);
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0]);
+        }
+    }
+    if (gStereoVconfR && !cameraVconfs.empty()) {
+        ARLOGe("Error: --stereo calibrates a single stereo pair, and cannot be used with --camera.\n");
+        return -1;
+    }
+    
+    // One session for the camera chosen in the settings, and one for each further camera.
+    gSessions.push_back(sessionNew(0, NULL));
+    for (const char *vconf : cameraVconfs) gSessions.push_back(sessionNew((int)gSessions.size(), vconf));
 
     // Initialize SDL.
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -307,6 +782,7 @@ int main(int argc, char *argv[])
     gCalibrationPatternSpacing = getPreferencesCalibrationPatternSpacing(gPreferences);
     
     gSDLEventPreferencesChanged = SDL_RegisterEvents(1);
+    gSDLEventPreferencesModal = SDL_RegisterEvents(1);
     
     // Create a window.
     gSDLWindow = SDL_CreateWindow("ARToolKit6 Camera Calibration Utility",
@@ -354,6 +830,11 @@ int main(int argc, char *argv[])
     ARLOGi("Calbration pattern size Y = %d\n", gCalibrationPatternSize.height);
     ARLOGi("Calbration pattern spacing = %f\n", gCalibrationPatternSpacing);
     ARLOGi("Calibration image count maximum = %d\n", gPreferencesCalibImageCountMax);
+    if (gPreferencesCalibViewSubsetCount > 0) ARLOGi("Calibrating with at most %d views.\n", gPreferencesCalibViewSubsetCount);
+    if (gSessions.size() > 1) ARLOGi("Calibrating %d cameras.\n", (int)gSessions.size());
+    
+    // The corner finders of all sessions run on one pool of threads. Stereo calibration has its own, per camera.
+    if (!gStereoVconfR) gCornerFinderPool = new Calibration::CornerFinderPool(gPreferencesCornerFinderWorkerCount);
     
     // Library setup.
     int contextsActiveCount = 1;
@@ -373,6 +854,7 @@ int main(int argc, char *argv[])
         
         SDL_Event ev;
         while (SDL_PollEvent(&ev)) {
+            CameraSession *active = gSessions[gSessionActive];
             if (ev.type == SDL_QUIT /*|| (ev.type == SDL_KEYDOWN && ev.key.keysym.sym == SDLK_ESCAPE)*/) {
                 done = true;
                 break;
@@ -389,128 +871,67 @@ int main(int argc, char *argv[])
                 if (gEdenMessageKeyboardRequired) {
                     EdenMessageInputKeyboard(ev.key.keysym.sym);
                 } else if (ev.key.keysym.sym == SDLK_ESCAPE) {
-                    flowHandleEvent(EVENT_BACK_BUTTON);
+                    if (active->flow) active->flow->handleEvent(EVENT_BACK_BUTTON);
                 } else if (ev.key.keysym.sym == SDLK_SPACE) {
-                    flowHandleEvent(EVENT_TOUCH);
+                    if (active->flow) active->flow->handleEvent(EVENT_TOUCH);
+                } else if (ev.key.keysym.sym == SDLK_TAB) {
+                    gSessionActive = (gSessionActive + 1) % (int)gSessions.size();
+                } else if (ev.key.keysym.sym == SDLK_a) {
+                    gAutoCapture = !gAutoCapture;
+                    for (CameraSession *session : gSessions) {
+                        if (session->calibration) session->calibration->setAutoCaptureEnabled(gAutoCapture);
+                    }
+                    if (gStereoCalibration) gStereoCalibration->setAutoCaptureEnabled(gAutoCapture);
+                    ARLOGi("Automatic capture %s.\n", (gAutoCapture ? "on" : "off"));
+                } else if (ev.key.keysym.sym == SDLK_f) {
+                    if (active->flow) active->flow->handleEvent(EVENT_FINISH);
+                } else if (ev.key.keysym.sym == SDLK_u) {
+                    gPreviewMode = (PREVIEW_MODE)((gPreviewMode + 1) % PREVIEW_MODE_COUNT);
+                } else if (ev.key.keysym.sym == SDLK_LEFT) {
+                    gPreviewWipe = std::max(gPreviewWipe - 0.05f, 0.0f);
+                } else if (ev.key.keysym.sym == SDLK_RIGHT) {
+                    gPreviewWipe = std::min(gPreviewWipe + 0.05f, 1.0f);
+                } else if (ev.key.keysym.sym == SDLK_s) {
+                    gLatencyStatsShow = !gLatencyStatsShow;
+                } else if (ev.key.keysym.sym == SDLK_r) {
+                    if (gSequenceRecorder) recordStop();
+                    else if (active->vs && active->vs->isOpen() && active->postVideoSetupDone) recordStart(active);
                 } else if ((ev.key.keysym.sym == SDLK_COMMA && (ev.key.keysym.mod & KMOD_LGUI)) || ev.key.keysym.sym == SDLK_p) {
                     showPreferences(gPreferences);
                 }
+            } else if (ev.type == SDL_MOUSEBUTTONDOWN && ev.button.button == SDL_BUTTON_LEFT && gSessions.size() > 1) {
+                // Click a camera's tile to direct keyboard input to it.
+                int index = sessionAtPoint(ev.button.x, ev.button.y);
+                if (index != -1) gSessionActive = index;
+            } else if (ev.type == SDL_MOUSEMOTION && (ev.motion.state & SDL_BUTTON_LMASK) && gPreviewMode == PREVIEW_MODE_WIPE) {
+                // Drag to move the wipe divider, across the active camera's tile.
+                int w, h;
+                SDL_GetWindowSize(gSDLWindow, &w, &h);
+                if (w > 0 && active->tile[2] > 0) {
+                    const float x = (float)ev.motion.x * (float)contextWidth / (float)w;
+                    gPreviewWipe = std::min(std::max((x - (float)active->tile[0]) / (float)active->tile[2], 0.0f), 1.0f);
+                }
+            } else if (gSDLEventPreferencesModal != 0 && ev.type == gSDLEventPreferencesModal) {
+                // The settings dialog opening or closing. Every session's flow waits for it to close.
+                for (CameraSession *session : gSessions) {
+                    if (session->flow) session->flow->handleEvent(EVENT_MODAL);
+                }
             } else if (gSDLEventPreferencesChanged != 0 && ev.type == gSDLEventPreferencesChanged) {
                 rereadPreferences();
             }
         }
         
-        if (vs->isOpen()) {
-            if (vs->captureFrame()) {
-                gFrameCount++; // Increment ARToolKit FPS counter.
-#ifdef DEBUG
-                if (gFrameCount % 150 == 0) {
-                    ARLOGi("*** Camera - %f (frame/sec)\n", (double)gFrameCount/arUtilTimer());
-                    gFrameCount = 0;
-                    arUtilTimerReset();
-                }
-#endif
-                if (!gPostVideoSetupDone) {
-                    
-                    gCameraIsFrontFacing = false;
-                    AR2VideoParamT *vid = vs->getAR2VideoParam();
-                    
-                    if (vid->module == AR_VIDEO_MODULE_AVFOUNDATION) {
-                        int frontCamera;
-                        if (ar2VideoGetParami(vid, AR_VIDEO_PARAM_AVFOUNDATION_CAMERA_POSITION, &frontCamera) >= 0) {
-                            gCameraIsFrontFacing = (frontCamera == AR_VIDEO_AVFOUNDATION_CAMERA_POSITION_FRONT);
-                        }
-                    }
-                    bool contentRotate90, contentFlipV, contentFlipH;
-                    if (gDisplayOrientation == 1) { // Landscape with top of device at left.
-                        contentRotate90 = false;
-                        contentFlipV = gCameraIsFrontFacing;
-                        contentFlipH = gCameraIsFrontFacing;
-                    } else if (gDisplayOrientation == 2) { // Portrait upside-down.
-                        contentRotate90 = true;
-                        contentFlipV = !gCameraIsFrontFacing;
-                        contentFlipH = true;
-                    } else if (gDisplayOrientation == 3) { // Landscape with top of device at right.
-                        contentRotate90 = false;
-                        contentFlipV = !gCameraIsFrontFacing;
-                        contentFlipH = (!gCameraIsFrontFacing);
-                    } else /*(gDisplayOrientation == 0)*/ { // Portait
-                        contentRotate90 = true;
-                        contentFlipV = gCameraIsFrontFacing;
-                        contentFlipH = false;
-                    }
-                    
-                    // Setup a route for rendering the colour background image.
-                    vv = new ARView;
-                    if (!vv) {
-                        ARLOGe("Error: unable to create video view.\n");
-                        quit(-1);
-                    }
-                    vv->setRotate90(contentRotate90);
-                    vv->setFlipH(contentFlipH);
-                    vv->setFlipV(contentFlipV);
-                    vv->setScalingMode(ARView::ScalingMode::SCALE_MODE_FIT);
-                    vv->initWithVideoSource(*vs, contextWidth, contextHeight);
-                    ARLOGi("Content %dx%d (wxh) will display in GL context %dx%d%s.\n", vs->getVideoWidth(), vs->getVideoHeight(), contextWidth, contextHeight, (contentRotate90 ? " rotated" : ""));
-                    vv->getViewport(gViewport);
-                    
-                    // Setup a route for rendering the mono background image.
-                    ARParam idealParam;
-                    arParamClear(&idealParam, vs->getVideoWidth(), vs->getVideoHeight(), AR_DIST_FUNCTION_VERSION_DEFAULT);
-                    if ((gArglSettingsCornerFinderImage = arglSetupForCurrentContext(&idealParam, AR_PIXEL_FORMAT_MONO)) == NULL) {
-                        ARLOGe("Unable to setup argl.\n");
-                        quit(-1);
-                    }
-                    if (!arglDistortionCompensationSet(gArglSettingsCornerFinderImage, FALSE)) {
-                        ARLOGe("Unable to setup argl.\n");
-                        quit(-1);
-                    }
-                    arglSetRotate90(gArglSettingsCornerFinderImage, contentRotate90);
-                    arglSetFlipV(gArglSettingsCornerFinderImage, contentFlipV);
-                    arglSetFlipH(gArglSettingsCornerFinderImage, contentFlipH);
-                    
-                    //
-                    // Calibration init.
-                    //
-                    
-                    gCalibration = new Calibration(gCalibrationPatternType, gPreferencesCalibImageCountMax, gCalibrationPatternSize, gCalibrationPatternSpacing, vs->getVideoWidth(), vs->getVideoHeight());
-                    if (!gCalibration) {
-                        ARLOGe("Error initialising calibration.\n");
-                        quit(-1);
-                    }
-                    
-                    if (!flowInitAndStart(gCalibration, saveParam, NULL)) {
-                        ARLOGe("Error: Could not initialise and start flow.\n");
-                        quit(-1);
-                    }
-                    
-                    // For FPS statistics.
-                    arUtilTimerReset();
-                    gFrameCount = 0;
-                    
-                    gPostVideoSetupDone = true;
-                } // !gPostVideoSetupDone
-                
-                if (contextWasUpdated) {
-                    vv->setContextSize({contextWidth, contextHeight});
-                    vv->getViewport(gViewport);
-                }
-                
-                FLOW_STATE state = flowStateGet();
-                if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
-                    
-                    // Upload the frame to OpenGL.
-                    // Now done as part of the draw call.
-                    
-                } else if (state == FLOW_STATE_CAPTURING) {
-                    
-                    gCalibration->frame(vs);
-
-                }
-                
+        // In stereo mode, nothing is set up until both cameras have delivered a frame.
+        if (vsR && vsR->isOpen() && vsR->captureFrame()) gVideoRFrameSeen = true;
+        
+        for (CameraSession *session : gSessions) sessionUpdate(session);
+        
+        if (contextWasUpdated) {
+            for (CameraSession *session : gSessions) {
+                if (session->postVideoSetupDone) sessionLayout(session);
             }
-            
-        } // vs->isOpen()
+            contextWasUpdated = false;
+        }
         
         // The display has changed.
         drawView();
@@ -519,6 +940,8 @@ int main(int argc, char *argv[])
     }
     
     stopVideo();
+    delete gCornerFinderPool;
+    gCornerFinderPool = nullptr;
     
     quit(0);
 }
@@ -533,12 +956,24 @@ void reshape(int w, int h)
 
 static void quit(int rc)
 {
+    if (gLatencyStatsPath) {
+        FILE *fp = fopen(gLatencyStatsPath, "w");
+        if (!fp || !latencyStatsWrite(fp, true)) ARLOGe("Error writing latency statistics to '%s'.\n", gLatencyStatsPath);
+        else ARLOGi("Latency statistics written to '%s'.\n", gLatencyStatsPath);
+        if (fp) fclose(fp);
+        free(gLatencyStatsPath);
+        gLatencyStatsPath = NULL;
+    }
+    
     fileUploaderFinal(&fileUploadHandle);
     
     SDL_Quit();
     
     free(gPreferenceCameraOpenToken);
     free(gPreferenceCameraResolutionToken);
+    free(gStereoVconfR);
+    for (CameraSession *&session : gSessions) sessionDelete(&session);
+    gSessions.clear();
     free(gCalibrationServerUploadURL);
     free(gCalibrationServerAuthenticationToken);
     preferencesFinal(&gPreferences);
@@ -555,6 +990,14 @@ static void usage(char *com)
     ARLOG("  -cornery=n: specify the number of corners on chessboard in Y direction.\n");
     ARLOG("  -imagenum=n: specify the number of images captured for calibration.\n");
     ARLOG("  -pattwidth=n: specify the square width in the chessbaord.\n");
+    ARLOG("  --latency-stats <file>: on exit, write pipeline latency statistics to file, as JSON.\n");
+    ARLOG("  --stereo <video parameter for the right camera>: calibrate a stereo pair. The camera chosen in\n");
+    ARLOG("      the settings is the left camera.\n");
+    ARLOG("  --camera <video parameter for a further camera>: calibrate another camera at the same time. May be\n");
+    ARLOG("      given more than once. Each camera is shown in its own tile; press tab or click a tile to choose\n");
+    ARLOG("      which camera the keyboard controls.\n");
+    ARLOG("  --calib-views <n>: calibrate with at most n of the captured views, chosen for coverage of the image and\n");
+    ARLOG("      range of poses. 0 (the default) uses all. Not used in stereo mode.\n");
     ARLOG("  -h -help --help: show this message\n");
     exit(0);
 }
@@ -707,142 +1150,351 @@ static void drawBusyIndicator(int positionX, int positionY, int squareSize, stru
     glPopMatrix();
 }
 
-void drawView(void)
+// Draw a table of pipeline stage latencies, with its bottom edge at y.
+static void drawLatencyStats(const float y)
+{
+    const float lineHeight = EdenGLFontGetHeight() + 2.0f;
+    char lines[LATENCY_STAGE_COUNT + 1][128];
+    float width = 0.0f;
+    
+    snprintf(lines[0], sizeof(lines[0]), "Stage: count, mean/p50/p90/p99/max ms");
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        LatencyStatsSummary summary;
+        latencyStatsSummarise((LATENCY_STAGE)s, &summary);
+        snprintf(lines[s + 1], sizeof(lines[s + 1]), "%s: %llu, %.2f/%.2f/%.2f/%.2f/%.2f", latencyStatsStageName((LATENCY_STAGE)s), (unsigned long long)summary.count, summary.meanMs, summary.p50Ms, summary.p90Ms, summary.p99Ms, summary.maxMs);
+    }
+    for (int i = 0; i <= LATENCY_STAGE_COUNT; i++) width = MAX(width, EdenGLFontGetLineWidth((unsigned char *)lines[i]));
+    
+    drawBackground(width + 8.0f, lineHeight*(LATENCY_STAGE_COUNT + 1) + 4.0f, 0.0f, y, false);
+    glDisable(GL_BLEND);
+    for (int i = 0; i <= LATENCY_STAGE_COUNT; i++) {
+        EdenGLFontDrawLine(0, NULL, (unsigned char *)lines[i], 4.0f, y + 4.0f + lineHeight*(LATENCY_STAGE_COUNT - i), H_OFFSET_VIEW_LEFT_EDGE_TO_TEXT_LEFT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+    }
+}
+
+// Draw a calibration's latest corner finder results into viewport: the frame searched, and (if showCorners) crosses
+// marking the corners found, red if the whole pattern was found. vv gives the orientation of the image.
+static void drawCornerFinderResults(Calibration *calibration, ARView *vv, ARGL_CONTEXT_SETTINGS_REF arglSettings, const int32_t viewport[4], const int videoWidth, const int videoHeight, const bool showCorners, Calibration::CornerFinderResultInfo *info, LatencyStatsTime *latencyStart)
 {
     int i;
-    struct timeval time;
     float left, right, bottom, top;
     GLfloat *vertices = NULL;
     GLint vertexCount;
     
-    // Get frame time.
-    gettimeofday(&time, NULL);
+    // Get the latest results. They won't change underneath us until we release them.
+    int cornerFoundAllFlag;
+    const std::vector<cv::Point2f> *cornersPtr;
+    ARUint8 *videoFrame;
+    calibration->cornerFinderResultsAcquire(&cornerFoundAllFlag, &cornersPtr, &videoFrame, info);
+    const std::vector<cv::Point2f>& corners = *cornersPtr;
     
-    SDL_GL_MakeCurrent(gSDLWindow, gSDLContext);
+    // Display the current frame.
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (videoFrame) arglPixelBufferDataUpload(arglSettings, videoFrame);
+    arglDispImage(arglSettings, NULL);
+    latencyStatsRecord(LATENCY_STAGE_DRAW_UPLOAD, *latencyStart);
+    *latencyStart = latencyStatsNow();
     
-    // Clean the OpenGL context.
-    glClearColor(0.0, 0.0, 0.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    //
+    // Setup for drawing on top of video frame, in video pixel coordinates.
+    //
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    if (vv->rotate90()) glRotatef(90.0f, 0.0f, 0.0f, -1.0f);
+    if (vv->flipV()) {
+        bottom = (float)videoHeight;
+        top = 0.0f;
+    } else {
+        bottom = 0.0f;
+        top = (float)videoHeight;
+    }
+    if (vv->flipH()) {
+        left = (float)videoWidth;
+        right = 0.0f;
+    } else {
+        left = 0.0f;
+        right = (float)videoWidth;
+    }
+    glOrtho(left, right, bottom, top, -1.0f, 1.0f);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_BLEND);
+    glActiveTexture(GL_TEXTURE0);
+    glDisable(GL_TEXTURE_2D);
+    
+    
+    // Draw the crosses marking the corner positions.
+    vertexCount = (showCorners ? (GLint)corners.size()*4 : 0);
+    if (vertexCount > 0) {
+        float fontSizeScaled = FONT_SIZE * (float)videoHeight/(float)(viewport[(gDisplayOrientation % 2) == 1 ? 3 : 2]);
+        float colorRed[4] = {1.0f, 0.0f, 0.0f, 1.0f};
+        float colorGreen[4] = {0.0f, 1.0f, 0.0f, 1.0f};
+        glColor4fv(cornerFoundAllFlag ? colorRed : colorGreen);
+        EdenGLFontSetSize(fontSizeScaled);
+        EdenGLFontSetColor(cornerFoundAllFlag ? colorRed : colorGreen);
+        arMalloc(vertices, GLfloat, vertexCount*2); // 2 coords per vertex.
+        for (i = 0; i < corners.size(); i++) {
+            vertices[i*8    ] = corners[i].x - 5.0f;
+            vertices[i*8 + 1] = videoHeight - corners[i].y - 5.0f;
+            vertices[i*8 + 2] = corners[i].x + 5.0f;
+            vertices[i*8 + 3] = videoHeight - corners[i].y + 5.0f;
+            vertices[i*8 + 4] = corners[i].x - 5.0f;
+            vertices[i*8 + 5] = videoHeight - corners[i].y + 5.0f;
+            vertices[i*8 + 6] = corners[i].x + 5.0f;
+            vertices[i*8 + 7] = videoHeight - corners[i].y - 5.0f;
+            
+            unsigned char buf[12]; // 10 digits in INT32_MAX, plus sign, plus null.
+            sprintf((char *)buf, "%d\n", i);
+            
+            glPushMatrix();
+            glLoadIdentity();
+            glTranslatef(corners[i].x, videoHeight - corners[i].y, 0.0f);
+            glRotatef((float)(gDisplayOrientation - 1) * -90.0f, 0.0f, 0.0f, 1.0f); // Orient the text to the user.
+            EdenGLFontDrawLine(0, NULL, buf, 0.0f, 0.0f, H_OFFSET_VIEW_LEFT_EDGE_TO_TEXT_LEFT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE); // These alignment modes don't require setting of EdenGLFontSetViewSize().
+            glPopMatrix();
+        }
+        EdenGLFontSetSize(FONT_SIZE);
+        float colorWhite[4] = {1.0f, 1.0f, 1.0f, 1.0f};;
+        EdenGLFontSetColor(colorWhite);
+    }
+    
+    calibration->cornerFinderResultsRelease();
+    
+    if (vertexCount > 0) {
+        glVertexPointer(2, GL_FLOAT, 0, vertices);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glClientActiveTexture(GL_TEXTURE0);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glLineWidth(2.0f);
+        glDrawArrays(GL_LINES, 0, vertexCount);
+        free(vertices);
+    }
+}
+
+// Viewport for one camera's image in stereo mode: its half of the window (0 for left, 1 for right), fitted to the
+// image's aspect ratio.
+static void stereoViewport(const int side, const int videoWidth, const int videoHeight, const bool rotate90, int32_t viewport[4])
+{
+    const int32_t half[4] = {side*(contextWidth / 2), 0, contextWidth / 2, contextHeight};
+    fitViewport(half, videoWidth, videoHeight, rotate90, viewport);
+}
+
+// Draw a flow's message in a box centred in the view, with the text made smaller if need be to fit the view's width.
+// Lines are separated by newlines, and are modified in place.
+static void drawMessage(char *text, const float width, const float height)
+{
+#define DRAW_MESSAGE_LINE_COUNT_MAX 32
+    const unsigned char *lines[DRAW_MESSAGE_LINE_COUNT_MAX];
+    unsigned int lineCount = 0;
+    const float padding = 20.0f;
+    
+    char *line = text;
+    while (line && lineCount < DRAW_MESSAGE_LINE_COUNT_MAX) {
+        lines[lineCount++] = (unsigned char *)line;
+        line = strchr(line, '\n');
+        if (line) *line++ = '\0';
+    }
+    
+    float blockWidth = EdenGLFontGetBlockWidth(lines, lineCount);
+    if (blockWidth > 0.0f && blockWidth + 4*padding > width) {
+        EdenGLFontSetSize(MAX(FONT_SIZE * (width - 4*padding) / blockWidth, 1.0f));
+        blockWidth = EdenGLFontGetBlockWidth(lines, lineCount);
+    }
+    const float boxWidth = blockWidth + 2*padding;
+    const float boxHeight = EdenGLFontGetBlockHeight(lines, lineCount) + 2*padding;
+    drawBackground(boxWidth, boxHeight, (width - boxWidth)/2.0f, (height - boxHeight)/2.0f, true);
+    glDisable(GL_BLEND);
+    EdenGLFontDrawBlock(0, NULL, lines, lineCount, 0.0f, 0.0f, H_OFFSET_VIEW_CENTER_TO_TEXT_CENTER, V_OFFSET_VIEW_CENTER_TO_TEXT_CENTER);
+    EdenGLFontSetSize(FONT_SIZE);
+}
+
+// Draw the session's camera image in its tile. Information about the image, for drawing over it, is left in the session.
+static void drawSessionImage(CameraSession *session, LatencyStatsTime *latencyStart)
+{
+    ARVideoSource *vs = session->vs;
+    ARView *vv = session->vv;
+    const int32_t *viewport = session->viewport;
     
     //
     // Setup for drawing video frame.
     //
-    glViewport(gViewport[0], gViewport[1], gViewport[2], gViewport[3]);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
     
-    FLOW_STATE state = flowStateGet();
-    if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
+    FLOW_STATE state = session->flow->state();
+    session->cornerFinderResultInfo = {-1, false, 0.0f, false, 0.0f};
+    session->cornerFinderResultInfoR = {-1, false, 0.0f, false, 0.0f};
+    const uint8_t *previewUndistorted = NULL, *previewOriginal = NULL;
+    session->previewShown = (state == FLOW_STATE_DONE && session->undistortPreview && gPreviewMode != PREVIEW_MODE_OFF && session->undistortPreview->acquire(&previewUndistorted, &previewOriginal));
+    if (gStereoCalibration) {
         
-        // Display the current frame
-        vv->draw(vs);
+        // Each camera's image in its half of the window, drawn from its latest results.
+        int32_t viewportL[4], viewportR[4];
+        stereoViewport(0, vs->getVideoWidth(), vs->getVideoHeight(), vv->rotate90(), viewportL);
+        stereoViewport(1, vsR->getVideoWidth(), vsR->getVideoHeight(), vv->rotate90(), viewportR);
+        drawCornerFinderResults(&gStereoCalibration->left(), vv, session->arglSettingsCornerFinderImage, viewportL, vs->getVideoWidth(), vs->getVideoHeight(), (state == FLOW_STATE_CAPTURING), &session->cornerFinderResultInfo, latencyStart);
+        drawCornerFinderResults(&gStereoCalibration->right(), vv, gArglSettingsCornerFinderImageR, viewportR, vsR->getVideoWidth(), vsR->getVideoHeight(), (state == FLOW_STATE_CAPTURING), &session->cornerFinderResultInfoR, latencyStart);
         
-    } else if (state == FLOW_STATE_CAPTURING) {
+    } else if (session->previewShown) {
         
-        // Grab a lock while we're using the data to prevent it being changed underneath us.
-        int cornerFoundAllFlag;
-        std::vector<cv::Point2f> corners;
-        ARUint8 *videoFrame;
-        gCalibration->cornerFinderResultsLockAndFetch(&cornerFoundAllFlag, corners, &videoFrame);
-        
-        // Display the current frame.
-        if (videoFrame) arglPixelBufferDataUpload(gArglSettingsCornerFinderImage, videoFrame);
-        arglDispImage(gArglSettingsCornerFinderImage, NULL);
-        
-        //
-        // Setup for drawing on top of video frame, in video pixel coordinates.
-        //
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
-        if (vv->rotate90()) glRotatef(90.0f, 0.0f, 0.0f, -1.0f);
-        if (vv->flipV()) {
-            bottom = (float)vs->getVideoHeight();
-            top = 0.0f;
+        // Display the original and undistorted frames, uploaded together so that they match.
+        arglPixelBufferDataUpload(session->arglSettingsCornerFinderImage, (ARUint8 *)previewOriginal);
+        arglPixelBufferDataUpload(session->arglSettingsPreviewImage, (ARUint8 *)previewUndistorted);
+        if (gPreviewMode == PREVIEW_MODE_SIDE_BY_SIDE) {
+            // Each in half the view, keeping the video aspect ratio.
+            int32_t halfViewport[4];
+            halfViewport[2] = viewport[2] / 2;
+            halfViewport[3] = viewport[3] / 2;
+            halfViewport[0] = viewport[0];
+            halfViewport[1] = viewport[1] + (viewport[3] - halfViewport[3]) / 2;
+            arglDispImage(session->arglSettingsCornerFinderImage, halfViewport);
+            halfViewport[0] = viewport[0] + halfViewport[2];
+            arglDispImage(session->arglSettingsPreviewImage, halfViewport);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
         } else {
-            bottom = 0.0f;
-            top = (float)vs->getVideoHeight();
+            arglDispImage(session->arglSettingsCornerFinderImage, NULL);
+            const GLint wipeX = viewport[0] + (GLint)(gPreviewWipe * (float)viewport[2]);
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(wipeX, viewport[1], viewport[0] + viewport[2] - wipeX, viewport[3]);
+            arglDispImage(session->arglSettingsPreviewImage, NULL);
+            glDisable(GL_SCISSOR_TEST);
         }
-        if (vv->flipH()) {
-            left = (float)vs->getVideoWidth();
-            right = 0.0f;
-        } else {
-            left = 0.0f;
-            right = (float)vs->getVideoWidth();
-        }
-        glOrtho(left, right, bottom, top, -1.0f, 1.0f);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-        glDisable(GL_DEPTH_TEST);
-        glDisable(GL_LIGHTING);
-        glDisable(GL_BLEND);
-        glActiveTexture(GL_TEXTURE0);
-        glDisable(GL_TEXTURE_2D);
+        latencyStatsRecord(LATENCY_STAGE_DRAW_UPLOAD, *latencyStart);
+        *latencyStart = latencyStatsNow();
         
+    } else if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
         
-        // Draw the crosses marking the corner positions.
-        vertexCount = (GLint)corners.size()*4;
-        if (vertexCount > 0) {
-            float fontSizeScaled = FONT_SIZE * (float)vs->getVideoHeight()/(float)(gViewport[(gDisplayOrientation % 2) == 1 ? 3 : 2]);
-            float colorRed[4] = {1.0f, 0.0f, 0.0f, 1.0f};
-            float colorGreen[4] = {0.0f, 1.0f, 0.0f, 1.0f};
-            glColor4fv(cornerFoundAllFlag ? colorRed : colorGreen);
-            EdenGLFontSetSize(fontSizeScaled);
-            EdenGLFontSetColor(cornerFoundAllFlag ? colorRed : colorGreen);
-            arMalloc(vertices, GLfloat, vertexCount*2); // 2 coords per vertex.
-            for (i = 0; i < corners.size(); i++) {
-                vertices[i*8    ] = corners[i].x - 5.0f;
-                vertices[i*8 + 1] = vs->getVideoHeight() - corners[i].y - 5.0f;
-                vertices[i*8 + 2] = corners[i].x + 5.0f;
-                vertices[i*8 + 3] = vs->getVideoHeight() - corners[i].y + 5.0f;
-                vertices[i*8 + 4] = corners[i].x - 5.0f;
-                vertices[i*8 + 5] = vs->getVideoHeight() - corners[i].y + 5.0f;
-                vertices[i*8 + 6] = corners[i].x + 5.0f;
-                vertices[i*8 + 7] = vs->getVideoHeight() - corners[i].y - 5.0f;
-                
-                unsigned char buf[12]; // 10 digits in INT32_MAX, plus sign, plus null.
-                sprintf((char *)buf, "%d\n", i);
-                
-                glPushMatrix();
-                glLoadIdentity();
-                glTranslatef(corners[i].x, vs->getVideoHeight() - corners[i].y, 0.0f);
-                glRotatef((float)(gDisplayOrientation - 1) * -90.0f, 0.0f, 0.0f, 1.0f); // Orient the text to the user.
-                EdenGLFontDrawLine(0, NULL, buf, 0.0f, 0.0f, H_OFFSET_VIEW_LEFT_EDGE_TO_TEXT_LEFT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE); // These alignment modes don't require setting of EdenGLFontSetViewSize().
-                glPopMatrix();
+        // Display the current frame.
+        if (gSessions.size() == 1) {
+            vv->draw(vs);
+        } else {
+            // ARView draws into the whole window, so a tile is drawn from the frame's luma instead.
+            AR2VideoBufferT *buff = vs->checkoutFrameIfNewerThan(session->displayLastTimestamp);
+            if (buff) {
+                session->displayLastTimestamp = buff->time;
+                arglPixelBufferDataUpload(session->arglSettingsCornerFinderImage, buff->buffLuma);
+                vs->checkinFrame();
             }
-            EdenGLFontSetSize(FONT_SIZE);
-            float colorWhite[4] = {1.0f, 1.0f, 1.0f, 1.0f};;
-            EdenGLFontSetColor(colorWhite);
+            arglDispImage(session->arglSettingsCornerFinderImage, NULL);
         }
+        latencyStatsRecord(LATENCY_STAGE_DRAW_UPLOAD, *latencyStart);
+        *latencyStart = latencyStatsNow();
         
-        gCalibration->cornerFinderResultsUnlock();
+    } else if (state == FLOW_STATE_CAPTURING) {
         
-        if (vertexCount > 0) {
-            glVertexPointer(2, GL_FLOAT, 0, vertices);
-            glEnableClientState(GL_VERTEX_ARRAY);
-            glDisableClientState(GL_NORMAL_ARRAY);
-            glClientActiveTexture(GL_TEXTURE0);
-            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-            glLineWidth(2.0f);
-            glDrawArrays(GL_LINES, 0, vertexCount);
-            free(vertices);
-        }
+        // Get the latest results, and draw them over the frame they were found in.
+        drawCornerFinderResults(session->calibration, vv, session->arglSettingsCornerFinderImage, viewport, vs->getVideoWidth(), vs->getVideoHeight(), true, &session->cornerFinderResultInfo, latencyStart);
     }
+}
+
+// Draw the session's status and messages over its tile.
+static void drawSessionOverlay(CameraSession *session)
+{
+    const int32_t *tile = session->tile;
+    float left, right, bottom, top;
     
     //
-    // Setup for drawing on top of video frame, in viewPort coordinates.
+    // Setup for drawing on the tile, with correct orientation for user.
     //
-#if 0
+    glViewport(tile[0], tile[1], tile[2], tile[3]);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     bottom = 0.0f;
-    top = (float)(viewPort[viewPortIndexHeight]);
+    top = (float)tile[3];
     left = 0.0f;
-    right = (float)(viewPort[viewPortIndexWidth]);
-    glOrthof(left, right, bottom, top, -1.0f, 1.0f);
+    right = (float)tile[2];
+    glOrtho(left, right, bottom, top, -1.0f, 1.0f);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
     
     EdenGLFontSetViewSize(right, top);
-    EdenMessageSetViewSize(right, top, gDisplayDPI);
-#endif
+    float statusBarHeight = EdenGLFontGetHeight() + 4.0f; // 2 pixels above, 2 below.
+    
+    FLOW_STATE state = session->flow->state();
+    const Calibration::CornerFinderResultInfo& cornerFinderResultInfo = session->cornerFinderResultInfo;
+    const Calibration::CornerFinderResultInfo& cornerFinderResultInfoR = session->cornerFinderResultInfoR;
+    
+    // Draw status bar with centred status message.
+    unsigned char statusBarMessage[128];
+    if (session->flow->statusBarMessage((char *)statusBarMessage, sizeof(statusBarMessage))) {
+        drawBackground(right, statusBarHeight, 0.0f, 0.0f, false);
+        glDisable(GL_BLEND);
+        EdenGLFontDrawLine(0, NULL, statusBarMessage, 0.0f, 2.0f, H_OFFSET_VIEW_CENTER_TO_TEXT_CENTER, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+    }
+    
+    // While capturing, show the sharpness of the newest frame, so the user can see when to hold the camera still.
+    if (state == FLOW_STATE_CAPTURING) {
+        char sharpnessText[128];
+        if (gStereoCalibration) {
+            snprintf(sharpnessText, sizeof(sharpnessText), "Sharpness: L %.1f%s, R %.1f%s  View score: L %.2f, R %.2f",
+                     cornerFinderResultInfo.sharpness, (cornerFinderResultInfo.blurred ? " (too blurred)" : ""), cornerFinderResultInfoR.sharpness, (cornerFinderResultInfoR.blurred ? " (too blurred)" : ""),
+                     cornerFinderResultInfo.coverageScore, cornerFinderResultInfoR.coverageScore);
+        } else {
+            snprintf(sharpnessText, sizeof(sharpnessText), "Sharpness: %.1f%s  View score: %.2f", cornerFinderResultInfo.sharpness, (cornerFinderResultInfo.blurred ? " (too blurred)" : ""), cornerFinderResultInfo.coverageScore);
+        }
+        EdenGLFontDrawLine(0, NULL, (unsigned char *)sharpnessText, 2.0f, statusBarHeight + 2.0f, H_OFFSET_VIEW_LEFT_EDGE_TO_TEXT_LEFT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+        
+        // And the result of the background calibration of the views captured so far, with its change from the previous one.
+        Calibration::SolverStatus solverStatus;
+        if (session->calibration && session->calibration->solverStatus(&solverStatus)) {
+            char solverText[128];
+            snprintf(solverText, sizeof(solverText), "RMS %.3f px (f %+.2f%%, c %.1f px, k1 %+.3f)%s", solverStatus.rms, solverStatus.focalChange*100.0, solverStatus.principalPointChange, solverStatus.k1Change, (solverStatus.converged ? " converged, press 'f' to finish" : ""));
+            EdenGLFontDrawLine(0, NULL, (unsigned char *)solverText, 2.0f, statusBarHeight + 2.0f, H_OFFSET_TEXT_RIGHT_EDGE_TO_VIEW_RIGHT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+        }
+        Calibration::SolverStatus solverStatusR;
+        if (gStereoCalibration && gStereoCalibration->left().solverStatus(&solverStatus) && gStereoCalibration->right().solverStatus(&solverStatusR)) {
+            char solverText[128];
+            snprintf(solverText, sizeof(solverText), "RMS L %.3f px, R %.3f px%s", solverStatus.rms, solverStatusR.rms, (solverStatus.converged && solverStatusR.converged ? " converged, press 'f' to finish" : ""));
+            EdenGLFontDrawLine(0, NULL, (unsigned char *)solverText, 2.0f, statusBarHeight + 2.0f, H_OFFSET_TEXT_RIGHT_EDGE_TO_VIEW_RIGHT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+        }
+    }
+    
+    if (session->previewShown) {
+        char previewText[128];
+        snprintf(previewText, sizeof(previewText), "Undistorted preview: %s. Press 'u' to change.", (gPreviewMode == PREVIEW_MODE_SIDE_BY_SIDE ? "original left, undistorted right" : "undistorted right of divider (drag or use arrow keys to move)"));
+        EdenGLFontDrawLine(0, NULL, (unsigned char *)previewText, 2.0f, statusBarHeight + 2.0f, H_OFFSET_VIEW_LEFT_EDGE_TO_TEXT_LEFT_EDGE, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+    }
+    
+    // With several cameras, name each tile, and highlight the one the keyboard controls.
+    if (gSessions.size() > 1) {
+        char label[64];
+        snprintf(label, sizeof(label), "Camera %d%s", session->index + 1, (session->index == gSessionActive ? " (active)" : ""));
+        float colorYellow[4] = {1.0f, 1.0f, 0.0f, 1.0f};
+        float colorWhite[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        EdenGLFontSetColor(session->index == gSessionActive ? colorYellow : colorWhite);
+        EdenGLFontDrawLine(0, NULL, (unsigned char *)label, 2.0f, 2.0f, H_OFFSET_VIEW_LEFT_EDGE_TO_TEXT_LEFT_EDGE, V_OFFSET_VIEW_TEXT_TOP_TO_VIEW_TOP);
+        EdenGLFontSetColor(colorWhite);
+    }
+    
+    // If the flow has a message for the user, draw it.
+    char message[1024];
+    if (session->flow->message(message, sizeof(message))) drawMessage(message, right, top);
+}
+
+void drawView(void)
+{
+    struct timeval time;
+    float left, right, bottom, top;
+    
+    // Get frame time.
+    gettimeofday(&time, NULL);
+    
+    SDL_GL_MakeCurrent(gSDLWindow, gSDLContext);
+    
+    // Clean the OpenGL context.
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    
+    // Each camera's image in its tile, and then its status and messages over it.
+    LatencyStatsTime latencyStart = latencyStatsNow();
+    for (CameraSession *session : gSessions) {
+        if (session->postVideoSetupDone) drawSessionImage(session, &latencyStart);
+    }
+    for (CameraSession *session : gSessions) {
+        if (session->postVideoSetupDone) drawSessionOverlay(session);
+    }
     
     //
     // Setup for drawing on screen, with correct orientation for user.
@@ -863,13 +1515,15 @@ void drawView(void)
     EdenMessageSetBoxParams(600.0f, 20.0f);
     float statusBarHeight = EdenGLFontGetHeight() + 4.0f; // 2 pixels above, 2 below.
     
-    // Draw status bar with centred status message.
-    if (statusBarMessage[0]) {
-        drawBackground(right, statusBarHeight, 0.0f, 0.0f, false);
-        glDisable(GL_BLEND);
-        EdenGLFontDrawLine(0, NULL, statusBarMessage, 0.0f, 2.0f, H_OFFSET_VIEW_CENTER_TO_TEXT_CENTER, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
+    if (gSequenceRecorder) {
+        char recordText[64];
+        if (gSessions.size() > 1) snprintf(recordText, sizeof(recordText), "Recording camera %d: %d frames", gSequenceRecorderSession->index + 1, gSequenceRecorder->frameCount());
+        else snprintf(recordText, sizeof(recordText), "Recording: %d frames", gSequenceRecorder->frameCount());
+        EdenGLFontDrawLine(0, NULL, (unsigned char *)recordText, 2.0f, 2.0f, H_OFFSET_TEXT_RIGHT_EDGE_TO_VIEW_RIGHT_EDGE, V_OFFSET_VIEW_TEXT_TOP_TO_VIEW_TOP);
     }
     
+    if (gLatencyStatsShow) drawLatencyStats(statusBarHeight + EdenGLFontGetHeight() + 6.0f);
+    
     // If background tasks are proceeding, draw a status box.
     if (fileUploadHandle) {
         char uploadStatus[UPLOAD_STATUS_BUFFER_LEN];
@@ -888,16 +1542,21 @@ void drawView(void)
         }
     }
     
-    // If a message should be onscreen, draw it.
+    // If a message should be onscreen (e.g. the settings), draw it over everything.
     if (gEdenMessageDrawRequired) EdenMessageDraw(0, NULL);
     
+    latencyStatsRecord(LATENCY_STAGE_DRAW_OVERLAY, latencyStart);
+    
     SDL_GL_SwapWindow(gSDLWindow);
 }
 
 
 // Save parameters file and index file with info about it, then signal thread that it's ready for upload.
+// userdata is the CameraSession calibrated. Its index is the camera_index of the saved and uploaded calibration.
 static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, void *userdata)
 {
+    CameraSession *session = (CameraSession *)userdata;
+    ARVideoSource *vs = session->vs;
     int i;
 #define SAVEPARAM_PATHNAME_LEN MAXPATHLEN
     char indexPathname[SAVEPARAM_PATHNAME_LEN];
@@ -918,8 +1577,14 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
     }
     int ID = timeptr->tm_hour*10000 + timeptr->tm_min*100 + timeptr->tm_sec;
     
-    // Save the parameter file.
-    snprintf(paramPathname, SAVEPARAM_PATHNAME_LEN, "%s/%s/%06d-camera_para.dat", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR, ID);
+    // Show the new calibration in the undistorted preview. The main loop picks it up.
+    pthread_mutex_lock(&session->undistortPreviewLock);
+    session->undistortPreviewParam = *param;
+    session->undistortPreviewParamPending = true;
+    pthread_mutex_unlock(&session->undistortPreviewLock);
+    
+    // Save the parameter file. The session index keeps the names of sessions calibrated in the same second apart.
+    snprintf(paramPathname, SAVEPARAM_PATHNAME_LEN, "%s/%s/%06d-%d-camera_para.dat", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR, ID, session->index);
     
     //if (arParamSave(strcat(strcat(docsPath,"/"),paramPathname), 1, param) < 0) {
     if (arParamSave(paramPathname, 1, param) < 0) {
@@ -980,7 +1645,7 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
             }
             calibrationSavePathname[len + i] = '\0';
             len = strlen(calibrationSavePathname);
-            snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, "-0-%dx%d", vs->getVideoWidth(), vs->getVideoHeight()); // camera_index is always 0 for desktop platforms.
+            snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, "-%d-%dx%d", session->index, vs->getVideoWidth(), vs->getVideoHeight()); // camera_index is the session index for desktop platforms.
             len = strlen(calibrationSavePathname);
             if (strcmp(focal_length, "0.000") != 0) {
                 snprintf(&calibrationSavePathname[len], SAVEPARAM_PATHNAME_LEN - len, "-%s", focal_length);
@@ -993,6 +1658,14 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
                 ARLOGperror(NULL);
             } else {
                 ARLOGi("Saved calibration to '%s'.\n", calibrationSavePathname);
+                
+                // Alongside it, the precomputed undistortion map for the calibrated resolution.
+                len = strlen(calibrationSavePathname);
+                snprintf(&calibrationSavePathname[len - 3], SAVEPARAM_PATHNAME_LEN - len + 3, UNDISTORT_MAP_EXTENSION); // Replace "dat".
+                UndistortMap map;
+                if (map.create(param, UNDISTORT_MAP_SAVE_INVERSE) && map.save(calibrationSavePathname)) {
+                    ARLOGi("Saved undistortion map to '%s'.\n", calibrationSavePathname);
+                }
             }
         }
 
@@ -1012,7 +1685,7 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
         //
         
         // Open the file.
-        snprintf(indexPathname, SAVEPARAM_PATHNAME_LEN, "%s/%s/%06d-index", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR, ID);
+        snprintf(indexPathname, SAVEPARAM_PATHNAME_LEN, "%s/%s/%06d-%d-index", arUtilGetResourcesDirectoryPath(AR_UTIL_RESOURCES_DIRECTORY_BEHAVIOR_USE_APP_CACHE_DIR), QUEUE_DIR, ID, session->index);
         FILE *fp;
         if (!(fp = fopen(indexPathname, "wb"))) {
             ARLOGe("Error opening upload index file '%s'.\n", indexPathname);
@@ -1057,14 +1730,14 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
         // Camera index.
         if (goodWrite) {
             char camera_index[12]; // 10 digits in INT32_MAX, plus sign, plus null.
-            snprintf(camera_index, 12, "%d", 0); // Always zero for desktop platforms.
+            snprintf(camera_index, 12, "%d", session->index); // The session index for desktop platforms.
             fprintf(fp, "camera_index,%s\n", camera_index);
         }
         
         // Front or rear facing.
         if (goodWrite) {
             char camera_face[6]; // "front" or "rear", plus null.
-            snprintf(camera_face, 6, "%s", (gCameraIsFrontFacing ? "front" : "rear"));
+            snprintf(camera_face, 6, "%s", (session->cameraIsFrontFacing ? "front" : "rear"));
             fprintf(fp, "camera_face,%s\n", camera_face);
         }
         
@@ -1091,6 +1764,15 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
             fprintf(fp, "err_max,%s\n", err_max_ascii);
         }
         
+        // Standard deviations of the camera parameters, if estimated.
+        Calibration::Uncertainty uncertainty;
+        if (goodWrite && session->calibration->calibUncertainty(&uncertainty)) {
+            const char *dist_factor_names[9] = {"k1", "k2", "p1", "p2", "fx", "fy", "x0", "y0", "s"};
+            fprintf(fp, "dist_factor_sd_method,%s\n", (uncertainty.method == Calibration::UncertaintyMethod::BOOTSTRAP ? "bootstrap" : "kfold"));
+            fprintf(fp, "dist_factor_sd_samples,%d\n", uncertainty.sampleCount);
+            for (i = 0; i < 9; i++) fprintf(fp, "dist_factor_sd_%s,%f\n", dist_factor_names[i], uncertainty.distFactorStdDev[i]);
+        }
+        
         // IP address will be derived from connect.
         
         // Hash the shared secret.
@@ -1140,4 +1822,25 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
     }
 }
 
-
+// Save a stereo calibration as the three files whose contents arwStartRunningStereoB() takes: each camera's parameters,
+// and the transform from the left camera to the right. Stereo calibrations are not uploaded, so they are always saved.
+static void saveStereoParam(const ARParam *paramL, const ARParam *paramR, ARdouble transL2R[3][4], ARdouble errL, ARdouble errR, ARdouble errStereo, void *userdata)
+{
+    char pathname[MAXPATHLEN];
+    char timestamp[32];
+    time_t now = time(NULL);
+    if (!strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", localtime(&now))) timestamp[0] = '\0';
+    const char *dir = (gCalibrationSaveDir ? gCalibrationSaveDir : ".");
+    
+    snprintf(pathname, sizeof(pathname), "%s/camera_para-stereo-%s-L-%dx%d.dat", dir, timestamp, paramL->xsize, paramL->ysize);
+    if (arParamSave(pathname, 1, paramL) < 0) ARLOGe("Error saving left camera calibration to '%s'.\n", pathname);
+    else ARLOGi("Saved left camera calibration to '%s'.\n", pathname);
+    
+    snprintf(pathname, sizeof(pathname), "%s/camera_para-stereo-%s-R-%dx%d.dat", dir, timestamp, paramR->xsize, paramR->ysize);
+    if (arParamSave(pathname, 1, paramR) < 0) ARLOGe("Error saving right camera calibration to '%s'.\n", pathname);
+    else ARLOGi("Saved right camera calibration to '%s'.\n", pathname);
+    
+    snprintf(pathname, sizeof(pathname), "%s/transL2R-stereo-%s.dat", dir, timestamp);
+    if (arParamSaveExt(pathname, transL2R) < 0) ARLOGe("Error saving left to right transform to '%s'.\n", pathname);
+    else ARLOGi("Saved left to right transform to '%s' (error left %.3f, right %.3f, stereo %.3f).\n", pathname, errL, errR, errStereo);
+}
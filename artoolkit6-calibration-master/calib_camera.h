@@ -34,6 +34,7 @@ extern "C" {
 #endif
 
 extern Uint32 gSDLEventPreferencesChanged;
+extern Uint32 gSDLEventPreferencesModal; // Sent when the preferences are shown and when they are hidden.
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,517 @@
+/*
+ *  calib_camera_batch.cpp
+ *  ARToolKit6
+ *
+ *  Headless camera calibration from a directory of images or a video file.
+ *
+ *  Run with "--help" parameter to see usage.
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // strcasecmp()
+#include <dirent.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <AR6/AR/ar.h>
+#include <AR6/ARUtil/thread_sub.h>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/videoio/videoio.hpp>
+
+#include "Calibration.hpp"
+#include "CalibrationCoverage.hpp"
+#include "calc.hpp"
+#include "UndistortMap.hpp"
+
+// ============================================================================
+//	Constants
+// ============================================================================
+
+#define      SAVE_FILENAME                 "camera_para.dat"
+#define      VIDEO_FRAMES_PER_WORKER       4 // Video frames are decoded in chunks of this many per worker, to bound memory use.
+#define      CALIB_VIEW_COUNT_MIN          3
+#define      BATCH_BOOTSTRAP_SAMPLES_DEFAULT 32
+#define      BATCH_KFOLD_FOLDS_DEFAULT     10
+
+// ============================================================================
+//	Types
+// ============================================================================
+
+typedef enum {
+    BATCH_VIEW_PENDING = 0,
+    BATCH_VIEW_UNREADABLE,
+    BATCH_VIEW_NOT_FOUND,
+    BATCH_VIEW_FOUND,
+    BATCH_VIEW_SIZE_MISMATCH
+} BATCH_VIEW_STATUS;
+
+// One image or video frame.
+typedef struct {
+    std::string name;
+    cv::Mat image; // Decoded greyscale image. Empty if the worker should read it from file "name".
+    cv::Size size;
+    BATCH_VIEW_STATUS status;
+    std::vector<cv::Point2f> corners;
+    bool used;
+    ARdouble err; // RMS error of the view in the final solve, in pixels, or -1 if not used. NaN if it couldn't be evaluated.
+    std::string rejectReason; // Non-empty if the view was rejected as an outlier.
+} BatchView;
+
+// Shared by all workers. Each worker claims the next unprocessed view in [next, end) until none remain.
+typedef struct {
+    std::vector<BatchView> *views;
+    std::atomic<int> next;
+    int end;
+    Calibration::CalibrationPatternType patternType;
+    cv::Size patternSize;
+} BatchWork;
+
+// ============================================================================
+//	Global variables.
+// ============================================================================
+
+static std::vector<THREAD_HANDLE_T *> gWorkers;
+
+// ============================================================================
+//	Function prototypes
+// ============================================================================
+
+static void usage(char *com);
+static bool isImageFile(const char *name);
+static bool listImages(const char *dir, std::vector<BatchView>& views);
+static void *batchWorker(THREAD_HANDLE_T *threadHandle);
+static void processViews(BatchWork *work, const int begin, const int end);
+static void stopWorkers(void);
+static bool writeReport(const char *path, const char *input, const Calibration::CalibrationPatternType patternType, const cv::Size patternSize, const float patternSpacing, const cv::Size imageSize, const std::vector<BatchView>& views, const ARParam *param, const ARdouble err_min, const ARdouble err_avg, const ARdouble err_max, const Calibration::Uncertainty *uncertainty);
+
+// ============================================================================
+//	Functions
+// ============================================================================
+
+int main(int argc, char *argv[])
+{
+    Calibration::CalibrationPatternType patternType = Calibration::CalibrationPatternType::CHESSBOARD;
+    int cornerNumX = 0;
+    int cornerNumY = 0;
+    float patternWidth = 0.0f;
+    int viewCountMax = 0;
+    int videoStep = 10;
+    int workerCount = 0;
+    const char *input = NULL;
+    const char *outputPath = SAVE_FILENAME;
+    const char *reportPath = NULL;
+    const char *mapPath = NULL;
+    bool robust = false;
+    bool uncertaintyEnabled = false;
+    Calibration::UncertaintyMethod uncertaintyMethod = Calibration::UncertaintyMethod::BOOTSTRAP;
+    int uncertaintySampleCount = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0]);
+        } else if (strncmp(argv[i], "-pattern=", 9) == 0) {
+            if (strcmp(&(argv[i][9]), "chessboard") == 0) patternType = Calibration::CalibrationPatternType::CHESSBOARD;
+            else if (strcmp(&(argv[i][9]), "circles") == 0) patternType = Calibration::CalibrationPatternType::CIRCLES_GRID;
+            else if (strcmp(&(argv[i][9]), "acircles") == 0) patternType = Calibration::CalibrationPatternType::ASYMMETRIC_CIRCLES_GRID;
+            else usage(argv[0]);
+        } else if (strncmp(argv[i], "-cornerx=", 9) == 0) {
+            if (sscanf(&(argv[i][9]), "%d", &cornerNumX) != 1 || cornerNumX <= 0) usage(argv[0]);
+        } else if (strncmp(argv[i], "-cornery=", 9) == 0) {
+            if (sscanf(&(argv[i][9]), "%d", &cornerNumY) != 1 || cornerNumY <= 0) usage(argv[0]);
+        } else if (strncmp(argv[i], "-pattwidth=", 11) == 0) {
+            if (sscanf(&(argv[i][11]), "%f", &patternWidth) != 1 || patternWidth <= 0.0f) usage(argv[0]);
+        } else if (strncmp(argv[i], "-views=", 7) == 0) {
+            if (sscanf(&(argv[i][7]), "%d", &viewCountMax) != 1 || viewCountMax < 0) usage(argv[0]);
+        } else if (strncmp(argv[i], "-videostep=", 11) == 0) {
+            if (sscanf(&(argv[i][11]), "%d", &videoStep) != 1 || videoStep <= 0) usage(argv[0]);
+        } else if (strncmp(argv[i], "-threads=", 9) == 0) {
+            if (sscanf(&(argv[i][9]), "%d", &workerCount) != 1 || workerCount < 0) usage(argv[0]);
+        } else if (strcmp(argv[i], "-robust") == 0) {
+            robust = true;
+        } else if (strncmp(argv[i], "-solver=", 8) == 0) {
+            if (strcmp(&(argv[i][8]), "bundle") == 0) calcSetBundleSolverEnabled(true);
+            else if (strcmp(&(argv[i][8]), "opencv") == 0) calcSetBundleSolverEnabled(false);
+            else usage(argv[0]);
+        } else if (strncmp(argv[i], "-uncertainty=", 13) == 0) {
+            if (strcmp(&(argv[i][13]), "bootstrap") == 0) uncertaintyMethod = Calibration::UncertaintyMethod::BOOTSTRAP;
+            else if (strcmp(&(argv[i][13]), "kfold") == 0) uncertaintyMethod = Calibration::UncertaintyMethod::K_FOLD;
+            else usage(argv[0]);
+            uncertaintyEnabled = true;
+        } else if (strncmp(argv[i], "-samples=", 9) == 0) {
+            if (sscanf(&(argv[i][9]), "%d", &uncertaintySampleCount) != 1 || uncertaintySampleCount <= 0) usage(argv[0]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportPath = argv[++i];
+        } else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+            mapPath = argv[++i];
+        } else if (argv[i][0] != '-' && !input) {
+            input = argv[i];
+        } else {
+            ARLOGe("Error: invalid command line argument '%s'.\n", argv[i]);
+            usage(argv[0]);
+        }
+    }
+    if (!input) usage(argv[0]);
+
+    cv::Size patternSize = Calibration::CalibrationPatternSizes.count(patternType) ? Calibration::CalibrationPatternSizes[patternType] : cv::Size(cornerNumX, cornerNumY);
+    if (cornerNumX > 0) patternSize.width = cornerNumX;
+    if (cornerNumY > 0) patternSize.height = cornerNumY;
+    if (patternSize.width <= 0 || patternSize.height <= 0) {
+        ARLOGe("Error: pattern size must be specified for this pattern type.\n");
+        usage(argv[0]);
+    }
+    float patternSpacing = patternWidth;
+    if (patternSpacing == 0.0f) patternSpacing = (Calibration::CalibrationPatternSpacings.count(patternType) ? Calibration::CalibrationPatternSpacings[patternType] : 1.0f);
+
+    if (workerCount <= 0) workerCount = threadGetCPU();
+    if (workerCount < 1) workerCount = 1;
+
+    //
+    // Start the workers.
+    //
+
+    std::vector<BatchView> views;
+    BatchWork work;
+    work.views = &views;
+    work.next = 0;
+    work.end = 0;
+    work.patternType = patternType;
+    work.patternSize = patternSize;
+    for (i = 0; i < workerCount; i++) {
+        THREAD_HANDLE_T *worker = threadInit(i, (void *)&work, batchWorker);
+        if (!worker) {
+            ARLOGe("Error starting worker thread %d.\n", i);
+            break;
+        }
+        gWorkers.push_back(worker);
+    }
+    if (gWorkers.empty()) return (1);
+    ARLOGi("Finding corners using %d thread%s.\n", (int)gWorkers.size(), (gWorkers.size() == 1 ? "" : "s"));
+
+    //
+    // Find corners in every image, or every videoStep-th video frame.
+    //
+
+    struct stat st;
+    if (stat(input, &st) != 0) {
+        ARLOGe("Error: unable to access '%s'.\n", input);
+        stopWorkers();
+        return (1);
+    }
+    if (S_ISDIR(st.st_mode)) {
+        if (!listImages(input, views)) {
+            stopWorkers();
+            return (1);
+        }
+        ARLOGi("Found %d images in '%s'.\n", (int)views.size(), input);
+        processViews(&work, 0, (int)views.size());
+    } else {
+        cv::VideoCapture video(input);
+        if (!video.isOpened()) {
+            ARLOGe("Error: unable to open video '%s'.\n", input);
+            stopWorkers();
+            return (1);
+        }
+        // Decoding is sequential, so frames are decoded in chunks, with corner finding on each chunk in parallel.
+        const int chunk = (int)gWorkers.size() * VIDEO_FRAMES_PER_WORKER;
+        cv::Mat frame;
+        int frameIndex = 0;
+        int begin = 0;
+        while (video.read(frame)) {
+            if (frameIndex % videoStep == 0) {
+                BatchView view;
+                char name[32];
+                snprintf(name, sizeof(name), "frame %d", frameIndex);
+                view.name = name;
+                if (frame.channels() == 1) view.image = frame.clone();
+                else cv::cvtColor(frame, view.image, cv::COLOR_BGR2GRAY);
+                view.status = BATCH_VIEW_PENDING;
+                view.used = false;
+                view.err = -1.0;
+                views.push_back(view);
+                if ((int)views.size() - begin == chunk) {
+                    processViews(&work, begin, (int)views.size());
+                    begin = (int)views.size();
+                }
+            }
+            frameIndex++;
+        }
+        processViews(&work, begin, (int)views.size());
+        ARLOGi("Read %d frames from '%s', searched %d.\n", frameIndex, input, (int)views.size());
+    }
+
+    stopWorkers();
+
+    //
+    // Select views. All must be the same size as the first in which the pattern was found.
+    //
+
+    cv::Size imageSize;
+    std::vector<int> found;
+    for (i = 0; i < (int)views.size(); i++) {
+        if (views[i].status != BATCH_VIEW_FOUND) continue;
+        if (found.empty()) imageSize = views[i].size;
+        else if (views[i].size != imageSize) {
+            views[i].status = BATCH_VIEW_SIZE_MISMATCH;
+            continue;
+        }
+        found.push_back(i);
+    }
+    ARLOGi("Pattern found in %d of %d views.\n", (int)found.size(), (int)views.size());
+    if ((int)found.size() < CALIB_VIEW_COUNT_MIN) {
+        ARLOGe("Error: at least %d views containing the pattern are needed.\n", CALIB_VIEW_COUNT_MIN);
+        return (1);
+    }
+
+    // Gather the corners into one block, and free each view's copy.
+    CornerSet cornerSet(patternSize.area());
+    cornerSet.reserve((int)found.size());
+    for (int index : found) {
+        cornerSet.push_back(views[index].corners);
+        std::vector<cv::Point2f>().swap(views[index].corners);
+    }
+    std::vector<int> cornerSetViews; // Index into views of each view in cornerSet.
+    if (viewCountMax > 0 && viewCountMax < cornerSet.viewCount()) {
+        std::vector<int> selected;
+        CalibrationCoverage::selectViews(cornerSet, patternSize, imageSize.width, imageSize.height, viewCountMax, selected);
+        for (int s : selected) cornerSetViews.push_back(found[s]);
+        cornerSet = cornerSet.subset(selected);
+        ARLOGi("Using %d views, chosen for coverage.\n", cornerSet.viewCount());
+    } else {
+        cornerSetViews = found;
+    }
+    for (int index : cornerSetViews) views[index].used = true;
+
+    //
+    // Calibrate and save.
+    //
+
+    ARParam param;
+    ARdouble err_min, err_avg, err_max;
+    Calibration::IntrinsicsEstimate estimate;
+    CalibrationResiduals residuals; // Of the views used, in their order in cornerSet.
+    if (robust) {
+        std::vector<CalibrationRejectedView> rejected;
+        calcRobust(cornerSet.viewCount(), patternType, patternSize, patternSpacing, cornerSet, imageSize.width, imageSize.height, &param, &err_min, &err_avg, &err_max, &rejected, &estimate, &residuals);
+        std::vector<bool> reject(cornerSet.viewCount(), false);
+        for (const CalibrationRejectedView& r : rejected) {
+            BatchView& view = views[cornerSetViews[r.index]];
+            view.used = false;
+            view.rejectReason = r.reason;
+            reject[r.index] = true;
+            ARLOG("Rejected view '%s': %s.\n", view.name.c_str(), r.reason.c_str());
+        }
+        std::vector<int> kept;
+        std::vector<int> keptViews;
+        for (int k = 0; k < cornerSet.viewCount(); k++) {
+            if (reject[k]) continue;
+            kept.push_back(k);
+            keptViews.push_back(cornerSetViews[k]);
+        }
+        cornerSet = cornerSet.subset(kept);
+        cornerSetViews.swap(keptViews);
+    } else {
+        calc(cornerSet.viewCount(), patternType, patternSize, patternSpacing, cornerSet, imageSize.width, imageSize.height, &param, &err_min, &err_avg, &err_max, &estimate, &residuals);
+    }
+    for (int k = 0; k < (int)cornerSetViews.size() && k < (int)residuals.viewErr.size(); k++) views[cornerSetViews[k]].err = residuals.viewErr[k];
+    ARLOG("Error min=%.3f, avg=%.3f, max=%.3f [pixel]\n", err_min, err_avg, err_max);
+    
+    Calibration::Uncertainty uncertainty;
+    bool uncertaintyValid = false;
+    if (uncertaintyEnabled) {
+        if (!uncertaintySampleCount) uncertaintySampleCount = (uncertaintyMethod == Calibration::UncertaintyMethod::BOOTSTRAP ? BATCH_BOOTSTRAP_SAMPLES_DEFAULT : BATCH_KFOLD_FOLDS_DEFAULT);
+        uncertaintyValid = calcUncertainty(patternType, patternSize, patternSpacing, cornerSet, imageSize.width, imageSize.height, estimate, uncertaintyMethod, uncertaintySampleCount, &uncertainty);
+        if (uncertaintyValid) {
+            ARLOG("Std. dev. (k1 k2 p1 p2 fx fy x0 y0 s): %f %f %f %f %f %f %f %f %f\n", uncertainty.distFactorStdDev[0], uncertainty.distFactorStdDev[1], uncertainty.distFactorStdDev[2], uncertainty.distFactorStdDev[3],
+                  uncertainty.distFactorStdDev[4], uncertainty.distFactorStdDev[5], uncertainty.distFactorStdDev[6], uncertainty.distFactorStdDev[7], uncertainty.distFactorStdDev[8]);
+        }
+    }
+
+    if (arParamSave(outputPath, 1, &param) < 0) {
+        ARLOGe("Error writing camera parameters to '%s'.\n", outputPath);
+        return (1);
+    }
+    ARLOGi("Wrote camera parameters to '%s'.\n", outputPath);
+
+    if (mapPath) {
+        UndistortMap map;
+        if (!map.create(&param, true) || !map.save(mapPath)) return (1);
+        ARLOGi("Wrote undistortion map to '%s'.\n", mapPath);
+    }
+
+    if (reportPath) {
+        if (!writeReport(reportPath, input, patternType, patternSize, patternSpacing, imageSize, views, &param, err_min, err_avg, err_max, (uncertaintyValid ? &uncertainty : NULL))) return (1);
+        ARLOGi("Wrote report to '%s'.\n", reportPath);
+    }
+
+    return (0);
+}
+
+static void usage(char *com)
+{
+    ARLOG("Usage: %s [options] <image directory | video file>\n", com);
+    ARLOG("Options:\n");
+    ARLOG("  -pattern=chessboard|circles|acircles: specify the calibration pattern type.\n");
+    ARLOG("  -cornerx=n: specify the number of corners on the pattern in X direction.\n");
+    ARLOG("  -cornery=n: specify the number of corners on the pattern in Y direction.\n");
+    ARLOG("  -pattwidth=n: specify the spacing of the pattern's corners.\n");
+    ARLOG("  -views=n: use at most n views, chosen for coverage of the image and range of poses. 0 uses all.\n");
+    ARLOG("  -videostep=n: search every nth frame of a video file. Default is 10.\n");
+    ARLOG("  -threads=n: number of corner finding threads. 0 uses one per CPU.\n");
+    ARLOG("  -robust: reject views whose error is an outlier, and recalibrate without them.\n");
+    ARLOG("  -solver=opencv|bundle: solve with cv::calibrateCamera() (the default), or with the sparse bundle solver,\n");
+    ARLOG("      which is much faster for 50 or more views.\n");
+    ARLOG("  -uncertainty=bootstrap|kfold: estimate the standard deviation of each camera parameter by resampling the views.\n");
+    ARLOG("  -samples=n: number of bootstrap resamples (default %d), or folds (default %d), for -uncertainty.\n", BATCH_BOOTSTRAP_SAMPLES_DEFAULT, BATCH_KFOLD_FOLDS_DEFAULT);
+    ARLOG("  -o <file>: write camera parameters to file. Default is '" SAVE_FILENAME "'.\n");
+    ARLOG("  --map <file>: also write an undistortion map (." UNDISTORT_MAP_EXTENSION ") for the calibrated resolution.\n");
+    ARLOG("  --report <file>: write a report of views and errors to file.\n");
+    ARLOG("  -h -help --help: show this message\n");
+    exit(0);
+}
+
+static bool isImageFile(const char *name)
+{
+    static const char *exts[] = {"jpg", "jpeg", "png", "bmp", "tif", "tiff", "pgm", "ppm"};
+    const char *dot = strrchr(name, '.');
+    if (!dot) return false;
+    for (size_t i = 0; i < sizeof(exts)/sizeof(exts[0]); i++) {
+        if (strcasecmp(dot + 1, exts[i]) == 0) return true;
+    }
+    return false;
+}
+
+static bool listImages(const char *dir, std::vector<BatchView>& views)
+{
+    DIR *d = opendir(dir);
+    if (!d) {
+        ARLOGe("Error: unable to read directory '%s'.\n", dir);
+        return false;
+    }
+    std::vector<std::string> names;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        if (entry->d_name[0] != '.' && isImageFile(entry->d_name)) names.push_back(std::string(dir) + "/" + entry->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+
+    for (const std::string& name : names) {
+        BatchView view;
+        view.name = name;
+        view.status = BATCH_VIEW_PENDING;
+        view.used = false;
+        view.err = -1.0;
+        views.push_back(view);
+    }
+    return true;
+}
+
+// Worker thread.
+static void *batchWorker(THREAD_HANDLE_T *threadHandle)
+{
+    BatchWork *work = (BatchWork *)threadGetArg(threadHandle);
+    std::vector<cv::Mat> pyramid; // Decimated images. Allocated on first use, then reused.
+
+    while (threadStartWait(threadHandle) == 0) {
+        int i;
+        while ((i = work->next.fetch_add(1)) < work->end) {
+            BatchView& view = (*work->views)[i];
+            cv::Mat image = (view.image.empty() ? cv::imread(view.name, cv::IMREAD_GRAYSCALE) : view.image);
+            if (image.empty()) {
+                view.status = BATCH_VIEW_UNREADABLE;
+                continue;
+            }
+            view.size = image.size();
+            view.status = (Calibration::findCornersInImage(image, work->patternType, work->patternSize, pyramid, view.corners) ? BATCH_VIEW_FOUND : BATCH_VIEW_NOT_FOUND);
+            view.image.release(); // Only the corners are needed from here on.
+        }
+        threadEndSignal(threadHandle);
+    }
+    return (NULL);
+}
+
+static void processViews(BatchWork *work, const int begin, const int end)
+{
+    if (begin >= end) return;
+    work->next = begin;
+    work->end = end;
+    for (THREAD_HANDLE_T *worker : gWorkers) threadStartSignal(worker);
+    for (THREAD_HANDLE_T *worker : gWorkers) threadEndWait(worker);
+}
+
+static void stopWorkers(void)
+{
+    for (int i = 0; i < (int)gWorkers.size(); i++) {
+        threadWaitQuit(gWorkers[i]);
+        threadFree(&gWorkers[i]);
+    }
+    gWorkers.clear();
+}
+
+static bool writeReport(const char *path, const char *input, const Calibration::CalibrationPatternType patternType, const cv::Size patternSize, const float patternSpacing, const cv::Size imageSize, const std::vector<BatchView>& views, const ARParam *param, const ARdouble err_min, const ARdouble err_avg, const ARdouble err_max, const Calibration::Uncertainty *uncertainty)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        ARLOGe("Error: unable to open report file '%s' for writing.\n", path);
+        return false;
+    }
+
+    int counts[BATCH_VIEW_SIZE_MISMATCH + 1] = {0};
+    int used = 0, rejected = 0;
+    for (const BatchView& view : views) {
+        counts[view.status]++;
+        if (view.used) used++;
+        if (!view.rejectReason.empty()) rejected++;
+    }
+    static const char *statusNames[] = {"pending", "unreadable", "not found", "found", "size mismatch"};
+    const char *patternTypeName = (patternType == Calibration::CalibrationPatternType::CHESSBOARD ? "chessboard" : (patternType == Calibration::CalibrationPatternType::CIRCLES_GRID ? "circles" : "asymmetric circles"));
+
+    fprintf(fp, "# ARToolKit6 camera calibration batch report\n");
+    fprintf(fp, "input: %s\n", input);
+    fprintf(fp, "pattern: %s %dx%d, spacing %.2f\n", patternTypeName, patternSize.width, patternSize.height, patternSpacing);
+    fprintf(fp, "image size: %dx%d\n", imageSize.width, imageSize.height);
+    fprintf(fp, "views: %d searched, %d found, %d not found, %d unreadable, %d size mismatch, %d used, %d rejected\n", (int)views.size(), counts[BATCH_VIEW_FOUND], counts[BATCH_VIEW_NOT_FOUND], counts[BATCH_VIEW_UNREADABLE], counts[BATCH_VIEW_SIZE_MISMATCH], used, rejected);
+    fprintf(fp, "error [pixel]: min %.3f, avg %.3f, max %.3f\n", err_min, err_avg, err_max);
+    fprintf(fp, "distortion (k1 k2 p1 p2 fx fy x0 y0 s): %f %f %f %f %f %f %f %f %f\n", param->dist_factor[0], param->dist_factor[1], param->dist_factor[2], param->dist_factor[3], param->dist_factor[4], param->dist_factor[5], param->dist_factor[6], param->dist_factor[7], param->dist_factor[8]);
+    if (uncertainty) {
+        fprintf(fp, "std. dev. (%s, %d samples): %f %f %f %f %f %f %f %f %f\n", (uncertainty->method == Calibration::UncertaintyMethod::BOOTSTRAP ? "bootstrap" : "k-fold"), uncertainty->sampleCount,
+                uncertainty->distFactorStdDev[0], uncertainty->distFactorStdDev[1], uncertainty->distFactorStdDev[2], uncertainty->distFactorStdDev[3], uncertainty->distFactorStdDev[4],
+                uncertainty->distFactorStdDev[5], uncertainty->distFactorStdDev[6], uncertainty->distFactorStdDev[7], uncertainty->distFactorStdDev[8]);
+    }
+    fprintf(fp, "\n# view, status, used, error [pixel]\n");
+    for (const BatchView& view : views) {
+        if (!view.rejectReason.empty()) fprintf(fp, "%s, %s, rejected: %s\n", view.name.c_str(), statusNames[view.status], view.rejectReason.c_str());
+        else if (view.used && !(view.err < 0.0)) fprintf(fp, "%s, %s, yes, %.3f\n", view.name.c_str(), statusNames[view.status], view.err);
+        else fprintf(fp, "%s, %s, %s\n", view.name.c_str(), statusNames[view.status], (view.used ? "yes" : "no"));
+    }
+
+    fclose(fp);
+    return true;
+}
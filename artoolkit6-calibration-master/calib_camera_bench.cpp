@@ -0,0 +1,546 @@
+/*
+ *  calib_camera_bench.cpp
+ *  ARToolKit6
+ *
+ *  Benchmarks of the camera calibration hot paths: corner finding, corner refinement, and calibration.
+ *  Results are written as JSON, for comparison between builds.
+ *
+ *  Run with "--help" parameter to see usage.
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <float.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <AR6/AR/ar.h>
+#include <opencv2/core/version.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include "Calibration.hpp"
+#include "FrameSequence.hpp"
+#include "calc.hpp"
+#include "BundleSolver.hpp"
+
+// ============================================================================
+//	Constants
+// ============================================================================
+
+#define      BENCH_FORMAT_VERSION          1
+#define      BENCH_POSE_COUNT              8 // Distinct synthetic views of the pattern, cycled through.
+#define      BENCH_ITERATIONS_DEFAULT      48 // Timed calls per image benchmark.
+#define      BENCH_WARMUP_ITERATIONS       2 // Untimed calls before each image benchmark.
+#define      BENCH_SEED                    0x41523643 // Fixed, so that every run sees the same images.
+#define      BENCH_IMAGE_NOISE_SIGMA       2.0 // Grey levels.
+#define      BENCH_IMAGE_BLUR_SIGMA        0.7 // Pixels.
+#define      BENCH_REFINE_PERTURBATION     0.75f // Pixels. Corners are moved up to this far before refinement.
+#define      BENCH_CALC_WIDTH              1280
+#define      BENCH_CALC_HEIGHT             720
+#define      BENCH_CALC_NOISE_SIGMA        0.2 // Pixels, added to projected corners.
+#define      BENCH_OPENCV_SOLVE_VIEWS_MAX  300 // cv::calibrateCamera()'s dense solve takes minutes beyond this.
+// How closely the bundle solver's solution must agree with cv::calibrateCamera()'s on the same views.
+#define      BENCH_PARITY_FOCAL_TOLERANCE  1e-3 // Relative.
+#define      BENCH_PARITY_PRINCIPAL_POINT_TOLERANCE 0.5 // Pixels.
+#define      BENCH_PARITY_DISTORTION_TOLERANCE 1e-2 // Absolute, for each of k1, k2, p1, p2.
+#define      BENCH_PARITY_RMS_TOLERANCE    1e-2 // Relative.
+
+// ============================================================================
+//	Types
+// ============================================================================
+
+typedef struct {
+    const char *name;
+    int width;
+    int height;
+} BenchResolution;
+
+typedef struct {
+    const char *name;
+    Calibration::CalibrationPatternType type;
+    cv::Size size;
+    float spacing;
+} BenchPattern;
+
+// Latencies of one benchmark, in milliseconds.
+typedef struct {
+    std::string stage;
+    std::string source; // "synthetic" or "sequence".
+    std::string pattern;
+    int patternWidth;
+    int patternHeight;
+    int width;
+    int height;
+    int views; // For calc, the number of views calibrated. Otherwise 0.
+    int found; // Calls which found the pattern, for corner finding. Otherwise -1.
+    std::vector<double> samples;
+} BenchResult;
+
+static const BenchResolution kResolutions[] = {
+    {"VGA", 640, 480},
+    {"720p", 1280, 720},
+    {"1080p", 1920, 1080},
+    {"4K", 3840, 2160}
+};
+
+static const BenchPattern kPatterns[] = {
+    {"chessboard", Calibration::CalibrationPatternType::CHESSBOARD, cv::Size(7, 5), 30.0f},
+    {"chessboard", Calibration::CalibrationPatternType::CHESSBOARD, cv::Size(9, 6), 25.0f},
+    {"circles", Calibration::CalibrationPatternType::CIRCLES_GRID, cv::Size(7, 5), 30.0f},
+    {"acircles", Calibration::CalibrationPatternType::ASYMMETRIC_CIRCLES_GRID, cv::Size(4, 11), 20.0f}
+};
+
+static const int kCalcViewCounts[] = {10, 30, 100, 300, 1000};
+
+// ============================================================================
+//	Function prototypes
+// ============================================================================
+
+static void usage(char *com);
+static double elapsedMs(const std::chrono::steady_clock::time_point& start);
+static void cameraForSize(const int width, const int height, cv::Mat& cameraMatrix, cv::Mat& distCoeffs);
+static void randomPose(cv::RNG& rng, const BenchPattern& pattern, const double distance, cv::Mat& rvec, cv::Mat& tvec);
+static cv::Mat renderPattern(const BenchPattern& pattern, const int width, const int height, cv::RNG& rng);
+static void benchImages(const std::vector<cv::Mat>& images, const BenchPattern& pattern, const char *source, const int iterations, std::vector<BenchResult>& results);
+static bool benchCalc(const BenchPattern& pattern, const int viewCount, const int iterations, std::vector<BenchResult>& results);
+static bool benchSolvers(const BenchPattern& pattern, const CornerSet& cornerSet, const int iterations, std::vector<BenchResult>& results);
+static bool benchSequence(const char *path, const BenchPattern& pattern, const int iterations, std::vector<BenchResult>& results);
+static bool writeJSON(FILE *fp, const std::vector<BenchResult>& results);
+
+// ============================================================================
+//	Functions
+// ============================================================================
+
+int main(int argc, char *argv[])
+{
+    const char *patternName = NULL;
+    int resolutionMax = 0;
+    int iterations = BENCH_ITERATIONS_DEFAULT;
+    int calcViewsMax = 1000;
+    bool doImages = true;
+    bool doCalc = true;
+    bool parityOK = true;
+    const char *sequencePath = NULL;
+    const char *outputPath = NULL;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0]);
+        } else if (strncmp(argv[i], "-pattern=", 9) == 0) {
+            patternName = &(argv[i][9]);
+            if (strcmp(patternName, "chessboard") != 0 && strcmp(patternName, "circles") != 0 && strcmp(patternName, "acircles") != 0) usage(argv[0]);
+        } else if (strncmp(argv[i], "-maxwidth=", 10) == 0) {
+            if (sscanf(&(argv[i][10]), "%d", &resolutionMax) != 1 || resolutionMax < 0) usage(argv[0]);
+        } else if (strncmp(argv[i], "-iterations=", 12) == 0) {
+            if (sscanf(&(argv[i][12]), "%d", &iterations) != 1 || iterations <= 0) usage(argv[0]);
+        } else if (strncmp(argv[i], "-calcviews=", 11) == 0) {
+            if (sscanf(&(argv[i][11]), "%d", &calcViewsMax) != 1 || calcViewsMax < 0) usage(argv[0]);
+        } else if (strcmp(argv[i], "--no-images") == 0) {
+            doImages = false;
+        } else if (strcmp(argv[i], "--no-calc") == 0) {
+            doCalc = false;
+        } else if (strcmp(argv[i], "--sequence") == 0 && i + 1 < argc) {
+            sequencePath = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else {
+            ARLOGe("Error: invalid command line argument '%s'.\n", argv[i]);
+            usage(argv[0]);
+        }
+    }
+
+    // Keep calc()'s logging out of the results when they go to stdout.
+    if (!outputPath) arLogLevel = AR_LOG_LEVEL_ERROR;
+
+    std::vector<BenchResult> results;
+    cv::RNG rng(BENCH_SEED);
+
+    for (const BenchPattern& pattern : kPatterns) {
+        if (patternName && strcmp(patternName, pattern.name) != 0) continue;
+
+        if (doImages) {
+            for (const BenchResolution& resolution : kResolutions) {
+                if (resolutionMax && resolution.width > resolutionMax) continue;
+                ARLOGi("Benchmarking %s %dx%d at %s.\n", pattern.name, pattern.size.width, pattern.size.height, resolution.name);
+                std::vector<cv::Mat> images;
+                for (int pose = 0; pose < BENCH_POSE_COUNT; pose++) images.push_back(renderPattern(pattern, resolution.width, resolution.height, rng));
+                benchImages(images, pattern, "synthetic", iterations, results);
+            }
+        }
+
+        if (doCalc) {
+            for (int viewCount : kCalcViewCounts) {
+                if (viewCount > calcViewsMax) continue;
+                ARLOGi("Benchmarking calc() with %d views of %s %dx%d.\n", viewCount, pattern.name, pattern.size.width, pattern.size.height);
+                if (!benchCalc(pattern, viewCount, std::max(1, std::min(10, 300 / viewCount)), results)) parityOK = false;
+            }
+        }
+
+        if (sequencePath) {
+            if (!benchSequence(sequencePath, pattern, iterations, results)) return (1);
+        }
+    }
+
+    FILE *fp = stdout;
+    if (outputPath && !(fp = fopen(outputPath, "w"))) {
+        ARLOGe("Error opening output file '%s'.\n", outputPath);
+        return (1);
+    }
+    bool ok = writeJSON(fp, results);
+    if (fp != stdout) {
+        if (fclose(fp) != 0) ok = false;
+        if (ok) ARLOGi("Benchmark results written to '%s'.\n", outputPath);
+    }
+    if (!parityOK) ARLOGe("Error: the bundle solver and cv::calibrateCamera() disagreed.\n");
+    return (ok && parityOK ? 0 : 1);
+}
+
+static void usage(char *com)
+{
+    ARLOG("Usage: %s [options]\n", com);
+    ARLOG("Options:\n");
+    ARLOG("  -pattern=chessboard|circles|acircles: benchmark only this pattern type.\n");
+    ARLOG("  -maxwidth=n: skip image sizes wider than n pixels.\n");
+    ARLOG("  -iterations=n: timed calls per corner finding benchmark. Default is %d.\n", BENCH_ITERATIONS_DEFAULT);
+    ARLOG("  -calcviews=n: skip calibrations of more than n views. Default is 1000.\n");
+    ARLOG("  --no-images: skip the corner finding and refinement benchmarks on synthetic images.\n");
+    ARLOG("  --no-calc: skip the calibration benchmarks, including the check that the bundle solver agrees with cv::calibrateCamera().\n");
+    ARLOG("  --sequence <file>: also benchmark a recorded frame sequence (." FRAME_SEQUENCE_EXTENSION ") with each pattern type.\n");
+    ARLOG("  -o <file>: write JSON results to file. Default is stdout.\n");
+    ARLOG("  -h -help --help: show this message\n");
+    exit(0);
+}
+
+static double elapsedMs(const std::chrono::steady_clock::time_point& start)
+{
+    return (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
+
+// A plausible camera: a horizontal field of view of about 60 degrees, and mild barrel distortion.
+static void cameraForSize(const int width, const int height, cv::Mat& cameraMatrix, cv::Mat& distCoeffs)
+{
+    const double f = 0.87 * width;
+    cameraMatrix = (cv::Mat_<double>(3, 3) << f, 0.0, 0.5 * (width - 1), 0.0, f, 0.5 * (height - 1), 0.0, 0.0, 1.0);
+    distCoeffs = (cv::Mat_<double>(1, 4) << -0.12, 0.05, 0.0005, -0.0003);
+}
+
+// A pose of the pattern in front of the camera, tilted up to about 35 degrees and offset from the centre of view.
+static void randomPose(cv::RNG& rng, const BenchPattern& pattern, const double distance, cv::Mat& rvec, cv::Mat& tvec)
+{
+    std::vector<cv::Point3f> objectPoints;
+    calcChessboardCorners(pattern.type, pattern.size, pattern.spacing, objectPoints);
+    const double cx = 0.5 * objectPoints.back().x, cy = 0.5 * objectPoints.back().y; // The last point is the farthest from the origin.
+
+    rvec = (cv::Mat_<double>(3, 1) << rng.uniform(-0.6, 0.6), rng.uniform(-0.6, 0.6), rng.uniform(-0.3, 0.3));
+    // Place the pattern centre at a random point near the optical axis.
+    cv::Mat R;
+    cv::Rodrigues(rvec, R);
+    cv::Mat centre = R * (cv::Mat_<double>(3, 1) << cx, cy, 0.0);
+    tvec = (cv::Mat_<double>(3, 1) << rng.uniform(-0.15, 0.15) * distance - centre.at<double>(0), rng.uniform(-0.1, 0.1) * distance - centre.at<double>(1), distance - centre.at<double>(2));
+}
+
+// Render the pattern seen by the camera from a random pose, blurred and with sensor noise.
+static cv::Mat renderPattern(const BenchPattern& pattern, const int width, const int height, cv::RNG& rng)
+{
+    std::vector<cv::Point3f> objectPoints;
+    calcChessboardCorners(pattern.type, pattern.size, pattern.spacing, objectPoints);
+    const float s = pattern.spacing;
+    const float extentX = objectPoints.back().x, extentY = objectPoints.back().y;
+    const float margin = 1.5f * s;
+
+    // Draw the pattern face-on, at about the resolution it will be seen at.
+    const float scale = (float)width / (extentX + 2.0f*margin);
+    cv::Mat board((int)((extentY + 2.0f*margin) * scale), (int)((extentX + 2.0f*margin) * scale), CV_8UC1, cv::Scalar(255));
+    if (pattern.type == Calibration::CalibrationPatternType::CHESSBOARD) {
+        // Corners are at the interior intersections, so there is one more square than corners in each direction.
+        for (int j = -1; j < pattern.size.height; j++) {
+            for (int i = -1; i < pattern.size.width; i++) {
+                if ((i + j) & 1) continue;
+                cv::Point p0(cvRound((margin + i*s) * scale), cvRound((margin + j*s) * scale));
+                cv::Point p1(cvRound((margin + (i + 1)*s) * scale) - 1, cvRound((margin + (j + 1)*s) * scale) - 1);
+                cv::rectangle(board, p0, p1, cv::Scalar(0), cv::FILLED);
+            }
+        }
+    } else {
+        const float radius = (pattern.type == Calibration::CalibrationPatternType::ASYMMETRIC_CIRCLES_GRID ? 0.45f : 0.3f) * s;
+        for (const cv::Point3f& p : objectPoints) {
+            cv::circle(board, cv::Point(cvRound((margin + p.x) * scale * 16.0f), cvRound((margin + p.y) * scale * 16.0f)), cvRound(radius * scale * 16.0f), cv::Scalar(0), cv::FILLED, cv::LINE_AA, 4);
+        }
+    }
+
+    // Project the board's outline to find where it falls in the image, and warp it there. Lens distortion is
+    // included only at the outline, which is enough to exercise the corner finder realistically.
+    cv::Mat cameraMatrix, distCoeffs, rvec, tvec;
+    cameraForSize(width, height, cameraMatrix, distCoeffs);
+    randomPose(rng, pattern, cameraMatrix.at<double>(0, 0) * (extentX + 2.0f*margin) / (0.7 * width), rvec, tvec);
+    std::vector<cv::Point3f> outline = {
+        cv::Point3f(-margin, -margin, 0.0f), cv::Point3f(extentX + margin, -margin, 0.0f),
+        cv::Point3f(extentX + margin, extentY + margin, 0.0f), cv::Point3f(-margin, extentY + margin, 0.0f)
+    };
+    std::vector<cv::Point2f> outlineImage;
+    cv::projectPoints(outline, rvec, tvec, cameraMatrix, distCoeffs, outlineImage);
+    std::vector<cv::Point2f> outlineBoard = {
+        cv::Point2f(0.0f, 0.0f), cv::Point2f((float)board.cols, 0.0f),
+        cv::Point2f((float)board.cols, (float)board.rows), cv::Point2f(0.0f, (float)board.rows)
+    };
+    cv::Mat image;
+    cv::warpPerspective(board, image, cv::getPerspectiveTransform(outlineBoard, outlineImage), cv::Size(width, height), cv::INTER_AREA, cv::BORDER_CONSTANT, cv::Scalar(160));
+
+    cv::GaussianBlur(image, image, cv::Size(0, 0), BENCH_IMAGE_BLUR_SIGMA);
+    cv::Mat noise(height, width, CV_16SC1);
+    rng.fill(noise, cv::RNG::NORMAL, 0.0, BENCH_IMAGE_NOISE_SIGMA);
+    cv::Mat noisy;
+    image.convertTo(noisy, CV_16SC1);
+    noisy += noise;
+    noisy.convertTo(image, CV_8UC1);
+    return image;
+}
+
+// Time Calibration::findCornersInImage() (the corner finder workers' search and refinement), and separately
+// Calibration::refineCorners() (refinement alone, from perturbed corners), cycling through the images.
+static void benchImages(const std::vector<cv::Mat>& images, const BenchPattern& pattern, const char *source, const int iterations, std::vector<BenchResult>& results)
+{
+    BenchResult find = {"find_corners", source, pattern.name, pattern.size.width, pattern.size.height, images[0].cols, images[0].rows, 0, 0, std::vector<double>()};
+    BenchResult refine = {"refine_corners", source, pattern.name, pattern.size.width, pattern.size.height, images[0].cols, images[0].rows, 0, -1, std::vector<double>()};
+    std::vector<cv::Mat> pyramid;
+    std::vector<cv::Point2f> corners;
+    std::vector<std::vector<cv::Point2f> > found(images.size());
+    cv::RNG rng(BENCH_SEED);
+
+    for (int i = 0; i < BENCH_WARMUP_ITERATIONS; i++) Calibration::findCornersInImage(images[i % images.size()], pattern.type, pattern.size, pyramid, corners);
+    find.samples.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+        const size_t index = i % images.size();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool ok = Calibration::findCornersInImage(images[index], pattern.type, pattern.size, pyramid, corners);
+        find.samples.push_back(elapsedMs(start));
+        if (ok) {
+            find.found++;
+            found[index] = corners;
+        }
+    }
+    results.push_back(find);
+
+    if (find.found == 0) return;
+    refine.samples.reserve(iterations);
+    for (int i = 0, index = 0; i < iterations; i++) {
+        while (found[index].empty()) index = (index + 1) % (int)images.size();
+        corners = found[index];
+        for (cv::Point2f& c : corners) {
+            c.x += rng.uniform(-BENCH_REFINE_PERTURBATION, BENCH_REFINE_PERTURBATION);
+            c.y += rng.uniform(-BENCH_REFINE_PERTURBATION, BENCH_REFINE_PERTURBATION);
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Calibration::refineCorners(images[index], corners);
+        refine.samples.push_back(elapsedMs(start));
+        index = (index + 1) % (int)images.size();
+    }
+    results.push_back(refine);
+}
+
+// Time calc() on viewCount views synthesised by projecting the pattern through a known camera.
+// Returns false if the solvers timed by benchSolvers() disagreed.
+static bool benchCalc(const BenchPattern& pattern, const int viewCount, const int iterations, std::vector<BenchResult>& results)
+{
+    BenchResult result = {"calc", "synthetic", pattern.name, pattern.size.width, pattern.size.height, BENCH_CALC_WIDTH, BENCH_CALC_HEIGHT, viewCount, -1, std::vector<double>()};
+    cv::RNG rng(BENCH_SEED + viewCount);
+    cv::Mat cameraMatrix, distCoeffs;
+    cameraForSize(BENCH_CALC_WIDTH, BENCH_CALC_HEIGHT, cameraMatrix, distCoeffs);
+    std::vector<cv::Point3f> objectPoints;
+    calcChessboardCorners(pattern.type, pattern.size, pattern.spacing, objectPoints);
+    const double extent = std::max(objectPoints.back().x, objectPoints.back().y);
+
+    CornerSet cornerSet(pattern.size.area());
+    cornerSet.reserve(viewCount);
+    while (cornerSet.viewCount() < viewCount) {
+        cv::Mat rvec, tvec;
+        randomPose(rng, pattern, cameraMatrix.at<double>(0, 0) * extent / (rng.uniform(0.35, 0.8) * BENCH_CALC_WIDTH), rvec, tvec);
+        std::vector<cv::Point2f> corners;
+        cv::projectPoints(objectPoints, rvec, tvec, cameraMatrix, distCoeffs, corners);
+        bool inside = true;
+        for (cv::Point2f& c : corners) {
+            c.x += (float)rng.gaussian(BENCH_CALC_NOISE_SIGMA);
+            c.y += (float)rng.gaussian(BENCH_CALC_NOISE_SIGMA);
+            if (c.x < 0.0f || c.y < 0.0f || c.x >= BENCH_CALC_WIDTH || c.y >= BENCH_CALC_HEIGHT) inside = false;
+        }
+        if (inside) cornerSet.push_back(corners);
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        ARParam param;
+        ARdouble err_min, err_avg, err_max;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        calc(viewCount, pattern.type, pattern.size, pattern.spacing, cornerSet, BENCH_CALC_WIDTH, BENCH_CALC_HEIGHT, &param, &err_min, &err_avg, &err_max);
+        result.samples.push_back(elapsedMs(start));
+    }
+    results.push_back(result);
+    
+    return (benchSolvers(pattern, cornerSet, iterations, results));
+}
+
+// Time the bundle solver and cv::calibrateCamera() on the same views, from a cold start, and check that their
+// solutions agree within the BENCH_PARITY_* tolerances. Returns false if they don't. Views beyond
+// BENCH_OPENCV_SOLVE_VIEWS_MAX are only timed with the bundle solver.
+static bool benchSolvers(const BenchPattern& pattern, const CornerSet& cornerSet, const int iterations, std::vector<BenchResult>& results)
+{
+    const int viewCount = cornerSet.viewCount();
+    const cv::Size imageSize(BENCH_CALC_WIDTH, BENCH_CALC_HEIGHT);
+    const cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, DBL_EPSILON);
+    std::vector<cv::Point3f> objectPoints;
+    calcChessboardCorners(pattern.type, pattern.size, pattern.spacing, objectPoints);
+    
+    BenchResult bundle = {"solve_bundle", "synthetic", pattern.name, pattern.size.width, pattern.size.height, BENCH_CALC_WIDTH, BENCH_CALC_HEIGHT, viewCount, -1, std::vector<double>()};
+    cv::Mat bundleCameraMatrix, bundleDistCoeffs;
+    double bundleRMS = 0.0;
+    for (int i = 0; i < iterations; i++) {
+        std::vector<cv::Mat> rvecs, tvecs;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bundleRMS = bundleCalibrateCamera(objectPoints, cornerSet, imageSize, bundleCameraMatrix, bundleDistCoeffs, rvecs, tvecs, false, criteria);
+        bundle.samples.push_back(elapsedMs(start));
+    }
+    results.push_back(bundle);
+    
+    if (viewCount > BENCH_OPENCV_SOLVE_VIEWS_MAX) return (true);
+    BenchResult opencv = {"solve_opencv", "synthetic", pattern.name, pattern.size.width, pattern.size.height, BENCH_CALC_WIDTH, BENCH_CALC_HEIGHT, viewCount, -1, std::vector<double>()};
+    const std::vector<std::vector<cv::Point3f> > objectPointSet(viewCount, objectPoints);
+    std::vector<std::vector<cv::Point2f> > imagePointSet;
+    cornerSet.copyViews(imagePointSet);
+    cv::Mat cameraMatrix, distCoeffs;
+    double rms = 0.0;
+    for (int i = 0; i < iterations; i++) {
+        std::vector<cv::Mat> rvecs, tvecs;
+        cameraMatrix = cv::Mat::eye(3, 3, CV_64F);
+        distCoeffs = cv::Mat::zeros(4, 1, CV_64F);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        rms = cv::calibrateCamera(objectPointSet, imagePointSet, imageSize, cameraMatrix, distCoeffs, rvecs, tvecs, cv::CALIB_FIX_K3|cv::CALIB_FIX_K4|cv::CALIB_FIX_K5, criteria);
+        opencv.samples.push_back(elapsedMs(start));
+    }
+    results.push_back(opencv);
+    
+    double focalDiff = 0.0, principalPointDiff = 0.0, distDiff = 0.0;
+    for (int j = 0; j < 2; j++) {
+        focalDiff = std::max(focalDiff, fabs(bundleCameraMatrix.at<double>(j, j) - cameraMatrix.at<double>(j, j))/cameraMatrix.at<double>(j, j));
+        principalPointDiff = std::max(principalPointDiff, fabs(bundleCameraMatrix.at<double>(j, 2) - cameraMatrix.at<double>(j, 2)));
+    }
+    for (int j = 0; j < 4; j++) distDiff = std::max(distDiff, fabs(bundleDistCoeffs.at<double>(j) - distCoeffs.at<double>(j)));
+    const double rmsDiff = fabs(bundleRMS - rms)/rms;
+    ARLOGi("Bundle solver vs. cv::calibrateCamera() with %d views: RMS %.6f vs. %.6f px; focal length differs by %.2g, principal point by %.3f px, distortion by %.2g.\n",
+           viewCount, bundleRMS, rms, focalDiff, principalPointDiff, distDiff);
+    // Written so that a NaN anywhere fails.
+    if (!(focalDiff <= BENCH_PARITY_FOCAL_TOLERANCE && principalPointDiff <= BENCH_PARITY_PRINCIPAL_POINT_TOLERANCE && distDiff <= BENCH_PARITY_DISTORTION_TOLERANCE && rmsDiff <= BENCH_PARITY_RMS_TOLERANCE)) {
+        ARLOGe("Error: bundle solver disagrees with cv::calibrateCamera() on %d views of %s %dx%d (tolerances: focal length %g, principal point %g px, distortion %g, RMS %g).\n",
+               viewCount, pattern.name, pattern.size.width, pattern.size.height, BENCH_PARITY_FOCAL_TOLERANCE, BENCH_PARITY_PRINCIPAL_POINT_TOLERANCE, BENCH_PARITY_DISTORTION_TOLERANCE, BENCH_PARITY_RMS_TOLERANCE);
+        return (false);
+    }
+    return (true);
+}
+
+// Time corner finding on every frame of a recorded sequence, and the full Calibration::frame() pipeline
+// (with its worker threads) replaying the sequence as fast as it will go.
+static bool benchSequence(const char *path, const BenchPattern& pattern, const int iterations, std::vector<BenchResult>& results)
+{
+    FrameSequenceReader reader;
+    if (!reader.open(path)) return false;
+    const int width = reader.getVideoWidth(), height = reader.getVideoHeight();
+
+    std::vector<cv::Mat> images;
+    for (int i = 0; i < reader.frameCount(); i++) {
+        AR2VideoBufferT *buff = reader.frameAt(i);
+        if (!buff) return false;
+        images.push_back(cv::Mat(height, width, CV_8UC1, buff->buffLuma).clone());
+    }
+    benchImages(images, pattern, "sequence", std::max(iterations, (int)images.size()), results);
+
+    // The pipeline. Each call to frame() is timed, which is the cost seen by the thread driving it.
+    BenchResult pipeline = {"pipeline_frame", "sequence", pattern.name, pattern.size.width, pattern.size.height, width, height, 0, -1, std::vector<double>()};
+    Calibration *calibration = new Calibration(pattern.type, 1, pattern.size, (int)pattern.spacing, width, height);
+    reader.rewind();
+    std::chrono::steady_clock::time_point pipelineStart = std::chrono::steady_clock::now();
+    while (!reader.atEnd()) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        calibration->frame(&reader);
+        pipeline.samples.push_back(elapsedMs(start));
+    }
+    const double pipelineMs = elapsedMs(pipelineStart);
+    ARLOGi("Pipeline: %d frames in %.1f ms, %lu submitted to corner finders, %lu dropped.\n", reader.frameCount(), pipelineMs, calibration->frameSubmittedCount(), calibration->frameDroppedCount());
+    pipeline.found = (int)calibration->frameSubmittedCount();
+    delete calibration;
+    results.push_back(pipeline);
+    return true;
+}
+
+static double percentile(const std::vector<double>& sorted, const double p)
+{
+    if (sorted.empty()) return 0.0;
+    const double rank = p * (double)(sorted.size() - 1);
+    const size_t lo = (size_t)rank;
+    const size_t hi = std::min(lo + 1, sorted.size() - 1);
+    return (sorted[lo] + (rank - (double)lo) * (sorted[hi] - sorted[lo]));
+}
+
+static bool writeJSON(FILE *fp, const std::vector<BenchResult>& results)
+{
+    char timestamp[32];
+    time_t now = time(NULL);
+    if (!strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now))) timestamp[0] = '\0';
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"format_version\": %d,\n", BENCH_FORMAT_VERSION);
+    fprintf(fp, "  \"timestamp\": \"%s\",\n", timestamp);
+    fprintf(fp, "  \"build\": {\"opencv\": \"%s\", \"compiler\": \"%s\", \"debug\": %s},\n", CV_VERSION,
+#if defined(__VERSION__)
+            __VERSION__,
+#else
+            "unknown",
+#endif
+#ifdef DEBUG
+            "true"
+#else
+            "false"
+#endif
+            );
+    fprintf(fp, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        std::vector<double> sorted = r.samples;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (double s : sorted) total += s;
+        const double mean = (sorted.empty() ? 0.0 : total / (double)sorted.size());
+        fprintf(fp, "    {\"stage\": \"%s\", \"source\": \"%s\", \"pattern\": \"%s\", \"pattern_size\": [%d, %d], \"image_size\": [%d, %d]",
+                r.stage.c_str(), r.source.c_str(), r.pattern.c_str(), r.patternWidth, r.patternHeight, r.width, r.height);
+        if (r.views) fprintf(fp, ", \"views\": %d", r.views);
+        if (r.found >= 0) fprintf(fp, ", \"%s\": %d", (r.stage == "pipeline_frame" ? "submitted" : "found"), r.found);
+        fprintf(fp, ", \"samples\": %d, \"latency_ms\": {\"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f}, \"throughput_per_s\": %.2f}%s\n",
+                (int)sorted.size(), (sorted.empty() ? 0.0 : sorted.front()), percentile(sorted, 0.5), percentile(sorted, 0.9), percentile(sorted, 0.99), (sorted.empty() ? 0.0 : sorted.back()), mean,
+                (total > 0.0 ? 1000.0 * (double)sorted.size() / total : 0.0), (i + 1 < results.size() ? "," : ""));
+    }
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+    return (ferror(fp) == 0);
+}
@@ -28,290 +28,417 @@
 #include "flow.hpp"
 
 #include <stdio.h> // asprintf()
+#include <math.h>
+#include <errno.h>
 #include <pthread.h>
-#include <Eden/EdenMessage.h>
+#include <sys/time.h>
 #include <AR6/AR/ar.h>
 
-//
-// Globals.
-//
-
-static bool gInited = false;
-static FLOW_STATE gState = FLOW_STATE_NOT_INITED;
-static pthread_mutex_t gStateLock;
-static pthread_mutex_t gEventLock;
-static pthread_cond_t gEventCond;
-static EVENT_t gEvent = EVENT_NONE;
-static EVENT_t gEventMask = EVENT_NONE;
-static pthread_t gThread;
-static int gThreadExitStatus;
-static bool gStop;
-
-// Completion callback.
-static FLOW_CALLBACK_t gCallback = NULL;
-static void *gCallbackUserdata = NULL;
-
 // Logging macros
 #define  LOG_TAG    "flow"
 
-// Status bar.
-#define STATUS_BAR_MESSAGE_BUFFER_LEN 128
-unsigned char statusBarMessage[STATUS_BAR_MESSAGE_BUFFER_LEN] = "";
-
-// Calibration inputs.
-static Calibration *gFlowCalib = nullptr;
-
-
-//
-// Function prototypes.
-//
-
-static void *flowThread(void *arg);
-static void flowSetEventMask(const EVENT_t eventMask);
+#define FLOW_STATUS_BAR_REFRESH_MS 250
 
 //
 // Functions.
 //
 
-bool flowInitAndStart(Calibration *calib, FLOW_CALLBACK_t callback, void *callback_userdata)
+Flow::Flow(Calibration *calib, FLOW_CALLBACK_t callback, void *callback_userdata) :
+    m_calib(calib),
+    m_stereoCalib(nullptr),
+    m_callback(callback),
+    m_stereoCallback(NULL),
+    m_callbackUserdata(callback_userdata),
+    m_running(false),
+    m_state(FLOW_STATE_NOT_INITED),
+    m_message(),
+    m_statusBarMessage(),
+    m_eventQueueHead(0),
+    m_eventQueueTail(0),
+    m_eventsCoalescedQueued(0),
+    m_eventMask(EVENT_NONE),
+    m_threadExitStatus(0),
+    m_stop(false)
 {
-    pthread_mutex_init(&gStateLock, NULL);
-    pthread_mutex_init(&gEventLock, NULL);
-    pthread_cond_init(&gEventCond, NULL);
-
-    // Calibration inputs.
-    gFlowCalib = calib;
-
-    // Completion callback.
-    gCallback = callback;
-    gCallbackUserdata = callback_userdata;
+    pthread_mutex_init(&m_stateLock, NULL);
+    pthread_mutex_init(&m_eventLock, NULL);
+    pthread_cond_init(&m_eventCond, NULL);
+}
 
-    gStop = false;
-    pthread_create(&gThread, NULL, flowThread, NULL);
+Flow::Flow(StereoCalibration *calib, FLOW_STEREO_CALLBACK_t callback, void *callback_userdata) :
+    Flow((Calibration *)nullptr, NULL, callback_userdata)
+{
+    m_stereoCalib = calib;
+    m_stereoCallback = callback;
+}
 
-    gInited = true;
+Flow::~Flow()
+{
+    stop();
+    pthread_mutex_destroy(&m_stateLock);
+    pthread_mutex_destroy(&m_eventLock);
+    pthread_cond_destroy(&m_eventCond);
+}
 
+bool Flow::start()
+{
+    if (m_running) return (false);
+    
+    m_stop = false;
+    m_eventQueueHead = 0;
+    m_eventQueueTail = 0;
+    m_eventsCoalescedQueued = 0;
+    if (pthread_create(&m_thread, NULL, flowThread, this) != 0) {
+        ARLOGe("Error starting flow thread.\n");
+        return (false);
+    }
+    m_running = true;
+    
     return (true);
 }
 
-bool flowStopAndFinal()
+bool Flow::stop()
 {
 	void *exit_status_p;		 // Pointer to return value from thread, will be filled in by pthread_join().
 
-	if (!gInited) return (false);
+	if (!m_running) return (false);
 
-	// Request stop and wait for join.
-	gStop = true;
-#ifndef ANDROID
-	pthread_cancel(gThread); // Not implemented on Android.
-#endif
+	// Request stop, wake the flow thread if it is waiting for an event, and wait for join.
+	m_stop = true;
+	pthread_mutex_lock(&m_eventLock);
+	pthread_cond_signal(&m_eventCond);
+	pthread_mutex_unlock(&m_eventLock);
 #ifdef DEBUG
-	ARLOGi("flowStopAndFinal(): Waiting for flowThread() to exit...\n");
+	ARLOGi("Flow::stop(): Waiting for flowThread() to exit...\n");
 #endif
-	pthread_join(gThread, &exit_status_p);
+	pthread_join(m_thread, &exit_status_p);
 #ifdef DEBUG
-#  ifndef ANDROID
-	ARLOGi("  done. Exit status was %d.\n",((exit_status_p == PTHREAD_CANCELED) ? 0 : *(int *)(exit_status_p))); // Contents of gThreadExitStatus.
-#  else
-	ARLOGi("  done. Exit status was %d.\n", *(int *)(exit_status_p)); // Contents of gThreadExitStatus.
-#  endif
+	ARLOGi("  done. Exit status was %d.\n", *(int *)(exit_status_p)); // Contents of m_threadExitStatus.
 #endif
-    
-    gFlowCalib = nullptr;
 
-	// Clean up.
-	pthread_mutex_destroy(&gStateLock);
-	pthread_mutex_destroy(&gEventLock);
-	pthread_cond_destroy(&gEventCond);
-	gState = FLOW_STATE_NOT_INITED;
-	gInited = false;
+	pthread_mutex_lock(&m_stateLock);
+	m_state = FLOW_STATE_NOT_INITED;
+	m_message.clear();
+	m_statusBarMessage.clear();
+	pthread_mutex_unlock(&m_stateLock);
+	m_running = false;
 
 	return true;
 }
 
-FLOW_STATE flowStateGet()
+FLOW_STATE Flow::state()
 {
 	FLOW_STATE ret;
 
-	if (!gInited) return (FLOW_STATE_NOT_INITED);
-
-	pthread_mutex_lock(&gStateLock);
-	ret = gState;
-	pthread_mutex_unlock(&gStateLock);
+	pthread_mutex_lock(&m_stateLock);
+	ret = m_state;
+	pthread_mutex_unlock(&m_stateLock);
 	return (ret);
 }
 
-static void flowStateSet(FLOW_STATE state)
+void Flow::stateSet(FLOW_STATE state)
 {
-	if (!gInited) return;
+	pthread_mutex_lock(&m_stateLock);
+	m_state = state;
+	pthread_mutex_unlock(&m_stateLock);
+}
 
-	pthread_mutex_lock(&gStateLock);
-	gState = state;
-	pthread_mutex_unlock(&gStateLock);
+bool Flow::message(char *buf, const size_t len)
+{
+    pthread_mutex_lock(&m_stateLock);
+    bool ret = !m_message.empty();
+    if (ret && len > 0) snprintf(buf, len, "%s", m_message.c_str());
+    pthread_mutex_unlock(&m_stateLock);
+    return (ret);
 }
 
-static void flowSetEventMask(const EVENT_t eventMask)
+bool Flow::statusBarMessage(char *buf, const size_t len)
 {
-	pthread_mutex_lock(&gEventLock);
-	gEventMask = eventMask;
-	pthread_mutex_unlock(&gEventLock);
+    pthread_mutex_lock(&m_stateLock);
+    bool ret = !m_statusBarMessage.empty();
+    if (ret && len > 0) snprintf(buf, len, "%s", m_statusBarMessage.c_str());
+    pthread_mutex_unlock(&m_stateLock);
+    return (ret);
 }
 
-bool flowHandleEvent(const EVENT_t event)
+void Flow::messageShow(const char *text)
 {
-	bool ret;
+    pthread_mutex_lock(&m_stateLock);
+    m_message = text;
+    pthread_mutex_unlock(&m_stateLock);
+}
 
-	if (!gInited) return false;
+void Flow::messageHide()
+{
+    pthread_mutex_lock(&m_stateLock);
+    m_message.clear();
+    pthread_mutex_unlock(&m_stateLock);
+}
 
-	pthread_mutex_lock(&gEventLock);
-	if ((event & gEventMask) == EVENT_NONE) {
-		ret = false; // not handled (discarded).
-	} else {
-		gEvent = event;
-		pthread_cond_signal(&gEventCond);
-		ret = true;
-	}
-	pthread_mutex_unlock(&gEventLock);
+void Flow::statusBarMessageSet(const char *text)
+{
+    pthread_mutex_lock(&m_stateLock);
+    if (text) m_statusBarMessage = text;
+    else m_statusBarMessage.clear();
+    pthread_mutex_unlock(&m_stateLock);
+}
 
-	return (ret);
+void Flow::setEventMask(const EVENT_t eventMask)
+{
+	m_eventMask = eventMask;
 }
 
-static EVENT_t flowWaitForEvent(void)
+bool Flow::handleEvent(const EVENT_t event)
 {
-	EVENT_t ret;
-
-	pthread_mutex_lock(&gEventLock);
-	while (gEvent == EVENT_NONE && !gStop) {
-#ifdef ANDROID
-        // Android "Bionic" libc doesn't implement cancelation, so need to let wait expire somewhat regularly.
-        const struct timespec twoSeconds = {2, 0};
-        pthread_cond_timedwait_relative_np(&gEventCond, &gEventLock, &twoSeconds);
-#else
-		pthread_cond_wait(&gEventCond, &gEventLock);
-#endif
+	if (!m_running || event == EVENT_NONE) return false;
+
+	// A condition already reported and not yet taken needn't be queued again.
+	if ((event & FLOW_EVENTS_COALESCED) && (m_eventsCoalescedQueued.fetch_or(event) & event)) return true;
+
+	const unsigned int tail = m_eventQueueTail.load(std::memory_order_relaxed);
+	if (tail - m_eventQueueHead.load(std::memory_order_acquire) == FLOW_EVENT_QUEUE_SIZE) {
+		ARLOGe("Flow event queue full; event %d discarded.\n", (int)event);
+		if (event & FLOW_EVENTS_COALESCED) m_eventsCoalescedQueued.fetch_and(~event);
+		return false;
 	}
-	ret = gEvent;
-	gEvent = EVENT_NONE; // Clear wait state.
-	pthread_mutex_unlock(&gEventLock);
+	m_eventQueue[tail & (FLOW_EVENT_QUEUE_SIZE - 1)] = event;
+	m_eventQueueTail.store(tail + 1, std::memory_order_release);
 
-	return (ret);
+	// Taking the lock means the flow thread is either not yet checking the queue, or already waiting.
+	pthread_mutex_lock(&m_eventLock);
+	pthread_cond_signal(&m_eventCond);
+	pthread_mutex_unlock(&m_eventLock);
+
+	return true;
 }
 
-static void flowThreadCleanup(void *arg)
+bool Flow::popEvent(EVENT_t *event_p)
 {
-	pthread_mutex_unlock(&gStateLock);
-    // Clear status bar.
-    statusBarMessage[0] = '\0';
+	const unsigned int head = m_eventQueueHead.load(std::memory_order_relaxed);
+	if (head == m_eventQueueTail.load(std::memory_order_acquire)) return false;
+	*event_p = m_eventQueue[head & (FLOW_EVENT_QUEUE_SIZE - 1)];
+	m_eventQueueHead.store(head + 1, std::memory_order_release);
+	if (*event_p & FLOW_EVENTS_COALESCED) m_eventsCoalescedQueued.fetch_and(~*event_p);
+	return true;
 }
 
-static void *flowThread(void *arg)
+void Flow::ignoreQueuedEvents(const EVENT_t events)
 {
-	bool captureDoneSinceBackButtonLastPressed;
-	EVENT_t event;
-	// TYPE* TYPE_INSTANCE = (TYPE *)arg; // Cast the thread start arg to the correct type.
+	// Only the flow thread reads the ring, and the sender never writes between head and tail, so the queued events
+	// can be blanked in place. Blanked slots are skipped when they are taken.
+	const unsigned int tail = m_eventQueueTail.load(std::memory_order_acquire);
+	for (unsigned int i = m_eventQueueHead.load(std::memory_order_relaxed); i != tail; i++) {
+		EVENT_t& event = m_eventQueue[i & (FLOW_EVENT_QUEUE_SIZE - 1)];
+		if (event & events) {
+			ARLOGd("Flow ignoring queued event %d.\n", (int)event);
+			if (event & FLOW_EVENTS_COALESCED) m_eventsCoalescedQueued.fetch_and(~event);
+			event = EVENT_NONE;
+		}
+	}
+}
+
+EVENT_t Flow::waitForEvent(const int timeoutMs)
+{
+	struct timespec deadline;
+	if (timeoutMs >= 0) {
+		// pthread_cond_timedwait() takes an absolute time on the realtime clock.
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		long nsec = now.tv_usec*1000L + (timeoutMs % 1000)*1000000L;
+		deadline.tv_sec = now.tv_sec + timeoutMs/1000 + nsec/1000000000L;
+		deadline.tv_nsec = nsec % 1000000000L;
+	}
+
+	bool timedOut = false;
+	while (!m_stop) {
+		EVENT_t event;
+		while (popEvent(&event)) {
+			if (event == EVENT_NONE) continue; // Blanked by ignoreQueuedEvents().
+			if (event & m_eventMask) return (event);
+			ARLOGd("Flow ignoring event %d.\n", (int)event);
+		}
+		if (timedOut) break;
+
+		pthread_mutex_lock(&m_eventLock);
+		while (m_eventQueueHead.load() == m_eventQueueTail.load() && !m_stop && !timedOut) {
+			if (timeoutMs < 0) pthread_cond_wait(&m_eventCond, &m_eventLock);
+			else timedOut = (pthread_cond_timedwait(&m_eventCond, &m_eventLock, &deadline) == ETIMEDOUT);
+		}
+		pthread_mutex_unlock(&m_eventLock);
+	}
+
+	return (EVENT_NONE);
+}
+
+int Flow::calibImageCount(void) {return (m_stereoCalib ? m_stereoCalib->calibImageCount() : m_calib->calibImageCount()); }
+int Flow::calibImageCountMax(void) {return (m_stereoCalib ? m_stereoCalib->calibImageCountMax() : m_calib->calibImageCountMax()); }
+bool Flow::autoCaptureEnabled(void) {return (m_stereoCalib ? m_stereoCalib->autoCaptureEnabled() : m_calib->autoCaptureEnabled()); }
+bool Flow::capture(const bool automatic) {return (m_stereoCalib ? m_stereoCalib->capture(automatic) : m_calib->capture(automatic)); }
+bool Flow::uncapture(void) {return (m_stereoCalib ? m_stereoCalib->uncapture() : m_calib->uncapture()); }
+bool Flow::uncaptureAll(void) {return (m_stereoCalib ? m_stereoCalib->uncaptureAll() : m_calib->uncaptureAll()); }
+bool Flow::solverConverged(void) {return (m_stereoCalib ? m_stereoCalib->solverConverged() : m_calib->solverConverged()); }
 
+// static
+void *Flow::flowThread(void *arg)
+{
+    Flow *flow = (Flow *)arg;
+    
     ARLOGi("Start flow thread.\n");
+    
+    flow->run();
+    
+    flow->statusBarMessageSet(NULL);
+    
+    ARLOGi("End flow thread.\n");
+    
+	flow->m_threadExitStatus = 1; // Put the exit status into the instance.
+	return (&flow->m_threadExitStatus); // Pass a pointer to it as our exit status.
+}
 
-    // Register our cleanup function, with no arg.
-	pthread_cleanup_push(flowThreadCleanup, NULL);
+void Flow::run()
+{
+	bool captureDoneSinceBackButtonLastPressed;
+	EVENT_t event;
 
 	// Welcome.
-	flowStateSet(FLOW_STATE_WELCOME);
+	stateSet(FLOW_STATE_WELCOME);
 
-	while (!gStop) {
+	while (!m_stop) {
 
-		if (flowStateGet() == FLOW_STATE_WELCOME) {
-			EdenMessageShow((const unsigned char *)"Welcome to ARToolKit Camera Calibrator\n(c)2017 DAQRI LLC.\n\nPress 'space' to begin a calibration run.\n\nPress 'p' for settings and help.");
+		if (state() == FLOW_STATE_WELCOME) {
+			messageShow("Welcome to ARToolKit Camera Calibrator\n(c)2017 DAQRI LLC.\n\nPress 'space' to begin a calibration run.\n\nPress 'a' to toggle automatic capture.\n\nPress 'p' for settings and help.");
 		} else {
-			EdenMessageShow((const unsigned char *)"Press 'space' to begin a calibration run.\n\nPress 'p' for settings and help.");
+			messageShow("Press 'space' to begin a calibration run.\n\nPress 'a' to toggle automatic capture.\n\nPress 'p' for settings and help.");
 		}
-		flowSetEventMask((EVENT_t)(EVENT_TOUCH | EVENT_MODAL));
-		event = flowWaitForEvent();
-		if (gStop) break;
+		// With automatic capture on, presenting the pattern also begins the first run. After a run, a press is needed,
+		// so that holding the pattern up to the undistorted preview doesn't begin another.
+		setEventMask((EVENT_t)(EVENT_TOUCH | EVENT_MODAL | (state() == FLOW_STATE_WELCOME ? EVENT_AUTO_CAPTURE : EVENT_NONE)));
+		event = waitForEvent();
+		if (m_stop) break;
         
         if (event == EVENT_MODAL) {
-            flowSetEventMask(EVENT_MODAL);
-            event = flowWaitForEvent();
+            // Out of the way of the modal dialog until it is dismissed.
+            messageHide();
+            setEventMask(EVENT_MODAL);
+            event = waitForEvent();
             continue;
         } else {
-            EdenMessageHide();
+            messageHide();
         }
 
 		// Start capturing.
 		captureDoneSinceBackButtonLastPressed = false;
-		flowStateSet(FLOW_STATE_CAPTURING);
-		flowSetEventMask((EVENT_t)(EVENT_TOUCH|EVENT_BACK_BUTTON));
+		bool finishedEarly = false;
+		stateSet(FLOW_STATE_CAPTURING);
+		setEventMask((EVENT_t)(EVENT_TOUCH|EVENT_BACK_BUTTON|EVENT_AUTO_CAPTURE|EVENT_FINISH));
 
 		do {
-			snprintf((char *)statusBarMessage, STATUS_BAR_MESSAGE_BUFFER_LEN, "Capturing image %d/%d", gFlowCalib->calibImageCount() + 1, gFlowCalib->calibImageCountMax());
-			event = flowWaitForEvent();
-			if (gStop) break;
-			if (event == EVENT_TOUCH) {
-
-				if (gFlowCalib->capture()) {
+			char statusBarBuf[128];
+			snprintf(statusBarBuf, sizeof(statusBarBuf), "Capturing image %d/%d%s", calibImageCount() + 1, calibImageCountMax(), (autoCaptureEnabled() ? " (automatic)" : ""));
+			statusBarMessageSet(statusBarBuf);
+			// Wake now and then to refresh the status bar, which shows settings that change without an event.
+			event = waitForEvent(FLOW_STATUS_BAR_REFRESH_MS);
+			if (m_stop) break;
+			if (event == EVENT_TOUCH || event == EVENT_AUTO_CAPTURE) {
+
+				if (capture(event == EVENT_AUTO_CAPTURE)) {
 			    	captureDoneSinceBackButtonLastPressed = true;
 				}
 
 			} else if (event == EVENT_BACK_BUTTON) {
 
 				if (!captureDoneSinceBackButtonLastPressed) {
-                    gFlowCalib->uncaptureAll();
+                    uncaptureAll();
                     break;
 				} else {
-					gFlowCalib->uncapture();
+					uncapture();
 				}
 				captureDoneSinceBackButtonLastPressed = false;
+			} else if (event == EVENT_FINISH) {
+
+				if (solverConverged()) {
+					finishedEarly = true;
+					break;
+				}
 			}
 
-		} while (gFlowCalib->calibImageCount() < gFlowCalib->calibImageCountMax());
+		} while (calibImageCount() < calibImageCountMax());
 
 		// Clear status bar.
-		statusBarMessage[0] = '\0';
-
-		if (gFlowCalib->calibImageCount() < gFlowCalib->calibImageCountMax()) {
-
-			flowSetEventMask(EVENT_TOUCH);
-            flowStateSet(FLOW_STATE_DONE);
-			EdenMessageShow((const unsigned char *)"Calibration canceled");
-			flowWaitForEvent();
-			if (gStop) break;
-			EdenMessageHide();
+		statusBarMessageSet(NULL);
+
+		if (calibImageCount() < calibImageCountMax() && !finishedEarly) {
+
+			setEventMask(EVENT_TOUCH);
+            stateSet(FLOW_STATE_DONE);
+			messageShow("Calibration canceled");
+			waitForEvent();
+			if (m_stop) break;
+			messageHide();
+
+		} else if (m_stereoCalib) {
+			ARParam paramL, paramR;
+			ARdouble transL2R[3][4];
+			ARdouble errL, errR, errStereo;
+
+			setEventMask(EVENT_NONE);
+			stateSet(FLOW_STATE_CALIBRATING);
+			messageShow("Calculating camera parameters...");
+			bool ok = m_stereoCalib->calib(&paramL, &paramR, transL2R, &errL, &errR, &errStereo);
+			messageHide();
+
+			if (ok && m_stereoCallback) (*m_stereoCallback)(&paramL, &paramR, transL2R, errL, errR, errStereo, m_callbackUserdata);
+			m_stereoCalib->uncaptureAll(); // prepare for next run.
+			ignoreQueuedEvents(EVENT_TOUCH); // A press made while calculating mustn't dismiss the results unseen.
+
+			setEventMask(EVENT_TOUCH);
+			stateSet(FLOW_STATE_DONE);
+			if (ok) {
+				char *buf;
+				asprintf(&buf, "Stereo parameters calculated (error left avg=%.3f, right avg=%.3f, stereo rms=%.3f)\nBaseline %.1f", errL, errR, errStereo,
+                         sqrt(transL2R[0][3]*transL2R[0][3] + transL2R[1][3]*transL2R[1][3] + transL2R[2][3]*transL2R[2][3]));
+				messageShow(buf);
+				free(buf);
+			} else {
+				messageShow("Stereo calibration failed");
+			}
+			waitForEvent();
+			if (m_stop) break;
+			messageHide();
 
 		} else {
 			ARParam param;
 			ARdouble err_min, err_avg, err_max;
 
-			flowSetEventMask(EVENT_NONE);
-			flowStateSet(FLOW_STATE_CALIBRATING);
-			EdenMessageShow((const unsigned char *)"Calculating camera parameters...");
-			gFlowCalib->calib(&param, &err_min, &err_avg, &err_max);
-    		EdenMessageHide();
+			setEventMask(EVENT_NONE);
+			stateSet(FLOW_STATE_CALIBRATING);
+			messageShow("Calculating camera parameters...");
+			m_calib->calib(&param, &err_min, &err_avg, &err_max);
+    		messageHide();
 
-            if (gCallback) (*gCallback)(&param, err_min, err_avg, err_max, gCallbackUserdata);
-            gFlowCalib->uncaptureAll(); // prepare for next run.
+            if (m_callback) (*m_callback)(&param, err_min, err_avg, err_max, m_callbackUserdata);
+            m_calib->uncaptureAll(); // prepare for next run.
+			ignoreQueuedEvents(EVENT_TOUCH); // A press made while calculating mustn't dismiss the results unseen.
 
 			// Calibration complete. Post results as status.
-			flowSetEventMask(EVENT_TOUCH);
-			flowStateSet(FLOW_STATE_DONE);
-			unsigned char *buf;
-			asprintf((char **)&buf, "Camera parameters calculated (error min=%.3f, avg=%.3f, max=%.3f)", err_min, err_avg, err_max);
-			EdenMessageShow(buf);
+			setEventMask(EVENT_TOUCH);
+			stateSet(FLOW_STATE_DONE);
+			char *buf;
+			Calibration::Uncertainty uncertainty;
+			if (m_calib->calibUncertainty(&uncertainty)) {
+				asprintf(&buf, "Camera parameters calculated (error min=%.3f, avg=%.3f, max=%.3f)\nStd. dev.: fx %.2f, fy %.2f, x0 %.2f, y0 %.2f px; k1 %.4f, k2 %.4f, p1 %.5f, p2 %.5f",
+                         err_min, err_avg, err_max,
+                         uncertainty.distFactorStdDev[4], uncertainty.distFactorStdDev[5], uncertainty.distFactorStdDev[6], uncertainty.distFactorStdDev[7],
+                         uncertainty.distFactorStdDev[0], uncertainty.distFactorStdDev[1], uncertainty.distFactorStdDev[2], uncertainty.distFactorStdDev[3]);
+			} else {
+				asprintf(&buf, "Camera parameters calculated (error min=%.3f, avg=%.3f, max=%.3f)", err_min, err_avg, err_max);
+			}
+			messageShow(buf);
 			free(buf);
-			flowWaitForEvent();
-			if (gStop) break;
-			EdenMessageHide();
+			waitForEvent();
+			if (m_stop) break;
+			messageHide();
 
 		}
-
-		//pthread_testcancel(); // Not implemented on Android.
-	} // while (!gStop);
-    
-	pthread_cleanup_pop(1); // Unlocks gStateLock.
-
-    ARLOGi("End flow thread.\n");
-
-	gThreadExitStatus = 1; // Put the exit status into a global
-	return (&gThreadExitStatus); // Pass a pointer to the global as our exit status.
+	} // while (!m_stop);
 }
-
-
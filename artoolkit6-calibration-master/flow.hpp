@@ -26,12 +26,18 @@
 #pragma once
 
 #include "Calibration.hpp"
+#include "StereoCalibration.hpp"
 
-extern unsigned char statusBarMessage[];
+#include <string>
+#include <atomic>
+#include <pthread.h>
 
 // Called when the flow has completed and generated a calibration.
 typedef void (*FLOW_CALLBACK_t)(const ARParam *param, ARdouble err_min, ARdouble err_avg, ARdouble err_max, void *userdata);
 
+// Called when a stereo flow has completed and generated a calibration of both cameras and the transform between them.
+typedef void (*FLOW_STEREO_CALLBACK_t)(const ARParam *paramL, const ARParam *paramR, ARdouble transL2R[3][4], ARdouble errL, ARdouble errR, ARdouble errStereo, void *userdata);
+
 typedef enum {
 	FLOW_STATE_NOT_INITED = 0,
 	FLOW_STATE_WELCOME,
@@ -44,13 +50,91 @@ typedef enum {
 	EVENT_NONE = 0,
 	EVENT_TOUCH = 1,
 	EVENT_BACK_BUTTON = 2,
-    EVENT_MODAL = 4
+    EVENT_MODAL = 4,
+    EVENT_AUTO_CAPTURE = 8, // The calibration's latest results are ready for automatic capture.
+    EVENT_FINISH = 16 // Finish capturing early. Honoured only once the background calibration has converged.
 } EVENT_t;
 
-bool flowInitAndStart(Calibration *calib, FLOW_CALLBACK_t callback, void *callback_userdata);
-
-FLOW_STATE flowStateGet();
+// Events which report a condition rather than a user action. While one is queued, sending it again does nothing.
+#define FLOW_EVENTS_COALESCED EVENT_AUTO_CAPTURE
 
-bool flowHandleEvent(const EVENT_t event);
+#define FLOW_EVENT_QUEUE_SIZE 16 // Must be a power of 2.
 
-bool flowStopAndFinal();
+// The calibration flow: a state machine, run on its own thread, which takes the user from a welcome message,
+// through capture of the calibration images, to calculation of the parameters. Each Flow drives one calibration
+// and has its own state and messages, so several cameras can each be calibrated by a Flow at the same time.
+class Flow
+{
+public:
+    Flow(Calibration *calib, FLOW_CALLBACK_t callback, void *callback_userdata);
+    // As above, but each capture is of a pair of views, one from each camera.
+    Flow(StereoCalibration *calib, FLOW_STEREO_CALLBACK_t callback, void *callback_userdata);
+    ~Flow(); // Stops the flow if it is running.
+    
+    bool start();
+    bool stop(); // Waits for the flow to reach a point where it can stop, e.g. for a calibration to finish.
+    FLOW_STATE state();
+    // Queue an event for the flow. Events are taken in the order sent. Those the flow has no use for when it
+    // takes them are ignored. Returns false if the flow is not running, or the queue is full. Must always be
+    // called from the same thread.
+    bool handleEvent(const EVENT_t event);
+    
+    // The flow's messages to the user, for the caller to draw: a message box, and a line for the status bar. Each
+    // copies the current text into buf (truncated to len bytes, including the terminator) and returns false if
+    // there is none. May be called from any thread.
+    bool message(char *buf, const size_t len);
+    bool statusBarMessage(char *buf, const size_t len);
+    
+private:
+    Flow(const Flow&) = delete; // No copy construction.
+    Flow& operator=(const Flow&) = delete; // No copy assignment.
+    
+    static void *flowThread(void *arg);
+    void run();
+    void stateSet(FLOW_STATE state);
+    void setEventMask(const EVENT_t eventMask);
+    // Wait for an event in the event mask, for at most timeoutMs milliseconds if timeoutMs is not negative.
+    // Returns EVENT_NONE on timeout, or if the flow is stopping.
+    EVENT_t waitForEvent(const int timeoutMs = -1);
+    bool popEvent(EVENT_t *event_p);
+    void ignoreQueuedEvents(const EVENT_t events); // Drop queued events of these types, keeping the rest.
+    void messageShow(const char *text);
+    void messageHide();
+    void statusBarMessageSet(const char *text); // NULL to clear.
+    
+    // Captures go to whichever calibration the flow was constructed with.
+    int calibImageCount();
+    int calibImageCountMax();
+    bool autoCaptureEnabled();
+    bool capture(const bool automatic);
+    bool uncapture();
+    bool uncaptureAll();
+    bool solverConverged();
+    
+    // Calibration inputs. One of these is set.
+    Calibration         *m_calib;
+    StereoCalibration   *m_stereoCalib;
+    
+    // Completion callback.
+    FLOW_CALLBACK_t      m_callback;
+    FLOW_STEREO_CALLBACK_t m_stereoCallback;
+    void                *m_callbackUserdata;
+    
+    bool                 m_running;
+    FLOW_STATE           m_state;
+    pthread_mutex_t      m_stateLock; // Guards m_state and the message texts.
+    std::string          m_message; // Empty when no message is shown.
+    std::string          m_statusBarMessage;
+    // Single-producer, single-consumer ring of events. The caller of handleEvent() advances the tail, and the flow
+    // thread the head. The lock and condition are only for the flow thread to sleep on while the ring is empty.
+    EVENT_t              m_eventQueue[FLOW_EVENT_QUEUE_SIZE];
+    std::atomic<unsigned int> m_eventQueueHead;
+    std::atomic<unsigned int> m_eventQueueTail;
+    std::atomic<int>     m_eventsCoalescedQueued; // FLOW_EVENTS_COALESCED events in the ring.
+    pthread_mutex_t      m_eventLock;
+    pthread_cond_t       m_eventCond;
+    EVENT_t              m_eventMask; // Used only on the flow thread.
+    pthread_t            m_thread;
+    int                  m_threadExitStatus;
+    std::atomic<bool>    m_stop;
+};
@@ -74,6 +74,7 @@ enum {
 
 #define      CALIB_IMAGE_NUM               10
 #define      SAVE_FILENAME                 "camera_para.dat"
+#define      CALIB_UNCERTAINTY_SAMPLES     32 // Bootstrap resamples for the standard deviations of the camera parameters. 0 to disable.
 
 // Data upload.
 #define QUEUE_DIR "queue"
@@ -129,6 +130,8 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
     //
     
     Calibration *gCalibration;
+    Flow *gFlow;
+    char gFlowMessageShown[1024]; // The flow message last passed to EdenMessageShow(), or empty.
     
     //
     // Data upload.
@@ -199,6 +202,8 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
     gCalibrationServerUploadURL = NULL;
     gCalibrationServerAuthenticationToken = NULL;
     gCalibration = nullptr;
+    gFlow = nullptr;
+    gFlowMessageShown[0] = '\0';
     gFileUploadQueuePath = NULL;
     fileUploadHandle = NULL;
     vs = nullptr;
@@ -466,7 +471,14 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
     gGotFrame = FALSE;
 
     // Stop calibration flow.
-    flowStopAndFinal();
+    if (gFlow) {
+        delete gFlow;
+        gFlow = nullptr;
+    }
+    if (gFlowMessageShown[0]) {
+        EdenMessageHide();
+        gFlowMessageShown[0] = '\0';
+    }
     
     if (gCalibration) {
         delete gCalibration;
@@ -822,8 +834,10 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
                 ARLOGe("Error initialising calibration.\n");
                 exit (-1);
             }
+            gCalibration->setCalibUncertainty(Calibration::UncertaintyMethod::BOOTSTRAP, CALIB_UNCERTAINTY_SAMPLES);
             
-            if (!flowInitAndStart(gCalibration, saveParam, (__bridge void *)self)) {
+            gFlow = new Flow(gCalibration, saveParam, (__bridge void *)self);
+            if (!gFlow->start()) {
                 ARLOGe("Error: Could not initialise and start flow.\n");
                 //quit(-1);
             }
@@ -840,7 +854,7 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
             vv->getViewport(gViewport);
         }
         
-        FLOW_STATE state = flowStateGet();
+        FLOW_STATE state = (gFlow ? gFlow->state() : FLOW_STATE_NOT_INITED);
         if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
             
             // Upload the frame to OpenGL.
@@ -866,7 +880,7 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
     //
     glViewport(gViewport[0], gViewport[1], gViewport[2], gViewport[3]);
     
-    FLOW_STATE state = flowStateGet();
+    FLOW_STATE state = (gFlow ? gFlow->state() : FLOW_STATE_NOT_INITED);
     if (state == FLOW_STATE_WELCOME || state == FLOW_STATE_DONE || state == FLOW_STATE_CALIBRATING) {
         
         // Display the current frame
@@ -874,11 +888,12 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
         
     } else if (state == FLOW_STATE_CAPTURING) {
         
-        // Grab a lock while we're using the data to prevent it being changed underneath us.
+        // Get the latest results. They won't change underneath us until we release them.
         int cornerFoundAllFlag;
-        std::vector<cv::Point2f> corners;
+        const std::vector<cv::Point2f> *cornersPtr;
         ARUint8 *videoFrame;
-        gCalibration->cornerFinderResultsLockAndFetch(&cornerFoundAllFlag, corners, &videoFrame);
+        gCalibration->cornerFinderResultsAcquire(&cornerFoundAllFlag, &cornersPtr, &videoFrame);
+        const std::vector<cv::Point2f>& corners = *cornersPtr;
         
         // Display the current frame.
         if (videoFrame) arglPixelBufferDataUpload(gArglSettingsCornerFinderImage, videoFrame);
@@ -942,7 +957,7 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
             EdenGLFontSetColor(colorWhite);
         }
         
-        gCalibration->cornerFinderResultsUnlock();
+        gCalibration->cornerFinderResultsRelease();
         
         if (vertexCount > 0) {
             glUseProgram(program);
@@ -995,7 +1010,8 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
     float statusBarHeight = EdenGLFontGetHeight() + 4.0f; // 2 pixels above, 2 below.
   
     // Draw status bar with centred status message.
-    if (statusBarMessage[0]) {
+    unsigned char statusBarMessage[128];
+    if (gFlow && gFlow->statusBarMessage((char *)statusBarMessage, sizeof(statusBarMessage))) {
         [self drawBackgroundWidth:right height:statusBarHeight x:0.0f y:0.0f border:false projection:p];
         glStateCacheDisableBlend();
         EdenGLFontDrawLine(0, p, statusBarMessage, 0.0f, 2.0f, H_OFFSET_VIEW_CENTER_TO_TEXT_CENTER, V_OFFSET_VIEW_BOTTOM_TO_TEXT_BASELINE);
@@ -1019,6 +1035,18 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
         }
     }
     
+    // The flow's message is shown in the Eden message box, updated only when it changes.
+    char flowMessage[sizeof(gFlowMessageShown)];
+    if (gFlow && gFlow->message(flowMessage, sizeof(flowMessage))) {
+        if (strcmp(flowMessage, gFlowMessageShown) != 0) {
+            EdenMessageShow((const unsigned char *)flowMessage);
+            strncpy(gFlowMessageShown, flowMessage, sizeof(gFlowMessageShown));
+        }
+    } else if (gFlowMessageShown[0]) {
+        EdenMessageHide();
+        gFlowMessageShown[0] = '\0';
+    }
+    
     // If a message should be onscreen, draw it.
     if (gEdenMessageDrawRequired) EdenMessageDraw(0, p);
 }
@@ -1220,6 +1248,15 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
             fprintf(fp, "err_max,%s\n", err_max_ascii);
         }
         
+        // Standard deviations of the camera parameters, if estimated.
+        Calibration::Uncertainty uncertainty;
+        if (goodWrite && gCalibration->calibUncertainty(&uncertainty)) {
+            const char *dist_factor_names[9] = {"k1", "k2", "p1", "p2", "fx", "fy", "x0", "y0", "s"};
+            fprintf(fp, "dist_factor_sd_method,%s\n", (uncertainty.method == Calibration::UncertaintyMethod::BOOTSTRAP ? "bootstrap" : "kfold"));
+            fprintf(fp, "dist_factor_sd_samples,%d\n", uncertainty.sampleCount);
+            for (i = 0; i < 9; i++) fprintf(fp, "dist_factor_sd_%s,%f\n", dist_factor_names[i], uncertainty.distFactorStdDev[i]);
+        }
+        
         // IP address will be derived from connect.
         
         // Hash the shared secret.
@@ -1270,11 +1307,11 @@ static void saveParam(const ARParam *param, ARdouble err_min, ARdouble err_avg,
 #pragma mark - User interaction methods.
 
 - (IBAction)handleBackButton:(id)sender {
-    flowHandleEvent(EVENT_BACK_BUTTON);
+    if (gFlow) gFlow->handleEvent(EVENT_BACK_BUTTON);
 }
 
 - (IBAction)handleAddButton:(id)sender {
-    flowHandleEvent(EVENT_TOUCH);
+    if (gFlow) gFlow->handleEvent(EVENT_TOUCH);
 }
 
 - (IBAction)handleMenuButton:(id)sender {
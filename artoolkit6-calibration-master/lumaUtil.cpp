@@ -0,0 +1,162 @@
+/*
+ *  lumaUtil.cpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "lumaUtil.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define LUMA_UTIL_SSE2 1
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#  define LUMA_UTIL_NEON 1
+#  include <arm_neon.h>
+#endif
+
+void lumaUtilDownsample2x(const uint8_t *src, const int srcWidth, const int srcHeight, const int srcStride, uint8_t *dst, const int dstStride)
+{
+    const int dstWidth = srcWidth / 2;
+    const int dstHeight = srcHeight / 2;
+    
+    for (int j = 0; j < dstHeight; j++) {
+        const uint8_t *row0 = src + (2*j)*srcStride;
+        const uint8_t *row1 = row0 + srcStride;
+        uint8_t *out = dst + j*dstStride;
+        int i = 0;
+#if LUMA_UTIL_SSE2
+        // 32 source pixels from each row make 16 destination pixels.
+        const __m128i maskLo = _mm_set1_epi16(0x00ff);
+        const __m128i two = _mm_set1_epi16(2);
+        for (; i + 16 <= dstWidth; i += 16) {
+            __m128i a0 = _mm_loadu_si128((const __m128i *)(row0 + 2*i));
+            __m128i a1 = _mm_loadu_si128((const __m128i *)(row0 + 2*i + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i *)(row1 + 2*i));
+            __m128i b1 = _mm_loadu_si128((const __m128i *)(row1 + 2*i + 16));
+            // Sum even and odd columns of both rows as 16-bit values.
+            __m128i s0 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a0, maskLo), _mm_srli_epi16(a0, 8)), _mm_add_epi16(_mm_and_si128(b0, maskLo), _mm_srli_epi16(b0, 8)));
+            __m128i s1 = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, maskLo), _mm_srli_epi16(a1, 8)), _mm_add_epi16(_mm_and_si128(b1, maskLo), _mm_srli_epi16(b1, 8)));
+            s0 = _mm_srli_epi16(_mm_add_epi16(s0, two), 2);
+            s1 = _mm_srli_epi16(_mm_add_epi16(s1, two), 2);
+            _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(s0, s1));
+        }
+#elif LUMA_UTIL_NEON
+        // 16 source pixels from each row make 8 destination pixels.
+        for (; i + 8 <= dstWidth; i += 8) {
+            uint16x8_t s = vpaddlq_u8(vld1q_u8(row0 + 2*i));
+            s = vpadalq_u8(s, vld1q_u8(row1 + 2*i));
+            vst1_u8(out + i, vrshrn_n_u16(s, 2));
+        }
+#endif
+        for (; i < dstWidth; i++) {
+            out[i] = (uint8_t)((row0[2*i] + row0[2*i + 1] + row1[2*i] + row1[2*i + 1] + 2) >> 2);
+        }
+    }
+}
+
+float lumaUtilGradientEnergy(const uint8_t *src, const int width, const int height, const int stride, const int rowStep, float *variance_out)
+{
+    if (variance_out) *variance_out = 0.0f;
+    if (width < 2 || height < 2 || rowStep < 1) return 0.0f;
+    
+    // The last column and row have no right or lower neighbour.
+    const int sampleWidth = width - 1;
+    uint64_t sum = 0;
+    uint64_t lumaSum = 0, lumaSumSq = 0; // Of the sampled pixels themselves, for the variance.
+    int rows = 0;
+    
+    for (int j = 0; j < height - 1; j += rowStep) {
+        const uint8_t *row0 = src + j*stride;
+        const uint8_t *row1 = row0 + stride;
+        int i = 0;
+        // Row sums fit in 32 bits for widths up to 2^32 / (2 * 255^2), about 33000 pixels.
+        uint32_t rowSum = 0, rowLumaSum = 0, rowLumaSumSq = 0;
+#if LUMA_UTIL_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = _mm_setzero_si128();
+        __m128i accLuma = _mm_setzero_si128(), accLumaSq = _mm_setzero_si128();
+        for (; i + 16 <= sampleWidth; i += 16) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(row0 + i));
+            __m128i r = _mm_loadu_si128((const __m128i *)(row0 + i + 1));
+            __m128i d = _mm_loadu_si128((const __m128i *)(row1 + i));
+            // Absolute differences of unsigned bytes, then squared and pairwise summed in 32 bits.
+            __m128i dx = _mm_or_si128(_mm_subs_epu8(p, r), _mm_subs_epu8(r, p));
+            __m128i dy = _mm_or_si128(_mm_subs_epu8(p, d), _mm_subs_epu8(d, p));
+            __m128i dxLo = _mm_unpacklo_epi8(dx, zero), dxHi = _mm_unpackhi_epi8(dx, zero);
+            __m128i dyLo = _mm_unpacklo_epi8(dy, zero), dyHi = _mm_unpackhi_epi8(dy, zero);
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(dxLo, dxLo), _mm_madd_epi16(dxHi, dxHi)));
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(dyLo, dyLo), _mm_madd_epi16(dyHi, dyHi)));
+            __m128i pLo = _mm_unpacklo_epi8(p, zero), pHi = _mm_unpackhi_epi8(p, zero);
+            accLuma = _mm_add_epi64(accLuma, _mm_sad_epu8(p, zero));
+            accLumaSq = _mm_add_epi32(accLumaSq, _mm_add_epi32(_mm_madd_epi16(pLo, pLo), _mm_madd_epi16(pHi, pHi)));
+        }
+        acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+        acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+        rowSum = (uint32_t)_mm_cvtsi128_si32(acc);
+        accLuma = _mm_add_epi64(accLuma, _mm_srli_si128(accLuma, 8));
+        rowLumaSum = (uint32_t)_mm_cvtsi128_si32(accLuma);
+        accLumaSq = _mm_add_epi32(accLumaSq, _mm_srli_si128(accLumaSq, 8));
+        accLumaSq = _mm_add_epi32(accLumaSq, _mm_srli_si128(accLumaSq, 4));
+        rowLumaSumSq = (uint32_t)_mm_cvtsi128_si32(accLumaSq);
+#elif LUMA_UTIL_NEON
+        uint32x4_t acc = vdupq_n_u32(0);
+        uint32x4_t accLuma = vdupq_n_u32(0), accLumaSq = vdupq_n_u32(0);
+        for (; i + 16 <= sampleWidth; i += 16) {
+            uint8x16_t p = vld1q_u8(row0 + i);
+            accLuma = vpadalq_u16(accLuma, vpaddlq_u8(p));
+            accLumaSq = vpadalq_u16(accLumaSq, vmull_u8(vget_low_u8(p), vget_low_u8(p)));
+            accLumaSq = vpadalq_u16(accLumaSq, vmull_u8(vget_high_u8(p), vget_high_u8(p)));
+            uint8x16_t dx = vabdq_u8(p, vld1q_u8(row0 + i + 1));
+            uint8x16_t dy = vabdq_u8(p, vld1q_u8(row1 + i));
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(dx), vget_low_u8(dx)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(dx), vget_high_u8(dx)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(dy), vget_low_u8(dy)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(dy), vget_high_u8(dy)));
+        }
+        uint64x2_t acc2 = vpaddlq_u32(acc);
+        rowSum = (uint32_t)(vgetq_lane_u64(acc2, 0) + vgetq_lane_u64(acc2, 1));
+        acc2 = vpaddlq_u32(accLuma);
+        rowLumaSum = (uint32_t)(vgetq_lane_u64(acc2, 0) + vgetq_lane_u64(acc2, 1));
+        acc2 = vpaddlq_u32(accLumaSq);
+        rowLumaSumSq = (uint32_t)(vgetq_lane_u64(acc2, 0) + vgetq_lane_u64(acc2, 1));
+#endif
+        for (; i < sampleWidth; i++) {
+            const int dx = row0[i + 1] - row0[i];
+            const int dy = row1[i] - row0[i];
+            rowSum += (uint32_t)(dx*dx + dy*dy);
+            rowLumaSum += row0[i];
+            rowLumaSumSq += (uint32_t)(row0[i]*row0[i]);
+        }
+        sum += rowSum;
+        lumaSum += rowLumaSum;
+        lumaSumSq += rowLumaSumSq;
+        rows++;
+    }
+    
+    const double n = (double)rows * (double)sampleWidth;
+    if (variance_out) {
+        const double mean = (double)lumaSum / n;
+        *variance_out = (float)std::max((double)lumaSumSq / n - mean*mean, 0.0);
+    }
+    
+    return (float)((double)sum / n);
+}
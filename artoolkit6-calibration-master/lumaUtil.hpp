@@ -0,0 +1,43 @@
+/*
+ *  lumaUtil.hpp
+ *  ARToolKit6 Camera Calibration Utility
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  Copyright 2017-2017 Daqri LLC. All Rights Reserved.
+ *
+ *  Author(s): Philip Lamb
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+// Low-level operations on 8-bit luma (greyscale) images. Where available, SSE2 (x86) or NEON (ARM)
+// implementations are used, with a scalar fallback.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Halve the width and height of a luma image, each destination pixel being the rounded average of the
+// corresponding 2x2 block of source pixels. The destination must be at least srcWidth/2 x srcHeight/2 pixels.
+// An odd final source row or column is ignored.
+void lumaUtilDownsample2x(const uint8_t *src, const int srcWidth, const int srcHeight, const int srcStride, uint8_t *dst, const int dstStride);
+
+// Measure the sharpness of a luma image as its gradient energy: the mean, over sampled pixels, of the squared
+// differences between each pixel and its right and lower neighbours. Only every rowStep-th row is sampled.
+// Blur (from defocus or motion) spreads edges out and lowers the score. Returns 0 if the image is too small.
+// If variance_out is non-NULL, it receives the variance of the sampled pixels, by which the gradient energy can be
+// divided to remove its dependence on image contrast.
+float lumaUtilGradientEnergy(const uint8_t *src, const int width, const int height, const int stride, const int rowStep, float *variance_out = NULL);
@@ -36,7 +36,6 @@
 #include <Eden/EdenMessage.h>
 #include <pthread.h>
 #include <AR6/ARVideo/video.h>
-#include "flow.hpp"
 #include <AR6/ARUtil/file_utils.h>
 #include "calib_camera.h"
 
@@ -150,6 +149,18 @@ void showPreferences(void *preferences)
     pthread_attr_destroy(&pta);
 }
 
+// Tell the main thread the preferences are being shown or hidden, so that it can pause or resume every camera's flow.
+static void pushModalEvent(void)
+{
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = gSDLEventPreferencesModal;
+    event.user.code = (Sint32)0;
+    event.user.data1 = NULL;
+    event.user.data2 = NULL;
+    SDL_PushEvent(&event);
+}
+
 void *showPreferencesThread(void *arg)
 {
     enum state {
@@ -178,7 +189,7 @@ void *showPreferencesThread(void *arg)
         return (NULL);
     }
     
-    flowHandleEvent(EVENT_MODAL);
+    pushModalEvent();
     
     while (state != PREFS_END) {
         if (state == PREFS_BEGIN) {
@@ -437,7 +448,7 @@ void *showPreferencesThread(void *arg)
         ARLOGe("Error writing configuration file '%s': %s.\n", prefs->prefsPath, config_error_text(&prefs->config));
     }
         
-    flowHandleEvent(EVENT_MODAL);
+    pushModalEvent();
     
     SDL_Event event;
     SDL_zero(event);